@@ -0,0 +1,1032 @@
+/*
+  ==============================================================================
+
+    This file contains the headless benchmark for the recorder's processor.
+
+    It drives prepareToPlay/processBlock with synthetic audio and midi while
+    recording, and reports per-callback latency percentiles, writer throughput
+    and dropped samples/events for each configuration. It also measures the
+    writer-thread cost of each WAV sample format, the throughput and CPU
+    cost of each way of getting a WAV file to disk, how compressed encoding
+    scales with the number of encoder threads, how many instances can
+    record at once on the shared writer threads, and how many tracks can
+    stream back from disk at once without the playback running dry.
+
+    With --stress it only runs the start/stop stress test instead: the audio
+    callback runs on its own thread while the main thread keeps starting,
+    arming, overdubbing and stopping takes as fast as it can. It exits with
+    an error if any callback took longer than the block period.
+
+    Usage:
+        ProcessorBenchmark [--seconds=2] [--freewheel] [--csv] [--stress]
+                           [--block-sizes=16,256,4096] [--sample-rates=48000,192000]
+                           [--channels=2,32] [--formats=wav,ogg] [--formats-only]
+                           [--backends=buffered,preallocated,direct,mapped]
+                           [--encoders=ogg,flac] [--encoder-threads=1,2,4]
+                           [--channels-per-encoder=2] [--instances=1,16,64] [--no-groups]
+                           [--no-overviews] [--tracks=1,16,64] [--prefetch=2]
+
+    Use --formats=memory to record to memory instead of a file, which also
+    reports the compression ratio and memory used.
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include <time.h>
+#include "../../Source/PluginProcessor.h"
+
+//==============================================================================
+struct BenchmarkOptions
+{
+    double seconds = 2.0;
+    bool realtime = true, csv = false, formatsOnly = false, stressOnly = false;
+
+    Array<int> blockSizes   { 16, 256, 4096 };
+    Array<int> sampleRates  { 48000, 192000 };
+    Array<int> channelCounts { 2, 32 };
+    StringArray formats, backends, encoders;
+    Array<int> encoderThreads;
+    Array<int> instanceCounts { 1, 16, 64 };
+    Array<int> trackCounts { 1, 16, 64 };
+    bool grouped = true, overviews = true;
+    int channelsPerEncoder = 2;
+    double prefetchSeconds = 2.0;
+
+    BenchmarkOptions()
+    {
+        encoders.add ("ogg");
+        encoders.add ("flac");
+
+        // 1, 2, 4 ... up to the number of cores
+        for (int n = 1; n < SystemStats::getNumCpus(); n *= 2)
+            encoderThreads.add (n);
+
+        encoderThreads.add (SystemStats::getNumCpus());
+
+        formats.add ("wav");
+        formats.add ("ogg");
+
+        backends.add ("buffered");
+        backends.add ("preallocated");
+        backends.add ("direct");
+        backends.add ("mapped");
+    }
+};
+
+static Array<int> parseIntList (const String& text)
+{
+    Array<int> values;
+
+    for (auto& token : StringArray::fromTokens (text, ",", ""))
+        values.add (token.getIntValue());
+
+    return values;
+}
+
+static BenchmarkOptions parseOptions (int argc, char* argv[])
+{
+    BenchmarkOptions options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg (argv[i]);
+        auto value = arg.fromFirstOccurrenceOf ("=", false, false);
+
+        if (arg.startsWith ("--seconds="))           options.seconds = jmax (0.1, value.getDoubleValue());
+        else if (arg == "--freewheel")               options.realtime = false;
+        else if (arg == "--csv")                     options.csv = true;
+        else if (arg == "--formats-only")            options.formatsOnly = true;
+        else if (arg == "--stress")                  options.stressOnly = true;
+        else if (arg.startsWith ("--block-sizes="))  options.blockSizes = parseIntList (value);
+        else if (arg.startsWith ("--sample-rates=")) options.sampleRates = parseIntList (value);
+        else if (arg.startsWith ("--channels="))     options.channelCounts = parseIntList (value);
+        else if (arg.startsWith ("--formats="))      options.formats = StringArray::fromTokens (value, ",", "");
+        else if (arg.startsWith ("--backends="))     options.backends = StringArray::fromTokens (value, ",", "");
+        else if (arg.startsWith ("--instances="))    options.instanceCounts = parseIntList (value);
+        else if (arg == "--no-groups")               options.grouped = false;
+        else if (arg == "--no-overviews")            options.overviews = false;
+        else if (arg.startsWith ("--encoders="))     options.encoders = StringArray::fromTokens (value, ",", "");
+        else if (arg.startsWith ("--encoder-threads=")) options.encoderThreads = parseIntList (value);
+        else if (arg.startsWith ("--channels-per-encoder=")) options.channelsPerEncoder = jmax (1, value.getIntValue());
+        else if (arg.startsWith ("--tracks="))       options.trackCounts = parseIntList (value);
+        else if (arg.startsWith ("--prefetch="))     options.prefetchSeconds = jmax (0.1, value.getDoubleValue());
+    }
+
+    return options;
+}
+
+//==============================================================================
+/** Fills blocks with a different sine on each channel, plus a dense midi stream
+    (a note every quarter of a second and a controller every 64 samples).
+*/
+class SignalGenerator
+{
+public:
+    SignalGenerator (double rate) : sampleRate (rate)
+    {
+        for (int i = 0; i < tableSize; ++i)
+            table[i] = 0.5f * std::sin ((float) i * MathConstants<float>::twoPi / (float) tableSize);
+    }
+
+    void fill (AudioBuffer<float>& buffer, MidiBuffer& midi)
+    {
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+        {
+            auto* data = buffer.getWritePointer (ch);
+            auto step = ch + 1;
+
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+                data[i] = table[(int) (((position + i) * step) % tableSize)];
+        }
+
+        midi.clear();
+        auto noteInterval = (int64) (sampleRate / 4);
+
+        for (int i = 0; i < buffer.getNumSamples(); ++i)
+        {
+            auto pos = position + i;
+
+            if (pos % noteInterval == 0)
+                midi.addEvent (MidiMessage::noteOn (1, 60, (uint8) 100), i);
+            else if (pos % noteInterval == noteInterval / 2)
+                midi.addEvent (MidiMessage::noteOff (1, 60), i);
+
+            if (pos % 64 == 0)
+                midi.addEvent (MidiMessage::controllerEvent (1, 1, (int) ((pos / 64) % 128)), i);
+        }
+
+        position += buffer.getNumSamples();
+    }
+
+private:
+    static constexpr int tableSize = 4096;
+    float table[tableSize];
+    double sampleRate;
+    int64 position = 0;
+};
+
+//==============================================================================
+struct ProcessorResult
+{
+    bool ok = false;
+    double p50 = 0, p99 = 0, max = 0;   // microseconds per callback
+    double budget = 0;                  // microseconds of audio per callback
+    double megabytesPerSecond = 0;
+    int64 droppedSamples = 0, droppedEvents = 0;
+    double fifoHighWater = 0, maxWriterLagMs = 0;   // from the processor's own telemetry
+    double compressionRatio = 0, memoryMegabytes = 0;   // memory takes only
+};
+
+static double percentile (const std::vector<double>& sorted, double p)
+{
+    return sorted.empty() ? 0.0 : sorted[(size_t) (p * (double) (sorted.size() - 1))];
+}
+
+static ProcessorResult runProcessorBenchmark (int blockSize, int sampleRate, int numChannels,
+                                              const String& format, const BenchmarkOptions& options,
+                                              const File& outputDir)
+{
+    ProcessorResult result;
+
+    AudioMidiRecorderPluginProcessor processor;
+    processor.setPlayConfigDetails (numChannels, numChannels, sampleRate, blockSize);
+
+    if (processor.getTotalNumInputChannels() != numChannels)
+        return result;
+
+    // (takes go into outputDir, so don't pre-arm any in the recording directory)
+    processor.setPrearmTakes (false);
+    processor.prepareToPlay (sampleRate, blockSize);
+    processor.setWriteOverviews (options.overviews);
+
+    auto toMemory = format == "memory";
+    processor.setRecordToMemory (toMemory);
+    processor.setMemoryLimitMegabytes (4096);
+
+    AudioBuffer<float> buffer (numChannels, blockSize);
+    MidiBuffer midi;
+    midi.ensureSize (4096);
+    SignalGenerator generator (sampleRate);
+
+    auto audioFile = outputDir.getNonexistentChildFile ("benchmark", "." + (toMemory ? String ("wav") : format));
+    auto midiFile = audioFile.withFileExtension (".mid");
+
+    auto numCallbacks = jmax (1, (int) (options.seconds * sampleRate / blockSize));
+    std::vector<double> timings;
+    timings.reserve ((size_t) numCallbacks);
+
+    auto ticksPerCallback = (int64) ((double) Time::getHighResolutionTicksPerSecond() * blockSize / sampleRate);
+    auto startTicks = Time::getHighResolutionTicks();
+    auto deadline = startTicks;
+
+    processor.startRecording (audioFile, midiFile);
+
+    for (int i = 0; i < numCallbacks; ++i)
+    {
+        generator.fill (buffer, midi);
+
+        auto t0 = Time::getHighResolutionTicks();
+        processor.processBlock (buffer, midi);
+        auto t1 = Time::getHighResolutionTicks();
+
+        timings.push_back (Time::highResolutionTicksToSeconds (t1 - t0) * 1.0e6);
+
+        if (options.realtime)
+        {
+            // Pace the callbacks like a device would, so the writer thread gets real time to keep up
+            deadline += ticksPerCallback;
+
+            while (Time::getHighResolutionTicks() < deadline)
+                if (Time::highResolutionTicksToSeconds (deadline - Time::getHighResolutionTicks()) > 0.002)
+                    Thread::sleep (1);
+        }
+    }
+
+    // (closes both takes and waits for the writer thread to finish them)
+    processor.releaseResources();
+    auto elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+
+    std::sort (timings.begin(), timings.end());
+
+    result.ok = true;
+    result.p50 = percentile (timings, 0.5);
+    result.p99 = percentile (timings, 0.99);
+    result.max = timings.back();
+    result.budget = 1.0e6 * blockSize / sampleRate;
+    result.megabytesPerSecond = (double) (audioFile.getSize() + midiFile.getSize()) / (1024.0 * 1024.0 * elapsed);
+
+    if (auto take = processor.getMemoryTakes().getLastTake())
+    {
+        auto stats = take->getStats();
+        result.megabytesPerSecond = (double) (stats.audioBytes + stats.midiBytes) / (1024.0 * 1024.0 * elapsed);
+        result.compressionRatio = stats.compressionRatio;
+        result.memoryMegabytes = (double) stats.memoryUsed / (1024.0 * 1024.0);
+    }
+    result.droppedSamples = processor.getNumDroppedSamples();
+    result.droppedEvents = processor.getNumDroppedMidiEvents();
+
+    auto metrics = processor.getMetrics();
+    result.fifoHighWater = metrics.fifoHighWater;
+    result.maxWriterLagMs = metrics.maxWriterLagMs;
+
+    // (compressed takes with more channels than one encoder group get a file per group)
+    auto groupFiles = outputDir.findChildFiles (File::findFiles, false, audioFile.getFileNameWithoutExtension() + "-ch*");
+
+    for (auto& file : groupFiles)
+    {
+        file.deleteFile();
+        SeekIndex::getFileFor (file).deleteFile();
+    }
+
+    audioFile.deleteFile();
+    PeakOverview::getFileFor (audioFile).deleteFile();
+    SeekIndex::getFileFor (audioFile).deleteFile();
+    midiFile.deleteFile();
+    SeekIndex::getFileFor (midiFile).deleteFile();
+    return result;
+}
+
+//==============================================================================
+struct StressResult
+{
+    int cycles = 0;                     // takes started (or armed) and stopped again
+    double p99 = 0, max = 0;            // microseconds per callback
+    double budget = 0;                  // microseconds of audio per callback
+    int64 droppedSamples = 0, droppedEvents = 0;
+};
+
+/** Runs processBlock at real-time pace, the way a device's callback would. */
+class StressAudioThread  : public Thread
+{
+public:
+    StressAudioThread (AudioMidiRecorderPluginProcessor& p, int rate, int size)
+        : Thread ("stress audio"), processor (p), sampleRate (rate), blockSize (size)
+    {
+        timings.reserve ((size_t) (3600.0 * sampleRate / blockSize));
+    }
+
+    void run() override
+    {
+        AudioBuffer<float> buffer (2, blockSize);
+        MidiBuffer midi;
+        midi.ensureSize (4096);
+        SignalGenerator generator (sampleRate);
+
+        auto ticksPerCallback = (int64) ((double) Time::getHighResolutionTicksPerSecond() * blockSize / sampleRate);
+        auto deadline = Time::getHighResolutionTicks();
+
+        while (! threadShouldExit() && timings.size() < timings.capacity())
+        {
+            generator.fill (buffer, midi);
+
+            auto t0 = Time::getHighResolutionTicks();
+            processor.processBlock (buffer, midi);
+            timings.push_back (Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - t0) * 1.0e6);
+
+            deadline += ticksPerCallback;
+
+            while (Time::getHighResolutionTicks() < deadline)
+                if (Time::highResolutionTicksToSeconds (deadline - Time::getHighResolutionTicks()) > 0.002)
+                    Thread::sleep (1);
+        }
+    }
+
+    std::vector<double> timings;
+
+private:
+    AudioMidiRecorderPluginProcessor& processor;
+    int sampleRate, blockSize;
+};
+
+/** Starts and stops takes on this thread as fast as it can (plain takes, armed takes that the
+    generator's notes trigger, and overdubs of the last take) while the callback keeps running
+    on another, to show that none of it ever makes the callback wait.
+*/
+static StressResult runStressTest (int sampleRate, int blockSize, double seconds, const File& outputDir)
+{
+    StressResult result;
+
+    auto directory = outputDir.getChildFile ("stress");
+    directory.createDirectory();
+
+    AudioMidiRecorderPluginProcessor processor;
+    processor.setPlayConfigDetails (2, 2, sampleRate, blockSize);
+    processor.setPrearmTakes (false);
+    processor.prepareToPlay (sampleRate, blockSize);
+
+    StressAudioThread audioThread (processor, sampleRate, blockSize);
+    audioThread.startThread (8);
+
+    Random random;
+    auto endTime = Time::getMillisecondCounterHiRes() + seconds * 1000.0;
+
+    while (Time::getMillisecondCounterHiRes() < endTime)
+    {
+        auto audioFile = directory.getNonexistentChildFile ("stress", ".wav");
+        auto midiFile = audioFile.withFileExtension (".mid");
+
+        switch (result.cycles % 3)
+        {
+            case 0:  processor.startRecording (audioFile, midiFile); break;
+            case 1:  processor.armRecording (audioFile, midiFile); break;
+            default: if (! processor.overdub (audioFile, midiFile)) processor.startRecording (audioFile, midiFile); break;
+        }
+
+        Thread::sleep (random.nextInt (20));
+        processor.stopRecording();
+        Thread::sleep (random.nextInt (5));
+        ++result.cycles;
+    }
+
+    audioThread.stopThread (1000);
+    processor.releaseResources();
+
+    auto& timings = audioThread.timings;
+    std::sort (timings.begin(), timings.end());
+
+    result.p99 = percentile (timings, 0.99);
+    result.max = timings.empty() ? 0.0 : timings.back();
+    result.budget = 1.0e6 * blockSize / sampleRate;
+    result.droppedSamples = processor.getNumDroppedSamples();
+    result.droppedEvents = processor.getNumDroppedMidiEvents();
+
+    directory.deleteRecursively();
+    return result;
+}
+
+//==============================================================================
+/** Discards everything written to it, so only the writer's own work is measured. */
+class NullOutputStream  : public OutputStream
+{
+public:
+    void flush() override                               {}
+    bool setPosition (int64 newPosition) override       { position = newPosition; return true; }
+    int64 getPosition() override                        { return position; }
+    bool write (const void*, size_t numBytes) override  { position += (int64) numBytes; return true; }
+
+private:
+    int64 position = 0;
+};
+
+/** Returns the writer-thread cost of one format, as seconds of CPU per second of audio. */
+static double runFormatBenchmark (int numChannels, int sampleRate, WavRecordingWriter::SampleFormat format,
+                                  SampleConversion::Ditherer::Mode dither, double seconds)
+{
+    const int blockSize = 4096;
+    AudioBuffer<float> buffer (numChannels, blockSize);
+    MidiBuffer unused;
+    SignalGenerator generator (sampleRate);
+    generator.fill (buffer, unused);
+
+    WavRecordingWriter writer (std::make_unique<NullOutputStream>(), sampleRate, numChannels, format, dither);
+
+    auto numBlocks = jmax (1, (int) (seconds * sampleRate / blockSize));
+    auto start = Time::getHighResolutionTicks();
+
+    for (int i = 0; i < numBlocks; ++i)
+        writer.write (buffer.getArrayOfReadPointers(), blockSize);
+
+    auto elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start);
+    return elapsed / ((double) numBlocks * blockSize / sampleRate);
+}
+
+//==============================================================================
+static double getThreadCpuSeconds()
+{
+    timespec t;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec * 1.0e-9;
+}
+
+struct BackendResult
+{
+    bool ok = false;
+    double megabytesPerSecond = 0;      // wall clock, including finalising the file
+    double cpuPerAudioSecond = 0;       // writer-thread CPU
+};
+
+/** Writes a 24-bit take straight to disk through one of the processor's WAV output modes,
+    the same way the writer thread does (blocks of a few thousand samples, a header commit
+    every five seconds of audio).
+*/
+static BackendResult runBackendBenchmark (AudioMidiRecorderPluginProcessor::WavOutputMode mode, int numChannels,
+                                          int sampleRate, double seconds, bool writeOverview, const File& outputDir)
+{
+    BackendResult result;
+
+    const int blockSize = 4096;
+    AudioBuffer<float> buffer (numChannels, blockSize);
+    MidiBuffer unused;
+    SignalGenerator generator (sampleRate);
+    generator.fill (buffer, unused);
+
+    auto file = outputDir.getNonexistentChildFile ("backend", ".wav");
+    auto numBlocks = jmax (1, (int) (seconds * sampleRate / blockSize));
+    auto commitInterval = jmax (1, 5 * sampleRate / blockSize);
+
+    auto startTicks = Time::getHighResolutionTicks();
+    auto startCpu = getThreadCpuSeconds();
+
+    {
+        AudioMidiRecorderPluginProcessor::AudioWriterSettings settings;
+        settings.sampleRate = sampleRate;
+        settings.numChannels = numChannels;
+        settings.format = WavRecordingWriter::SampleFormat::int24;
+        settings.outputMode = mode;
+        settings.writeOverview = writeOverview;
+
+        auto writer = AudioMidiRecorderPluginProcessor::createAudioWriter (file, settings);
+        if (writer == nullptr)
+            return result;
+
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            writer->write (buffer.getArrayOfReadPointers(), blockSize);
+
+            if (i % commitInterval == commitInterval - 1)
+                writer->commit();
+        }
+    }
+
+    auto cpu = getThreadCpuSeconds() - startCpu;
+    auto elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+    auto audioSeconds = (double) numBlocks * blockSize / sampleRate;
+
+    result.ok = true;
+    result.megabytesPerSecond = (double) file.getSize() / (1024.0 * 1024.0 * elapsed);
+    result.cpuPerAudioSecond = cpu / audioSeconds;
+
+    file.deleteFile();
+    return result;
+}
+
+//==============================================================================
+struct InstancesResult
+{
+    bool ok = false;
+    int writerThreads = 0;              // shared writer threads while everything was recording
+    int numFiles = 0;
+    double megabytesPerSecond = 0;
+    int64 droppedSamples = 0;
+    double maxWriterLagMs = 0;
+};
+
+/** Records a stereo WAV take on many processor instances at once, the way a session full of
+    tracks would, to show that they share a fixed number of writer threads. Grouped, they all
+    record into one multichannel file.
+*/
+static InstancesResult runInstancesBenchmark (int numInstances, int sampleRate, int blockSize, double seconds,
+                                              bool grouped, const File& outputDir)
+{
+    InstancesResult result;
+    OwnedArray<AudioMidiRecorderPluginProcessor> processors;
+    Array<File> files;
+
+    for (int i = 0; i < numInstances; ++i)
+    {
+        auto* processor = processors.add (new AudioMidiRecorderPluginProcessor());
+        processor->setPlayConfigDetails (2, 2, sampleRate, blockSize);
+        processor->setPrearmTakes (false);
+        processor->prepareToPlay (sampleRate, blockSize);
+
+        if (grouped)
+            processor->setRecordingGroup ("benchmark");
+    }
+
+    // A group take is started from any one member and goes into a single file
+    for (auto* processor : processors)
+    {
+        auto file = outputDir.getNonexistentChildFile ("instance", ".wav");
+        file.create();
+        files.add (file);
+        processor->startRecordingAudio (file);
+
+        if (grouped)
+            break;
+    }
+
+    AudioBuffer<float> buffer (2, blockSize);
+    MidiBuffer midi;
+    midi.ensureSize (4096);
+    SignalGenerator generator (sampleRate);
+
+    auto numCallbacks = jmax (1, (int) (seconds * sampleRate / blockSize));
+    auto ticksPerCallback = (int64) ((double) Time::getHighResolutionTicksPerSecond() * blockSize / sampleRate);
+    auto startTicks = Time::getHighResolutionTicks();
+    auto deadline = startTicks;
+
+    for (int i = 0; i < numCallbacks; ++i)
+    {
+        generator.fill (buffer, midi);
+        midi.clear();
+
+        for (auto* processor : processors)
+            processor->processBlock (buffer, midi);
+
+        deadline += ticksPerCallback;
+
+        while (Time::getHighResolutionTicks() < deadline)
+            if (Time::highResolutionTicksToSeconds (deadline - Time::getHighResolutionTicks()) > 0.002)
+                Thread::sleep (1);
+    }
+
+    result.writerThreads = processors.getFirst()->getIOService().getNumThreads();
+
+    for (auto* processor : processors)
+        processor->releaseResources();
+
+    auto elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+    int64 totalBytes = 0;
+
+    for (auto* processor : processors)
+    {
+        auto metrics = processor->getMetrics();
+        result.droppedSamples += metrics.droppedSamples;
+        result.maxWriterLagMs = jmax (result.maxWriterLagMs, metrics.maxWriterLagMs);
+    }
+
+    // (a group take puts every member's channels side by side, so 64 stereo instances need a
+    // 128 channel file - check it was really written that wide)
+    auto expectedChannels = grouped ? 2 * numInstances : 2;
+    auto allWritten = true;
+
+    for (auto& file : files)
+    {
+        std::unique_ptr<AudioFormatReader> reader (WavAudioFormat().createReaderFor (file.createInputStream().release(), true));
+        allWritten = allWritten && reader != nullptr && (int) reader->numChannels == expectedChannels && reader->lengthInSamples > 0;
+        reader.reset();
+
+        totalBytes += file.getSize();
+        file.deleteFile();
+        PeakOverview::getFileFor (file).deleteFile();
+        SeekIndex::getFileFor (file).deleteFile();
+        file.withFileExtension (".channels.txt").deleteFile();
+    }
+
+    result.numFiles = files.size();
+
+    result.ok = allWritten;
+    result.megabytesPerSecond = (double) totalBytes / (1024.0 * 1024.0 * elapsed);
+    return result;
+}
+
+//==============================================================================
+struct PlaybackResult
+{
+    bool ok = false;
+    int readerThreads = 0;              // shared writer threads the players read on
+    double megabytesPerSecond = 0;
+    int64 underruns = 0, underrunSamples = 0;
+    double lowestPrefetch = 1.0;        // the emptiest any read-ahead buffer got
+    int64 eventsPlayed = 0;
+    double p99 = 0;                     // microseconds per callback, all the tracks together
+};
+
+/** Streams a stereo 24-bit WAV take with a midi file back on many instances at once, the way a
+    session full of tracks would play, with the callbacks paced like a device. The takes are
+    written first (a little longer than the run, so none of them ends), then read back from disk
+    for the whole run through the players' read-ahead buffers.
+*/
+static PlaybackResult runPlaybackBenchmark (int numTracks, int sampleRate, int blockSize, double seconds,
+                                            double prefetchSeconds, const File& outputDir)
+{
+    PlaybackResult result;
+    Array<File> files;
+    OwnedArray<AudioMidiRecorderPluginProcessor> processors;
+
+    // (however the run ends, the players let go of the takes and they're deleted)
+    auto deleteTakes = [&]
+    {
+        for (auto* processor : processors)
+            processor->releaseResources();
+
+        processors.clear();
+
+        for (auto& file : files)
+        {
+            file.deleteFile();
+            file.withFileExtension (".mid").deleteFile();
+        }
+    };
+
+    const int writeBlockSize = 4096;
+    AudioBuffer<float> writeBuffer (2, writeBlockSize);
+    MidiBuffer unused;
+    auto takeLength = (int64) ((seconds + prefetchSeconds + 1.0) * sampleRate);
+
+    for (int i = 0; i < numTracks; ++i)
+    {
+        auto audioFile = outputDir.getNonexistentChildFile ("playback", ".wav");
+        auto midiFile = audioFile.withFileExtension (".mid");
+        files.add (audioFile);
+
+        AudioMidiRecorderPluginProcessor::AudioWriterSettings settings;
+        settings.sampleRate = sampleRate;
+        settings.format = WavRecordingWriter::SampleFormat::int24;
+        settings.writeOverview = false;
+        settings.writeSeekIndex = false;
+
+        auto writer = AudioMidiRecorderPluginProcessor::createAudioWriter (audioFile, settings);
+
+        if (writer == nullptr)
+        {
+            deleteTakes();
+            return result;
+        }
+
+        SignalGenerator generator (sampleRate);
+
+        for (int64 pos = 0; pos < takeLength; pos += writeBlockSize)
+        {
+            generator.fill (writeBuffer, unused);
+            writer->write (writeBuffer.getArrayOfReadPointers(), (int) jmin ((int64) writeBlockSize, takeLength - pos));
+        }
+
+        // A note every quarter of a second (at the default 120bpm and 96 ticks per quarter note)
+        MidiFileStreamWriter midiWriter (std::unique_ptr<OutputStream> (midiFile.createOutputStream()), 96);
+
+        for (int tick = 0; tick < (int) (takeLength / sampleRate) * 192; tick += 48)
+        {
+            const uint8 noteOn[] = { 0x90, 60, 100 }, noteOff[] = { 0x80, 60, 0 };
+            midiWriter.writeEvent (tick, noteOn, 3);
+            midiWriter.writeEvent (tick + 24, noteOff, 3);
+        }
+    }
+
+    for (auto& file : files)
+    {
+        auto* processor = processors.add (new AudioMidiRecorderPluginProcessor());
+        processor->setPlayConfigDetails (2, 2, sampleRate, blockSize);
+        processor->setPrearmTakes (false);
+        processor->setPlaybackPrefetchSeconds (prefetchSeconds);
+        processor->prepareToPlay (sampleRate, blockSize);
+
+        if (! processor->playTake (file, file.withFileExtension (".mid")))
+        {
+            deleteTakes();
+            return result;
+        }
+    }
+
+    AudioBuffer<float> buffer (2, blockSize);
+    MidiBuffer midi;
+    midi.ensureSize (4096);
+
+    auto numCallbacks = jmax (1, (int) (seconds * sampleRate / blockSize));
+    std::vector<double> timings;
+    timings.reserve ((size_t) numCallbacks);
+
+    auto ticksPerCallback = (int64) ((double) Time::getHighResolutionTicksPerSecond() * blockSize / sampleRate);
+    auto startTicks = Time::getHighResolutionTicks();
+    auto deadline = startTicks;
+
+    for (int i = 0; i < numCallbacks; ++i)
+    {
+        auto t0 = Time::getHighResolutionTicks();
+
+        for (auto* processor : processors)
+        {
+            buffer.clear();
+            midi.clear();
+            processor->processBlock (buffer, midi);
+        }
+
+        timings.push_back (Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - t0) * 1.0e6);
+
+        deadline += ticksPerCallback;
+
+        while (Time::getHighResolutionTicks() < deadline)
+            if (Time::highResolutionTicksToSeconds (deadline - Time::getHighResolutionTicks()) > 0.002)
+                Thread::sleep (1);
+    }
+
+    auto elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - startTicks);
+    result.readerThreads = processors.getFirst()->getIOService().getNumThreads();
+    int64 totalBytes = 0;
+
+    for (auto* processor : processors)
+    {
+        auto stats = processor->getPlaybackStats();
+        result.underruns += stats.underruns;
+        result.underrunSamples += stats.underrunSamples;
+        result.lowestPrefetch = jmin (result.lowestPrefetch, stats.lowestPrefetch);
+        result.eventsPlayed += stats.eventsPlayed;
+        totalBytes += stats.bytesRead;
+    }
+
+    deleteTakes();
+
+    std::sort (timings.begin(), timings.end());
+
+    result.ok = true;
+    result.megabytesPerSecond = (double) totalBytes / (1024.0 * 1024.0 * elapsed);
+    result.p99 = percentile (timings, 0.99);
+    return result;
+}
+
+//==============================================================================
+/** Encodes a take through a ParallelEncodingWriter on a pool of the given size (into
+    NullOutputStreams) and returns how many times faster than real time it ran.
+*/
+static double runEncoderBenchmark (const String& format, int numThreads, int numChannels, int channelsPerGroup,
+                                   int sampleRate, double seconds)
+{
+    const int blockSize = 4096;
+    AudioBuffer<float> buffer (numChannels, blockSize);
+    MidiBuffer unused;
+    SignalGenerator generator (sampleRate);
+    generator.fill (buffer, unused);
+
+    ThreadPool pool (numThreads);
+    auto numBlocks = jmax (1, (int) (seconds * sampleRate / blockSize));
+    double elapsed;
+
+    {
+        ParallelEncodingWriter writer (pool, [&] (int, int numGroupChannels) -> std::unique_ptr<RecordingWriter>
+        {
+            auto stream = std::make_unique<NullOutputStream>();
+            std::unique_ptr<AudioFormatWriter> audioWriter;
+
+            if (format == "flac")
+                audioWriter.reset (FlacAudioFormat().createWriterFor (stream.get(), sampleRate, (unsigned int) numGroupChannels, 24, {}, 5));
+            else
+                audioWriter.reset (OggVorbisAudioFormat().createWriterFor (stream.get(), sampleRate, (unsigned int) numGroupChannels, 16, {}, 8));
+
+            if (audioWriter == nullptr)
+                return nullptr;
+
+            auto& s = *stream.release();
+            return std::make_unique<AudioFormatRecordingWriter> (std::move (audioWriter), s);
+        }, numChannels, channelsPerGroup);
+
+        if (! writer.openedOk())
+            return 0;
+
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numBlocks; ++i)
+            writer.write (buffer.getArrayOfReadPointers(), blockSize);
+
+        writer.commit();
+        elapsed = Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - start);
+    }
+
+    return (double) numBlocks * blockSize / sampleRate / elapsed;
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    ScopedJuceInitialiser_GUI juceInitialiser;
+    auto options = parseOptions (argc, argv);
+
+    auto outputDir = File::getSpecialLocation (File::tempDirectory).getChildFile ("AudioMidiRecorderBenchmark");
+    outputDir.createDirectory();
+
+    //==============================================================================
+    if (options.stressOnly)
+    {
+        const int sampleRate = 48000, blockSize = 256;
+        auto r = runStressTest (sampleRate, blockSize, jmax (2.0, options.seconds), outputDir);
+        auto passed = r.max <= r.budget;
+
+        if (options.csv)
+            std::cout << "cycles,sample_rate,block_size,budget_us,p99_us,max_us,dropped_samples,dropped_events,passed" << std::endl
+                      << r.cycles << "," << sampleRate << "," << blockSize << "," << r.budget << "," << r.p99 << ","
+                      << r.max << "," << r.droppedSamples << "," << r.droppedEvents << "," << (passed ? 1 : 0) << std::endl;
+        else
+            std::cout << "stress, " << r.cycles << " start/stop cycles, stereo @ 48kHz block " << blockSize
+                      << " (budget " << String (r.budget, 1) << "us): p99 " << String (r.p99, 2) << "us  max "
+                      << String (r.max, 2) << "us  dropped " << r.droppedSamples << " samples, " << r.droppedEvents
+                      << " events  " << (passed ? "PASSED" : "FAILED: a callback overran the block period") << std::endl;
+
+        return passed ? 0 : 1;
+    }
+
+    //==============================================================================
+    if (! options.formatsOnly)
+    {
+        if (options.csv)
+            std::cout << "format,channels,sample_rate,block_size,budget_us,p50_us,p99_us,max_us,mb_per_s,dropped_samples,dropped_events,fifo_high_water,max_writer_lag_ms,compression_ratio,memory_mb" << std::endl;
+
+        for (auto& format : options.formats)
+        for (auto numChannels : options.channelCounts)
+        for (auto sampleRate : options.sampleRates)
+        for (auto blockSize : options.blockSizes)
+        {
+            auto r = runProcessorBenchmark (blockSize, sampleRate, numChannels, format, options, outputDir);
+
+            if (! r.ok)
+            {
+                std::cout << format << " " << numChannels << "ch: layout not supported, skipped" << std::endl;
+                continue;
+            }
+
+            if (options.csv)
+                std::cout << format << "," << numChannels << "," << sampleRate << "," << blockSize << ","
+                          << r.budget << "," << r.p50 << "," << r.p99 << "," << r.max << ","
+                          << r.megabytesPerSecond << "," << r.droppedSamples << "," << r.droppedEvents << ","
+                          << r.fifoHighWater << "," << r.maxWriterLagMs << "," << r.compressionRatio << "," << r.memoryMegabytes << std::endl;
+            else
+                std::cout << format << " " << numChannels << "ch " << sampleRate << "Hz block " << blockSize
+                          << " (budget " << String (r.budget, 1) << "us): p50 " << String (r.p50, 2)
+                          << "us  p99 " << String (r.p99, 2) << "us  max " << String (r.max, 2)
+                          << "us  writer " << String (r.megabytesPerSecond, 2) << " MB/s  dropped "
+                          << r.droppedSamples << " samples, " << r.droppedEvents << " events  fifo peak "
+                          << String (r.fifoHighWater * 100.0, 1) << "%  writer lag " << String (r.maxWriterLagMs, 1) << "ms"
+                          << (format == "memory" ? "  ratio " + String (r.compressionRatio, 2) + ":1, " + String (r.memoryMegabytes, 1) + " MB"
+                                                 : String())
+                          << std::endl;
+        }
+    }
+
+    //==============================================================================
+    struct FormatCase
+    {
+        const char* name;
+        WavRecordingWriter::SampleFormat format;
+        SampleConversion::Ditherer::Mode dither;
+    };
+
+    const FormatCase formatCases[] =
+    {
+        { "16-bit",                 WavRecordingWriter::SampleFormat::int16,   SampleConversion::Ditherer::Mode::none },
+        { "16-bit tpdf",            WavRecordingWriter::SampleFormat::int16,   SampleConversion::Ditherer::Mode::triangular },
+        { "16-bit hp-tpdf",         WavRecordingWriter::SampleFormat::int16,   SampleConversion::Ditherer::Mode::highPassTriangular },
+        { "24-bit",                 WavRecordingWriter::SampleFormat::int24,   SampleConversion::Ditherer::Mode::none },
+        { "24-bit tpdf",            WavRecordingWriter::SampleFormat::int24,   SampleConversion::Ditherer::Mode::triangular },
+        { "32-bit int",             WavRecordingWriter::SampleFormat::int32,   SampleConversion::Ditherer::Mode::none },
+        { "32-bit float",           WavRecordingWriter::SampleFormat::float32, SampleConversion::Ditherer::Mode::none }
+    };
+
+    if (options.csv)
+        std::cout << "wav_format,channels,sample_rate,cpu_per_audio_second,msamples_per_s" << std::endl;
+
+    for (auto numChannels : options.channelCounts)
+    {
+        for (auto& c : formatCases)
+        {
+            const int sampleRate = 192000;
+            auto cost = runFormatBenchmark (numChannels, sampleRate, c.format, c.dither, jmax (1.0, options.seconds));
+            auto throughput = numChannels * sampleRate / (cost * 1.0e6);
+
+            if (options.csv)
+                std::cout << c.name << "," << numChannels << "," << sampleRate << "," << cost << "," << throughput << std::endl;
+            else
+                std::cout << "wav " << c.name << " " << numChannels << "ch @ 192kHz: writer thread "
+                          << String (cost * 100.0, 2) << "% of one core, " << String (throughput, 1)
+                          << " Msamples/s" << std::endl;
+        }
+    }
+
+    //==============================================================================
+    if (options.csv)
+        std::cout << "wav_backend,channels,sample_rate,mb_per_s,cpu_per_audio_second" << std::endl;
+
+    for (auto& backend : options.backends)
+    {
+        auto mode = backend == "mapped"       ? AudioMidiRecorderPluginProcessor::WavOutputMode::memoryMapped
+                  : backend == "direct"       ? AudioMidiRecorderPluginProcessor::WavOutputMode::directIO
+                  : backend == "preallocated" ? AudioMidiRecorderPluginProcessor::WavOutputMode::preallocated
+                                              : AudioMidiRecorderPluginProcessor::WavOutputMode::buffered;
+
+        for (auto numChannels : options.channelCounts)
+        {
+            const int sampleRate = 192000;
+            auto r = runBackendBenchmark (mode, numChannels, sampleRate, jmax (5.0, options.seconds), options.overviews, outputDir);
+
+            if (! r.ok)
+                std::cout << backend << " " << numChannels << "ch: couldn't open the file, skipped" << std::endl;
+            else if (options.csv)
+                std::cout << backend << "," << numChannels << "," << sampleRate << "," << r.megabytesPerSecond << ","
+                          << r.cpuPerAudioSecond << std::endl;
+            else
+                std::cout << "wav " << backend << " " << numChannels << "ch @ 192kHz 24-bit: "
+                          << String (r.megabytesPerSecond, 1) << " MB/s, writer thread "
+                          << String (r.cpuPerAudioSecond * 100.0, 2) << "% of one core" << std::endl;
+        }
+    }
+
+    //==============================================================================
+    if (options.csv)
+        std::cout << "instances,sample_rate,block_size,writer_threads,files,mb_per_s,dropped_samples,max_writer_lag_ms" << std::endl;
+
+    for (auto grouped : { false, true })
+    {
+        if (grouped && ! options.grouped)
+            continue;
+
+        for (auto numInstances : options.instanceCounts)
+        {
+            const int sampleRate = 48000, blockSize = 256;
+            auto r = runInstancesBenchmark (numInstances, sampleRate, blockSize, options.seconds, grouped, outputDir);
+            auto name = String (numInstances) + (grouped ? " grouped" : "") + " instances";
+
+            if (! r.ok)
+                std::cout << name << ": the takes weren't written with all their channels, skipped" << std::endl;
+            else if (options.csv)
+                std::cout << numInstances << (grouped ? " grouped" : "") << "," << sampleRate << "," << blockSize << ","
+                          << r.writerThreads << "," << r.numFiles << "," << r.megabytesPerSecond << "," << r.droppedSamples << ","
+                          << r.maxWriterLagMs << std::endl;
+            else
+                std::cout << name << ", stereo wav @ 48kHz: " << r.writerThreads << " writer thread"
+                          << (r.writerThreads == 1 ? "" : "s") << ", " << r.numFiles << " file" << (r.numFiles == 1 ? "" : "s")
+                          << ", " << String (r.megabytesPerSecond, 1) << " MB/s, dropped " << r.droppedSamples
+                          << " samples, writer lag " << String (r.maxWriterLagMs, 1) << "ms" << std::endl;
+        }
+    }
+
+    //==============================================================================
+    if (options.csv)
+        std::cout << "tracks,sample_rate,block_size,prefetch_s,reader_threads,mb_per_s,underruns,underrun_samples,lowest_prefetch,midi_events,p99_us" << std::endl;
+
+    for (auto numTracks : options.trackCounts)
+    {
+        const int sampleRate = 48000, blockSize = 256;
+        auto r = runPlaybackBenchmark (numTracks, sampleRate, blockSize, options.seconds, options.prefetchSeconds, outputDir);
+
+        if (! r.ok)
+            std::cout << numTracks << " tracks: couldn't write or play the takes, skipped" << std::endl;
+        else if (options.csv)
+            std::cout << numTracks << "," << sampleRate << "," << blockSize << "," << options.prefetchSeconds << ","
+                      << r.readerThreads << "," << r.megabytesPerSecond << "," << r.underruns << "," << r.underrunSamples << ","
+                      << r.lowestPrefetch << "," << r.eventsPlayed << "," << r.p99 << std::endl;
+        else
+            std::cout << numTracks << " tracks playing, stereo 24-bit wav @ 48kHz, " << String (options.prefetchSeconds, 1)
+                      << "s prefetch: " << r.readerThreads << " reader thread" << (r.readerThreads == 1 ? "" : "s") << ", "
+                      << String (r.megabytesPerSecond, 1) << " MB/s, " << r.underruns << " underruns (" << r.underrunSamples
+                      << " samples), read-ahead never below " << String (r.lowestPrefetch * 100.0, 1) << "%, "
+                      << r.eventsPlayed << " midi events, p99 " << String (r.p99, 1) << "us per callback" << std::endl;
+    }
+
+    //==============================================================================
+    if (options.csv)
+        std::cout << "encoder,channels,sample_rate,threads,channels_per_group,x_realtime" << std::endl;
+
+    for (auto& format : options.encoders)
+    {
+        for (auto numChannels : options.channelCounts)
+        {
+            const int sampleRate = 48000;
+            auto channelsPerGroup = format == "flac" ? jmin (8, options.channelsPerEncoder) : options.channelsPerEncoder;
+
+            for (auto numThreads : options.encoderThreads)
+            {
+                auto speed = runEncoderBenchmark (format, numThreads, numChannels, channelsPerGroup, sampleRate, jmax (1.0, options.seconds));
+
+                if (speed <= 0)
+                    std::cout << format << " " << numChannels << "ch: couldn't create the encoder, skipped" << std::endl;
+                else if (options.csv)
+                    std::cout << format << "," << numChannels << "," << sampleRate << "," << numThreads << ","
+                              << channelsPerGroup << "," << speed << std::endl;
+                else
+                    std::cout << format << " " << numChannels << "ch @ 48kHz, " << numThreads << " encoder thread"
+                              << (numThreads == 1 ? "" : "s") << " (" << channelsPerGroup << "ch per group): "
+                              << String (speed, 1) << "x real time" << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
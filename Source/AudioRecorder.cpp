@@ -0,0 +1,333 @@
+/*
+  ==============================================================================
+
+    This file contains the lock-free audio capture path used by the recorder.
+
+  ==============================================================================
+*/
+
+#include "AudioRecorder.h"
+
+//==============================================================================
+AudioRecorder::AudioRecorder (RecorderMetrics& metricsToUpdate)
+    : metrics (metricsToUpdate)
+{
+}
+
+AudioRecorder::~AudioRecorder()
+{
+}
+
+//==============================================================================
+void AudioRecorder::prepare (int numChannels, int fifoSizeSamples, int lookbackSamples, int maxBlockSize)
+{
+    if (numChannels == ringBuffer.getNumChannels() && fifoSizeSamples == sampleFifo.getTotalSize()
+         && lookbackSamples == lookbackLength && maxBlockSize == historyMargin)
+        return;
+
+    // Make sure the writer thread has finished with the old ring before it goes away. (It's
+    // still registered and keeps polling, so the ring is swapped under its lock.)
+    release();
+
+    const ScopedLock sl (ringLock);
+
+    ringBuffer.setSize (numChannels, fifoSizeSamples);
+    ringBuffer.clear();
+    sampleFifo.setTotalSize (fifoSizeSamples);
+    readPointers.malloc ((size_t) numChannels);
+
+    // The history is a bit longer than the lookback, so the writer thread has time to copy
+    // the oldest samples out before the audio thread comes round to overwrite them
+    lookbackLength = lookbackSamples;
+    historyMargin = maxBlockSize;
+    historyBuffer.setSize (numChannels, lookbackSamples > 0 ? lookbackSamples + fifoSizeSamples + maxBlockSize : 0);
+    historyBuffer.clear();
+    historyPosition = 0;
+    lookbackScratch.setSize (numChannels, lookbackSamples > 0 ? 4096 : 0);
+}
+
+bool AudioRecorder::resizeFifo (int fifoSizeSamples)
+{
+    // Once the last take is closed the audio thread only posts boundaries, which don't touch
+    // the ring, and it won't start pushing samples again until it sees the next take number -
+    // which startTake() publishes after we've returned. (The writer thread holds the lock for a
+    // whole slice, so rather than wait on the message thread the ring just keeps its size.)
+    const ScopedTryLock sl (ringLock);
+
+    if (! sl.isLocked() || ! takes.isIdle() || sampleFifo.getNumReady() > 0)
+        return false;
+
+    if (fifoSizeSamples == sampleFifo.getTotalSize())
+        return true;
+
+    ringBuffer.setSize (ringBuffer.getNumChannels(), fifoSizeSamples);
+    ringBuffer.clear();
+    sampleFifo.setTotalSize (fifoSizeSamples);
+
+    // (the history keeps its original margin, so with a much bigger ring a badly stalled
+    // writer may now lose part of the lookback - writeLookback() drops that safely)
+    return true;
+}
+
+void AudioRecorder::release()
+{
+    auto take = stopTake();
+
+    // The audio callback is stopped, so we can stand in for it as the producer and
+    // post the boundary ourselves
+    process (nullptr, 0, 0, takes.getRequestedTake());
+
+    waitForTakeToFinish (take, 2000);
+}
+
+//==============================================================================
+void AudioRecorder::process (const float* const* channels, int numChannels, int numSamples,
+                             int requestedTake, TimelinePosition position)
+{
+    // Pick up any take change requested since the last callback
+    if (requestedTake != audioThreadTake && pushBoundary ({ requestedTake, audioThreadPosition, historyPosition.load(), position }))
+        audioThreadTake = requestedTake;
+
+    if (numSamples <= 0)
+        return;
+
+    if (audioThreadTake > 0)
+        pushToRing (channels, numChannels, numSamples);
+
+    if (lookbackLength > 0)
+        pushToHistory (channels, numChannels, numSamples);
+}
+
+void AudioRecorder::pushToRing (const float* const* channels, int numChannels, int numSamples) noexcept
+{
+    int start1, size1, start2, size2;
+    sampleFifo.prepareToWrite (numSamples, start1, size1, start2, size2);
+
+    auto numWritten = size1 + size2;
+
+    if (numWritten < numSamples)
+        metrics.addDroppedSamples (numSamples - numWritten);
+
+    for (int ch = 0; ch < ringBuffer.getNumChannels(); ++ch)
+    {
+        if (ch < numChannels)
+        {
+            if (size1 > 0)  ringBuffer.copyFrom (ch, start1, channels[ch], size1);
+            if (size2 > 0)  ringBuffer.copyFrom (ch, start2, channels[ch] + size1, size2);
+        }
+        else
+        {
+            if (size1 > 0)  ringBuffer.clear (ch, start1, size1);
+            if (size2 > 0)  ringBuffer.clear (ch, start2, size2);
+        }
+    }
+
+    sampleFifo.finishedWrite (numWritten);
+    audioThreadPosition += numWritten;
+
+    metrics.updateFifoLevel (sampleFifo.getNumReady());
+}
+
+void AudioRecorder::pushToHistory (const float* const* channels, int numChannels, int numSamples) noexcept
+{
+    auto historySize = historyBuffer.getNumSamples();
+    auto position = historyPosition.load();
+
+    for (int done = 0; done < numSamples;)
+    {
+        auto index = (int) (position % historySize);
+        auto num = jmin (numSamples - done, historySize - index);
+
+        for (int ch = 0; ch < historyBuffer.getNumChannels(); ++ch)
+        {
+            if (ch < numChannels)
+                historyBuffer.copyFrom (ch, index, channels[ch] + done, num);
+            else
+                historyBuffer.clear (ch, index, num);
+        }
+
+        done += num;
+        position += num;
+    }
+
+    historyPosition = position;
+}
+
+//==============================================================================
+int AudioRecorder::useTimeSlice()
+{
+    // The audio thread publishes a boundary before the samples that follow it, so the
+    // sample count has to be read first: any boundary inside it is then guaranteed visible.
+    const ScopedLock sl (ringLock);
+
+    auto numReady = sampleFifo.getNumReady();
+    bool didWork = false;
+
+    // Small amounts are left to build up into one larger write, unless a take change is
+    // waiting behind them
+    TakeBoundary pending;
+
+    if (numReady < writeBatchSize.load() && ! peekBoundary (pending))
+        numReady = 0;
+
+    for (;;)
+    {
+        TakeBoundary next;
+        auto hasBoundary = peekBoundary (next);
+
+        if (hasBoundary && next.position <= writerPosition)
+        {
+            popBoundary();
+            switchToTake (next);
+            didWork = true;
+            continue;
+        }
+
+        auto numToWrite = hasBoundary ? (int) jmin ((int64) numReady, next.position - writerPosition)
+                                      : numReady;
+
+        if (numToWrite <= 0)
+            break;
+
+        writeFromRing (numToWrite);
+        numReady -= numToWrite;
+        didWork = true;
+    }
+
+    metrics.updateWriterLag (sampleFifo.getNumReady());
+
+    // Keep the file readable up to about here in case we never get to close it
+    auto interval = commitInterval.load();
+    auto now = Time::getMillisecondCounter();
+
+    if (currentWriter != nullptr && interval > 0 && now - lastCommitTime >= (uint32) interval)
+    {
+        currentWriter->commit();
+        lastCommitTime = now;
+    }
+
+    if (didWork)
+        reportBytesWritten();
+
+    return didWork ? 0 : 10;
+}
+
+void AudioRecorder::writeFromRing (int numSamples)
+{
+    int start1, size1, start2, size2;
+    sampleFifo.prepareToRead (numSamples, start1, size1, start2, size2);
+
+    writeRegion (start1, size1);
+    writeRegion (start2, size2);
+
+    sampleFifo.finishedRead (size1 + size2);
+    writerPosition += size1 + size2;
+}
+
+void AudioRecorder::writeRegion (int start, int numSamples)
+{
+    if (numSamples <= 0 || currentWriter == nullptr)
+        return;
+
+    jassert (currentWriter->getNumChannels() <= ringBuffer.getNumChannels());
+
+    for (int ch = 0; ch < ringBuffer.getNumChannels(); ++ch)
+        readPointers[ch] = ringBuffer.getReadPointer (ch, start);
+
+    auto writeStart = Time::getHighResolutionTicks();
+    currentWriter->write (readPointers, numSamples);
+    metrics.addWriteDuration (Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - writeStart));
+}
+
+void AudioRecorder::writeLookback (int64 endPosition)
+{
+    auto historySize = historyBuffer.getNumSamples();
+
+    for (auto position = jmax ((int64) 0, endPosition - lookbackLength); position < endPosition;)
+    {
+        auto num = (int) jmin ((int64) lookbackScratch.getNumSamples(), endPosition - position);
+        auto index = (int) (position % historySize);
+        auto num1 = jmin (num, historySize - index);
+
+        for (int ch = 0; ch < historyBuffer.getNumChannels(); ++ch)
+        {
+            lookbackScratch.copyFrom (ch, 0, historyBuffer, ch, index, num1);
+
+            if (num > num1)
+                lookbackScratch.copyFrom (ch, num1, historyBuffer, ch, 0, num - num1);
+        }
+
+        // If the audio thread lapped us while we were copying (i.e. the writer thread fell a
+        // whole ring behind), this part of the history may be torn, so it's dropped
+        if (historyPosition.load() + historyMargin <= position + historySize)
+            currentWriter->write (lookbackScratch.getArrayOfReadPointers(), num);
+        else
+            metrics.addDroppedSamples (num);
+
+        position += num;
+    }
+}
+
+void AudioRecorder::switchToTake (const TakeBoundary& boundary)
+{
+    // Deleting the writer flushes the remaining data and rewrites the file header
+    reportBytesWritten();
+    currentWriter.reset();
+    currentWriter = takes.switchToTake (boundary.take, writerTake);
+    bytesReported = currentWriter != nullptr ? currentWriter->getNumBytesWritten() : 0;
+    lastCommitTime = Time::getMillisecondCounter();
+    writerTake = jmax (0, boundary.take);
+
+    if (currentWriter == nullptr)
+        return;
+
+    // Everything the history holds from before the boundary goes in ahead of the live samples
+    auto lookbackSamples = lookbackLength > 0 ? jmin ((int64) lookbackLength, boundary.historyPosition) : (int64) 0;
+    auto start = boundary.timelinePosition;
+    start.samples -= lookbackSamples;
+    currentWriter->setStartPosition (start);
+
+    if (lookbackSamples > 0)
+        writeLookback (boundary.historyPosition);
+}
+
+void AudioRecorder::reportBytesWritten()
+{
+    if (currentWriter == nullptr)
+        return;
+
+    auto total = currentWriter->getNumBytesWritten();
+    metrics.addBytesWritten (total - bytesReported);
+    bytesReported = total;
+}
+
+//==============================================================================
+bool AudioRecorder::pushBoundary (TakeBoundary boundary) noexcept
+{
+    int start1, size1, start2, size2;
+    boundaryFifo.prepareToWrite (1, start1, size1, start2, size2);
+
+    if (size1 == 0)
+        return false;
+
+    boundaries[start1] = boundary;
+    boundaryFifo.finishedWrite (1);
+    return true;
+}
+
+bool AudioRecorder::peekBoundary (TakeBoundary& boundary) const noexcept
+{
+    int start1, size1, start2, size2;
+    boundaryFifo.prepareToRead (1, start1, size1, start2, size2);
+
+    if (size1 == 0)
+        return false;
+
+    boundary = boundaries[start1];
+    return true;
+}
+
+void AudioRecorder::popBoundary() noexcept
+{
+    boundaryFifo.finishedRead (1);
+}
@@ -0,0 +1,176 @@
+/*
+  ==============================================================================
+
+    This file contains the lock-free audio capture path used by the recorder.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "RecorderMetrics.h"
+#include "RecordingWriter.h"
+#include "TakeHandover.h"
+
+//==============================================================================
+/**
+    Moves audio from the real-time thread to a RecordingWriter running on a
+    background TimeSliceThread, without the audio thread ever taking a lock.
+
+    The audio thread pushes blocks into a preallocated single-producer/single-
+    consumer ring. Starting or stopping a take only bumps an atomic take number:
+    the audio thread notices the change at the top of its next callback and posts
+    a boundary (new take number + stream position) into a second small ring, so
+    the writer thread knows exactly which samples belong to which file.
+
+    Writers are handed over through a TakeHandover, whose pending list is only
+    ever shared between the message thread and the writer thread.
+
+    Optionally the audio thread also keeps the last few seconds in a lookback
+    history that it overwrites continuously, recording or not. When a take starts
+    the writer thread copies that history into the file ahead of the live samples,
+    so the take begins before Record was pressed, sample-aligned with the ring.
+
+    Ring fill, dropped samples, writer lag, write stalls and bytes written are
+    reported to a RecorderMetrics owned by the caller. The ring can be resized
+    between takes (see resizeFifo), so its size can follow the stalls measured.
+*/
+class AudioRecorder  : public TimeSliceClient
+{
+public:
+    //==============================================================================
+    explicit AudioRecorder (RecorderMetrics& metricsToUpdate);
+    ~AudioRecorder() override;
+
+    //==============================================================================
+    /** Allocates the capture ring and the lookback history (which is disabled if
+        lookbackSamples is 0). Must not be called while the audio callback is running,
+        but the writer thread can carry on polling.
+    */
+    void prepare (int numChannels, int fifoSizeSamples, int lookbackSamples, int maxBlockSize);
+
+    /** Reallocates the capture ring between takes, while the audio callback keeps
+        running. Returns false (and leaves the ring alone) unless the last take has
+        been stopped and fully written, or if the writer thread is busy with the ring
+        - this never blocks. Call this from the message thread before
+        startTake(), never from the audio thread.
+    */
+    bool resizeFifo (int fifoSizeSamples);
+
+    /** Ends any open take and drains the ring from the calling thread.
+        Only call this while the audio callback is stopped (e.g. from releaseResources).
+    */
+    void release();
+
+    //==============================================================================
+    /** Pushes a block of audio into the capture ring. Called on the audio thread;
+        never blocks and never allocates.
+
+        requestedTake is the take to feed (see getRequestedTake). The timeline position
+        of the block's first sample is passed on to the writer of a take that starts
+        with this block.
+    */
+    void process (const float* const* channels, int numChannels, int numSamples,
+                  int requestedTake, TimelinePosition position = {});
+
+    /** The take the audio thread should be feeding. */
+    int getRequestedTake() const noexcept                       { return takes.getRequestedTake(); }
+
+    //==============================================================================
+    /** Hands a writer over to the recorder and asks the audio thread to start feeding
+        it from the next callback. Returns the new take number.
+    */
+    int startTake (std::unique_ptr<RecordingWriter> writer)     { return takes.startTake (std::move (writer)); }
+
+    /** Asks the audio thread to end the current take. Returns the take being stopped. */
+    int stopTake()                                              { return takes.stopTake(); }
+
+    /** True once the writer thread has flushed and closed the given take. Stopping
+        doesn't wait for this, so it can be polled to show when the file is complete.
+    */
+    bool isTakeFinished (int takeNumber) const noexcept         { return takes.isTakeFinished (takeNumber); }
+
+    /** Blocks the calling (non audio) thread until the writer thread has closed the
+        given take, or the timeout expires.
+    */
+    bool waitForTakeToFinish (int takeNumber, int timeoutMs)    { return takes.waitForTakeToFinish (takeNumber, timeoutMs); }
+
+    /** How often the writer thread asks the open take to commit a valid header
+        (see RecordingWriter::commit), or 0 to only do it when the take ends.
+    */
+    void setCommitInterval (int milliseconds) noexcept      { commitInterval = jmax (0, milliseconds); }
+
+    /** Leaves samples in the ring until at least this many are waiting (or a take starts or
+        stops), so the writer makes fewer, larger writes. Keep it well under the ring size.
+    */
+    void setWriteBatchSize (int numSamples) noexcept        { writeBatchSize = jmax (0, numSamples); }
+
+    /** The size the capture ring was allocated with, in samples. */
+    int getFifoSize() const noexcept                { return sampleFifo.getTotalSize(); }
+
+    /** The number of channels the ring was prepared with. Writers must not expect more. */
+    int getNumChannels() const noexcept             { return ringBuffer.getNumChannels(); }
+
+    //==============================================================================
+    int useTimeSlice() override;
+
+private:
+    //==============================================================================
+    struct TakeBoundary
+    {
+        int take;
+        int64 position;         // in the sample ring
+        int64 historyPosition;  // in the lookback history
+        TimelinePosition timelinePosition;
+    };
+
+    bool pushBoundary (TakeBoundary boundary) noexcept;
+    bool peekBoundary (TakeBoundary& boundary) const noexcept;
+    void popBoundary() noexcept;
+
+    void pushToRing (const float* const* channels, int numChannels, int numSamples) noexcept;
+    void pushToHistory (const float* const* channels, int numChannels, int numSamples) noexcept;
+
+    void writeFromRing (int numSamples);
+    void writeRegion (int start, int numSamples);
+    void writeLookback (int64 endPosition);
+    void switchToTake (const TakeBoundary& boundary);
+    void reportBytesWritten();
+
+    //==============================================================================
+    // Shared between the audio thread (producer) and the writer thread (consumer)
+    AudioBuffer<float> ringBuffer;
+    AbstractFifo sampleFifo { 1 };
+
+    static constexpr int boundaryFifoSize = 32;
+    TakeBoundary boundaries[boundaryFifoSize];
+    AbstractFifo boundaryFifo { boundaryFifoSize };
+
+    AudioBuffer<float> historyBuffer;
+    std::atomic<int64> historyPosition { 0 };   // total samples ever written to the history
+    int lookbackLength = 0, historyMargin = 0;
+
+    TakeHandover<RecordingWriter> takes;
+    RecorderMetrics& metrics;
+    std::atomic<int> commitInterval { 0 }, writeBatchSize { 0 };
+
+    // Audio thread only
+    int audioThreadTake = 0;
+    int64 audioThreadPosition = 0;
+
+    // Held by the writer thread while it reads the ring, and by prepare() and resizeFifo()
+    CriticalSection ringLock;
+
+    // Writer thread only
+    int writerTake = 0;
+    int64 writerPosition = 0;
+    std::unique_ptr<RecordingWriter> currentWriter;
+    int64 bytesReported = 0;
+    uint32 lastCommitTime = 0;
+    HeapBlock<const float*> readPointers;
+    AudioBuffer<float> lookbackScratch;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioRecorder)
+};
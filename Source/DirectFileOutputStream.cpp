@@ -0,0 +1,246 @@
+/*
+  ==============================================================================
+
+    This file contains the preallocating, block-aligned file stream used for
+    sustained WAV capture.
+
+  ==============================================================================
+*/
+
+#include "DirectFileOutputStream.h"
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <fcntl.h>
+ #include <unistd.h>
+ #define DIRECT_FILE_STREAM_AVAILABLE 1
+#else
+ #define DIRECT_FILE_STREAM_AVAILABLE 0
+#endif
+
+//==============================================================================
+DirectFileOutputStream::DirectFileOutputStream (const File& file, Options opts)
+    : options (opts)
+{
+    options.bufferSize = jmax (blockSize, (options.bufferSize + blockSize - 1) & ~(blockSize - 1));
+
+    bufferStorage.calloc ((size_t) (options.bufferSize + blockSize));
+    blockStorage.calloc ((size_t) (2 * blockSize));
+    buffer = snapPointerToAlignment (bufferStorage.get(), blockSize);
+    block = snapPointerToAlignment (blockStorage.get(), blockSize);
+
+   #if DIRECT_FILE_STREAM_AVAILABLE
+    auto path = file.getFullPathName();
+    auto flags = O_RDWR | O_CREAT | O_TRUNC;
+
+   #ifdef O_DIRECT
+    if (options.useDirectIO)
+    {
+        // (not every filesystem supports O_DIRECT - tmpfs doesn't - so fall back quietly)
+        fileHandle = ::open (path.toRawUTF8(), flags | O_DIRECT, 0644);
+        directIO = fileHandle >= 0;
+    }
+   #endif
+
+    if (fileHandle < 0)
+        fileHandle = ::open (path.toRawUTF8(), flags, 0644);
+
+   #if JUCE_MAC
+    if (fileHandle >= 0 && options.useDirectIO)
+        directIO = fcntl (fileHandle, F_NOCACHE, 1) != -1;
+   #endif
+
+    lastSyncTime = Time::getMillisecondCounter();
+   #else
+    ignoreUnused (file);
+   #endif
+}
+
+DirectFileOutputStream::~DirectFileOutputStream()
+{
+   #if DIRECT_FILE_STREAM_AVAILABLE
+    if (fileHandle < 0)
+        return;
+
+    flush();
+
+    // Gives back the preallocated extent and the padding of the last block
+    if (ftruncate (fileHandle, (off_t) endOfData) != 0)
+        ok = false;
+
+    if (options.syncInterval > 0)
+        syncIfDue (true);
+
+    ::close (fileHandle);
+   #endif
+}
+
+//==============================================================================
+bool DirectFileOutputStream::write (const void* data, size_t numBytes)
+{
+    if (! openedOk())
+        return false;
+
+    auto* src = static_cast<const uint8*> (data);
+
+    while (numBytes > 0)
+    {
+        if (position >= bufferStart)
+        {
+            // Appending (or overwriting something that's still in the buffer)
+            auto offset = (int) (position - bufferStart);
+            auto num = (int) jmin ((size_t) (options.bufferSize - offset), numBytes);
+
+            memcpy (buffer + offset, src, (size_t) num);
+            bufferUsed = jmax (bufferUsed, offset + num);
+            position += num;
+            src += num;
+            numBytes -= (size_t) num;
+
+            if (bufferUsed == options.bufferSize)
+            {
+                if (! writeBuffer ((size_t) options.bufferSize))
+                    return false;
+
+                bufferStart += options.bufferSize;
+                bufferUsed = 0;
+                syncIfDue (false);
+            }
+        }
+        else
+        {
+            // Behind the buffer, i.e. already written: patch it in place
+            auto blockStart = position & ~(int64) (blockSize - 1);
+            auto offset = (int) (position - blockStart);
+            auto num = (int) jmin ((int64) (blockSize - offset), bufferStart - position, (int64) numBytes);
+
+            if (! patchBlock (blockStart, offset, src, num))
+                return false;
+
+            position += num;
+            src += num;
+            numBytes -= (size_t) num;
+        }
+
+        endOfData = jmax (endOfData, position);
+    }
+
+    return true;
+}
+
+bool DirectFileOutputStream::setPosition (int64 newPosition)
+{
+    // (the file can't have holes in it)
+    if (newPosition < 0 || newPosition > endOfData)
+        return false;
+
+    position = newPosition;
+    return true;
+}
+
+void DirectFileOutputStream::flush()
+{
+    if (! openedOk() || bufferUsed == 0)
+        return;
+
+    // The partial block is written padded out to the block size, but stays in the buffer,
+    // so later data simply rewrites it. The padding is truncated off when the file closes.
+    auto numBytes = (size_t) ((bufferUsed + blockSize - 1) & ~(blockSize - 1));
+    zeromem (buffer + bufferUsed, numBytes - (size_t) bufferUsed);
+
+    writeBuffer (numBytes);
+    syncIfDue (false);
+}
+
+//==============================================================================
+bool DirectFileOutputStream::writeBuffer (size_t numBytes)
+{
+   #if DIRECT_FILE_STREAM_AVAILABLE
+    preallocate (bufferStart + (int64) numBytes);
+
+    for (size_t done = 0; done < numBytes;)
+    {
+        auto result = pwrite (fileHandle, buffer + done, numBytes - done, (off_t) (bufferStart + (int64) done));
+
+        if (result <= 0)
+        {
+            ok = false;
+            return false;
+        }
+
+        done += (size_t) result;
+    }
+
+    return true;
+   #else
+    ignoreUnused (numBytes);
+    return false;
+   #endif
+}
+
+bool DirectFileOutputStream::patchBlock (int64 blockStart, int offset, const void* data, int numBytes)
+{
+   #if DIRECT_FILE_STREAM_AVAILABLE
+    // Unbuffered I/O can only move whole aligned blocks, so this is a read-modify-write.
+    // It's only used for headers, a few times per take.
+    if (pread (fileHandle, block, (size_t) blockSize, (off_t) blockStart) < 0)
+    {
+        ok = false;
+        return false;
+    }
+
+    memcpy (block + offset, data, (size_t) numBytes);
+
+    ok = pwrite (fileHandle, block, (size_t) blockSize, (off_t) blockStart) == blockSize;
+    return ok;
+   #else
+    ignoreUnused (blockStart, offset, data, numBytes);
+    return false;
+   #endif
+}
+
+void DirectFileOutputStream::preallocate (int64 upTo)
+{
+   #if DIRECT_FILE_STREAM_AVAILABLE
+    if (upTo <= allocatedSize)
+        return;
+
+    auto newSize = allocatedSize + jmax (options.preallocationChunk, upTo - allocatedSize);
+
+   #if JUCE_MAC
+    fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, (off_t) (newSize - allocatedSize), 0 };
+
+    if (fcntl (fileHandle, F_PREALLOCATE, &store) == -1)
+    {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl (fileHandle, F_PREALLOCATE, &store);
+    }
+   #elif JUCE_LINUX
+    // (a failure here isn't fatal - the writes just extend the file as they go)
+    posix_fallocate (fileHandle, (off_t) allocatedSize, (off_t) (newSize - allocatedSize));
+   #endif
+
+    allocatedSize = newSize;
+   #else
+    ignoreUnused (upTo);
+   #endif
+}
+
+void DirectFileOutputStream::syncIfDue (bool force)
+{
+   #if DIRECT_FILE_STREAM_AVAILABLE
+    auto now = Time::getMillisecondCounter();
+
+    if (force || (options.syncInterval > 0 && now - lastSyncTime >= (uint32) options.syncInterval))
+    {
+       #if JUCE_LINUX
+        fdatasync (fileHandle);
+       #else
+        fsync (fileHandle);
+       #endif
+
+        lastSyncTime = now;
+    }
+   #else
+    ignoreUnused (force);
+   #endif
+}
@@ -0,0 +1,85 @@
+/*
+  ==============================================================================
+
+    This file contains the preallocating, block-aligned file stream used for
+    sustained WAV capture.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    An OutputStream for long sequential recordings. It behaves like a
+    FileOutputStream, but it talks to the file descriptor directly:
+
+    - The file is preallocated in large chunks ahead of the write position, so
+      the filesystem doesn't have to grow it on every flush.
+    - Data is gathered into a page-aligned buffer and written in whole aligned
+      blocks, optionally with O_DIRECT (F_NOCACHE on macOS), which keeps a long
+      take out of the page cache.
+    - fdatasync is only issued every syncInterval milliseconds.
+    - On close the file is truncated to the exact number of bytes written.
+
+    Seeking backwards (e.g. to rewrite a header) is supported. Bytes that are
+    already on disk are patched one aligned block at a time.
+
+    Only available on POSIX systems; elsewhere openedOk() returns false.
+*/
+class DirectFileOutputStream  : public OutputStream
+{
+public:
+    //==============================================================================
+    struct Options
+    {
+        bool useDirectIO = false;                       // O_DIRECT / F_NOCACHE
+        int bufferSize = 1 << 20;                       // rounded up to a multiple of the block size
+        int64 preallocationChunk = (int64) 64 << 20;    // how far ahead the file extent is reserved
+        int syncInterval = 2000;                        // ms between fdatasyncs, 0 for never
+    };
+
+    /** Truncates and opens the file. Check openedOk() before writing. */
+    DirectFileOutputStream (const File& file, Options options);
+
+    /** Flushes, truncates the file to its exact size and closes it. */
+    ~DirectFileOutputStream() override;
+
+    bool openedOk() const noexcept                  { return fileHandle >= 0 && ok; }
+
+    /** True if the file could be opened for unbuffered I/O. */
+    bool isUsingDirectIO() const noexcept           { return directIO; }
+
+    //==============================================================================
+    void flush() override;
+    int64 getPosition() override                    { return position; }
+    bool setPosition (int64 newPosition) override;
+    bool write (const void* data, size_t numBytes) override;
+
+    static constexpr int blockSize = 4096;
+
+private:
+    //==============================================================================
+    bool writeBuffer (size_t numBytes);
+    bool patchBlock (int64 blockStart, int offset, const void* data, int numBytes);
+    void preallocate (int64 upTo);
+    void syncIfDue (bool force);
+
+    Options options;
+    int fileHandle = -1;
+    bool directIO = false, ok = true;
+
+    HeapBlock<uint8> bufferStorage, blockStorage;
+    uint8* buffer = nullptr;        // page-aligned views of the storage above
+    uint8* block = nullptr;
+
+    int64 bufferStart = 0;          // file offset of buffer[0], always block-aligned
+    int bufferUsed = 0;
+    int64 position = 0, endOfData = 0, allocatedSize = 0;
+    uint32 lastSyncTime = 0;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DirectFileOutputStream)
+};
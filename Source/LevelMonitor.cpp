@@ -0,0 +1,166 @@
+/*
+  ==============================================================================
+
+    This file contains the live levels and waveform the audio thread hands to
+    the editor.
+
+  ==============================================================================
+*/
+
+#include "LevelMonitor.h"
+#include "PeakOverview.h"
+
+//==============================================================================
+LevelMonitor::LevelMonitor()
+    : live (std::make_unique<Snapshot>())
+{
+    // (allocated up front, since the snapshots are much too big for the stack)
+    published[0] = std::make_unique<Snapshot>();
+    published[1] = std::make_unique<Snapshot>();
+}
+
+void LevelMonitor::prepare (int channels, double newSampleRate, double windowSeconds)
+{
+    numChannels = jlimit (0, maxChannels, channels);
+    sampleRate = newSampleRate;
+    samplesPerColumn = jmax (1, roundToInt (windowSeconds * sampleRate / historySize));
+    samplesInColumn = 0;
+
+    // Peaks fall back at 24 dB per second
+    peakDecayPerSample = (float) std::pow (10.0, -24.0 / (20.0 * sampleRate));
+
+    for (auto& c : columnInProgress)
+        c = { 0.0f, 0.0f };
+
+    live->numChannels = numChannels;
+    live->numColumns = 0;
+
+    for (int ch = 0; ch < maxChannels; ++ch)
+        live->peak[ch] = live->rms[ch] = 0.0f;
+
+    publish();
+}
+
+//==============================================================================
+void LevelMonitor::process (const float* const* channels, int channelsToMeasure, int numSamples) noexcept
+{
+    if (numSamples <= 0)
+        return;
+
+    auto num = jmin (numChannels, channelsToMeasure);
+    float blockPeak[maxChannels] = {};
+    double blockSquares[maxChannels] = {};
+
+    // One pass over the samples feeds both the waveform columns and the meters
+    for (int done = 0; done < numSamples;)
+    {
+        auto chunk = jmin (numSamples - done, samplesPerColumn - samplesInColumn);
+
+        for (int ch = 0; ch < num; ++ch)
+        {
+            auto lo = 0.0f, hi = 0.0f;
+            PeakOverview::measure (channels[ch] + done, chunk, lo, hi, blockSquares[ch]);
+
+            auto& c = columnInProgress[ch];
+            c.minimum = jmin (c.minimum, lo);
+            c.maximum = jmax (c.maximum, hi);
+            blockPeak[ch] = jmax (blockPeak[ch], hi, -lo);
+        }
+
+        done += chunk;
+        samplesInColumn += chunk;
+
+        if (samplesInColumn == samplesPerColumn)
+        {
+            for (int ch = 0; ch < num; ++ch)
+            {
+                live->getColumn (live->numColumns, ch) = columnInProgress[ch];
+                columnInProgress[ch] = { 0.0f, 0.0f };
+            }
+
+            ++live->numColumns;
+            samplesInColumn = 0;
+        }
+    }
+
+    // Meter ballistics: peaks hold and fall back, RMS is smoothed over about 300ms
+    auto decay = std::pow (peakDecayPerSample, (float) numSamples);
+    auto smoothing = 1.0 - std::exp (-numSamples / (0.3 * sampleRate));
+
+    for (int ch = 0; ch < num; ++ch)
+    {
+        live->peak[ch] = jmax (blockPeak[ch], live->peak[ch] * decay);
+
+        auto meanSquare = (double) live->rms[ch] * live->rms[ch];
+        meanSquare += (blockSquares[ch] / numSamples - meanSquare) * smoothing;
+        live->rms[ch] = (float) std::sqrt (meanSquare);
+    }
+
+    publish();
+}
+
+void LevelMonitor::publish() noexcept
+{
+    // Fill whichever snapshot isn't the current one, unless the editor is reading it
+    auto target = 1 - publishedIndex.load();
+
+    if (readingIndex.load() == target)
+        return;
+
+    auto& dest = *published[target];
+    dest.numChannels = live->numChannels;
+
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        dest.peak[ch] = live->peak[ch];
+        dest.rms[ch] = live->rms[ch];
+    }
+
+    // (only the columns added since this snapshot was last filled)
+    auto first = jmax (dest.numColumns <= live->numColumns ? dest.numColumns : 0, live->numColumns - historySize);
+
+    for (auto i = first; i < live->numColumns; ++i)
+        for (int ch = 0; ch < numChannels; ++ch)
+            dest.getColumn (i, ch) = live->getColumn (i, ch);
+
+    dest.numColumns = live->numColumns;
+    publishedIndex = target;
+}
+
+//==============================================================================
+int64 LevelMonitor::copySnapshot (Snapshot& dest) const noexcept
+{
+    // Claim the current snapshot, then check it's still current: if it is, the audio thread
+    // can't start filling it until we let go of it
+    int index;
+
+    for (;;)
+    {
+        index = publishedIndex.load();
+        readingIndex = index;
+
+        if (publishedIndex.load() == index)
+            break;
+    }
+
+    auto& source = *published[index];
+    auto seen = source.numColumns >= dest.numColumns ? dest.numColumns : 0;
+    auto first = jmax (seen, source.numColumns - historySize);
+
+    dest.numChannels = source.numChannels;
+
+    for (int ch = 0; ch < source.numChannels; ++ch)
+    {
+        dest.peak[ch] = source.peak[ch];
+        dest.rms[ch] = source.rms[ch];
+    }
+
+    for (auto i = first; i < source.numColumns; ++i)
+        for (int ch = 0; ch < source.numChannels; ++ch)
+            dest.getColumn (i, ch) = source.getColumn (i, ch);
+
+    dest.numColumns = source.numColumns;
+    readingIndex = -1;
+
+    return dest.numColumns - seen;
+}
@@ -0,0 +1,93 @@
+/*
+  ==============================================================================
+
+    This file contains the live levels and waveform the audio thread hands to
+    the editor.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    Measures the input on the audio thread (per-channel peak and RMS meters,
+    plus min/max columns for a scrolling waveform) and publishes it to the
+    editor without locks.
+
+    The audio thread keeps its own copy of everything and, after each block,
+    copies what has changed into one of two published snapshots: whichever
+    one the editor isn't reading. If the editor happens to be reading the only
+    one that's free, publishing is just skipped for that block (nothing is
+    lost, since it's all copied across next time). The editor never waits
+    either: it copies the latest snapshot out, and only the waveform columns
+    it hasn't seen yet.
+
+    Meters have peak-hold style ballistics applied on the audio thread, so
+    they read correctly however often the editor looks at them.
+*/
+class LevelMonitor
+{
+public:
+    //==============================================================================
+    static constexpr int maxChannels = 16;      // (any more are left out of the display)
+    static constexpr int historySize = 512;     // waveform columns kept
+
+    struct Column
+    {
+        float minimum, maximum;
+    };
+
+    struct Snapshot
+    {
+        int numChannels = 0;
+        float peak[maxChannels] {}, rms[maxChannels] {};    // linear gain
+
+        /** Columns produced since prepare(). Column i is at getColumn (i, channel), as long
+            as it's one of the last historySize.
+        */
+        int64 numColumns = 0;
+
+        const Column& getColumn (int64 index, int channel) const noexcept   { return columns[(int) (index % historySize) * maxChannels + channel]; }
+        Column& getColumn (int64 index, int channel) noexcept               { return columns[(int) (index % historySize) * maxChannels + channel]; }
+
+        Column columns[historySize * maxChannels];
+    };
+
+    //==============================================================================
+    LevelMonitor();
+
+    /** Resets everything. Call before the audio thread starts. The waveform scrolls by a
+        column per windowSeconds / historySize.
+    */
+    void prepare (int numChannels, double sampleRate, double windowSeconds = 5.0);
+
+    /** Measures a block of input. Audio thread only. */
+    void process (const float* const* channels, int numChannels, int numSamples) noexcept;
+
+    /** Copies the latest levels into dest, along with any waveform columns it doesn't have
+        yet (dest should be a snapshot only ever updated by this). Never blocks; returns the
+        number of new columns.
+    */
+    int64 copySnapshot (Snapshot& dest) const noexcept;
+
+private:
+    //==============================================================================
+    void publish() noexcept;
+
+    std::unique_ptr<Snapshot> live;                 // audio thread only
+    std::unique_ptr<Snapshot> published[2];
+    std::atomic<int> publishedIndex { 0 };
+    mutable std::atomic<int> readingIndex { -1 };
+
+    int numChannels = 0;
+    int samplesPerColumn = 1, samplesInColumn = 0;
+    double sampleRate = 44100.0;
+    float peakDecayPerSample = 1.0f;
+    Column columnInProgress[maxChannels];
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LevelMonitor)
+};
@@ -0,0 +1,198 @@
+/*
+  ==============================================================================
+
+    This file contains the memory-mapped file stream used for WAV recordings.
+
+  ==============================================================================
+*/
+
+#include "MappedFileOutputStream.h"
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <unistd.h>
+ #define MAPPED_FILE_STREAM_AVAILABLE 1
+#else
+ #define MAPPED_FILE_STREAM_AVAILABLE 0
+#endif
+
+//==============================================================================
+MappedFileOutputStream::MappedFileOutputStream (const File& file, int64 size)
+{
+   #if MAPPED_FILE_STREAM_AVAILABLE
+    pageSize = jmax ((int64) 4096, (int64) sysconf (_SC_PAGESIZE));
+    windowSize = jmax (pageSize * 16, (size + pageSize - 1) / pageSize * pageSize);
+
+    auto path = file.getFullPathName();
+    fileHandle = ::open (path.toRawUTF8(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    // The first window is reserved and mapped up front, before the take starts
+    ok = fileHandle >= 0 && mapWindow (0);
+   #else
+    ignoreUnused (file);
+    windowSize = size;
+   #endif
+}
+
+MappedFileOutputStream::~MappedFileOutputStream()
+{
+   #if MAPPED_FILE_STREAM_AVAILABLE
+    if (fileHandle < 0)
+        return;
+
+    unmapWindow();
+
+    // (gives back the part of the last window that was never used)
+    if (ftruncate (fileHandle, (off_t) endOfData) != 0)
+        ok = false;
+
+    ::close (fileHandle);
+   #endif
+}
+
+//==============================================================================
+void* MappedFileOutputStream::getWritePointer (size_t numBytes)
+{
+    if (! openedOk() || (int64) numBytes > windowSize - pageSize)
+        return nullptr;
+
+    auto end = position + (int64) numBytes;
+
+    if (window == nullptr || position < windowStart || end > windowStart + windowSize)
+        if (! mapWindow (position - position % pageSize))
+            return nullptr;
+
+    return window + (position - windowStart);
+}
+
+void MappedFileOutputStream::advance (size_t numBytes) noexcept
+{
+    position += (int64) numBytes;
+    endOfData = jmax (endOfData, position);
+}
+
+bool MappedFileOutputStream::write (const void* data, size_t numBytes)
+{
+   #if MAPPED_FILE_STREAM_AVAILABLE
+    auto* src = static_cast<const uint8*> (data);
+
+    while (numBytes > 0)
+    {
+        if (position < windowStart)
+        {
+            // Behind the window (e.g. the header): write it into the file in place. The page
+            // cache is shared with the mapping, so this can't get out of step with it.
+            auto num = (size_t) jmin ((int64) numBytes, windowStart - position);
+
+            if (pwrite (fileHandle, src, num, (off_t) position) != (ssize_t) num)
+            {
+                ok = false;
+                return false;
+            }
+
+            advance (num);
+            src += num;
+            numBytes -= num;
+        }
+        else
+        {
+            auto num = (size_t) jmin ((int64) numBytes, windowSize / 2);
+            auto* dest = getWritePointer (num);
+
+            if (dest == nullptr)
+                return false;
+
+            memcpy (dest, src, num);
+            advance (num);
+            src += num;
+            numBytes -= num;
+        }
+    }
+
+    return true;
+   #else
+    ignoreUnused (data, numBytes);
+    return false;
+   #endif
+}
+
+bool MappedFileOutputStream::setPosition (int64 newPosition)
+{
+    // (the file can't have holes in it)
+    if (newPosition < 0 || newPosition > endOfData)
+        return false;
+
+    position = newPosition;
+    return true;
+}
+
+void MappedFileOutputStream::flush()
+{
+   #if MAPPED_FILE_STREAM_AVAILABLE
+    if (window != nullptr)
+        msync (window, (size_t) windowSize, MS_ASYNC);
+   #endif
+}
+
+//==============================================================================
+bool MappedFileOutputStream::mapWindow (int64 start)
+{
+   #if MAPPED_FILE_STREAM_AVAILABLE
+    unmapWindow();
+
+    if (! reserve (start + windowSize))
+    {
+        ok = false;
+        return false;
+    }
+
+    auto* mapped = mmap (nullptr, (size_t) windowSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileHandle, (off_t) start);
+
+    if (mapped == MAP_FAILED)
+    {
+        ok = false;
+        return false;
+    }
+
+    window = static_cast<uint8*> (mapped);
+    windowStart = start;
+    return true;
+   #else
+    ignoreUnused (start);
+    return false;
+   #endif
+}
+
+void MappedFileOutputStream::unmapWindow()
+{
+   #if MAPPED_FILE_STREAM_AVAILABLE
+    if (window != nullptr)
+        munmap (window, (size_t) windowSize);
+
+    window = nullptr;
+   #endif
+}
+
+bool MappedFileOutputStream::reserve (int64 size)
+{
+   #if MAPPED_FILE_STREAM_AVAILABLE
+    if (size <= fileSize)
+        return true;
+
+    // The mapping mustn't reach past the end of the file, so it grows a window at a time.
+    // Allocating the blocks now (rather than leaving a sparse file) means a full disk shows
+    // up here instead of as a SIGBUS when a page is first touched.
+   #if JUCE_LINUX
+    if (posix_fallocate (fileHandle, (off_t) fileSize, (off_t) (size - fileSize)) != 0)
+   #endif
+        if (ftruncate (fileHandle, (off_t) size) != 0)
+            return false;
+
+    fileSize = size;
+    return true;
+   #else
+    ignoreUnused (size);
+    return false;
+   #endif
+}
@@ -0,0 +1,73 @@
+/*
+  ==============================================================================
+
+    This file contains the memory-mapped file stream used for WAV recordings.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    An OutputStream that writes through a window of the file mapped into memory.
+
+    The file is extended (preallocated where the OS allows) one window at a time
+    ahead of the write position, and the window moves along as the take grows.
+    getWritePointer() hands out the mapped bytes at the current position, so a
+    writer can convert samples straight into the file with no intermediate
+    buffer and no write() calls. Writes to data behind the window (such as the
+    header rewrite at the end of a take) go straight into the file in place.
+
+    On close the window is unmapped and the file truncated to the bytes written.
+    Only available on POSIX systems; elsewhere openedOk() returns false.
+*/
+class MappedFileOutputStream  : public OutputStream
+{
+public:
+    //==============================================================================
+    /** Truncates and opens the file, and maps its first window. */
+    MappedFileOutputStream (const File& file, int64 windowSize = (int64) 64 << 20);
+
+    /** Unmaps the file, truncates it to its exact size and closes it. */
+    ~MappedFileOutputStream() override;
+
+    bool openedOk() const noexcept                  { return fileHandle >= 0 && ok; }
+
+    //==============================================================================
+    /** Returns numBytes of the mapped file starting at the current position (moving
+        the window if needed), or nullptr if that many bytes can't be mapped at once.
+        Fill them in, then call advance().
+    */
+    void* getWritePointer (size_t numBytes);
+
+    /** Moves the position on past bytes filled in through getWritePointer(). */
+    void advance (size_t numBytes) noexcept;
+
+    //==============================================================================
+    /** Schedules the dirty pages of the window to be written back. */
+    void flush() override;
+    int64 getPosition() override                    { return position; }
+    bool setPosition (int64 newPosition) override;
+    bool write (const void* data, size_t numBytes) override;
+
+private:
+    //==============================================================================
+    bool mapWindow (int64 start);
+    void unmapWindow();
+    bool reserve (int64 size);
+
+    int fileHandle = -1;
+    bool ok = true;
+
+    int64 pageSize = 4096, windowSize;
+    uint8* window = nullptr;
+    int64 windowStart = 0;
+
+    int64 position = 0, endOfData = 0, fileSize = 0;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MappedFileOutputStream)
+};
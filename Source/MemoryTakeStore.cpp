@@ -0,0 +1,401 @@
+/*
+  ==============================================================================
+
+    This file contains the store that keeps takes in memory, losslessly
+    compressed, until they're saved or thrown away.
+
+  ==============================================================================
+*/
+
+#include "MemoryTakeStore.h"
+
+//==============================================================================
+/** Appends to (or, for header fix-ups, overwrites) a take's chunks, allocating a chunk
+    at a time from the store's budget.
+*/
+class MemoryTake::ChunkOutputStream  : public OutputStream
+{
+public:
+    ChunkOutputStream (MemoryTake& owner, Chunks& chunksToUse)
+        : take (&owner), chunks (chunksToUse)
+    {
+        ++take->openStreams;
+    }
+
+    ~ChunkOutputStream() override
+    {
+        --take->openStreams;
+    }
+
+    void flush() override {}
+
+    bool setPosition (int64 newPosition) override
+    {
+        if (newPosition < 0 || newPosition > chunks.size)
+            return false;
+
+        position = newPosition;
+        return true;
+    }
+
+    int64 getPosition() override                    { return position; }
+
+    bool write (const void* data, size_t numBytes) override
+    {
+        auto* source = static_cast<const char*> (data);
+
+        while (numBytes > 0)
+        {
+            auto index = (int) (position / MemoryTakeStore::chunkSize);
+            auto offset = (int) (position % MemoryTakeStore::chunkSize);
+
+            if (index == chunks.blocks.size())
+            {
+                if (! take->store.allocate (MemoryTakeStore::chunkSize)
+                     && ! (take->store.makeRoom (MemoryTakeStore::chunkSize, take.get())
+                            && take->store.allocate (MemoryTakeStore::chunkSize)))
+                {
+                    take->truncated = true;
+                    return false;
+                }
+
+                chunks.blocks.add (new MemoryBlock ((size_t) MemoryTakeStore::chunkSize));
+                take->bytesAllocated += MemoryTakeStore::chunkSize;
+            }
+
+            auto num = jmin (numBytes, (size_t) (MemoryTakeStore::chunkSize - offset));
+            memcpy (static_cast<char*> (chunks.blocks.getUnchecked (index)->getData()) + offset, source, num);
+
+            source += num;
+            numBytes -= num;
+            position += (int64) num;
+
+            if (position > chunks.size)
+                chunks.size = position;
+        }
+
+        return true;
+    }
+
+private:
+    MemoryTake::Ptr take;
+    Chunks& chunks;
+    int64 position = 0;
+};
+
+//==============================================================================
+/** Reads a finished take's chunks back as one stream. */
+class MemoryTake::ChunkInputStream  : public InputStream
+{
+public:
+    explicit ChunkInputStream (const Chunks& chunksToRead)
+        : chunks (chunksToRead)
+    {
+    }
+
+    int64 getTotalLength() override                 { return chunks.size; }
+    bool isExhausted() override                     { return position >= chunks.size; }
+    int64 getPosition() override                    { return position; }
+
+    bool setPosition (int64 newPosition) override
+    {
+        position = jlimit ((int64) 0, chunks.size.load(), newPosition);
+        return true;
+    }
+
+    int read (void* destBuffer, int maxBytesToRead) override
+    {
+        auto numToRead = (int) jmin ((int64) maxBytesToRead, chunks.size - position);
+        auto* dest = static_cast<char*> (destBuffer);
+
+        for (int done = 0; done < numToRead;)
+        {
+            auto index = (int) (position / MemoryTakeStore::chunkSize);
+            auto offset = (int) (position % MemoryTakeStore::chunkSize);
+            auto num = jmin (numToRead - done, MemoryTakeStore::chunkSize - offset);
+
+            memcpy (dest + done, static_cast<const char*> (chunks.blocks.getUnchecked (index)->getData()) + offset, (size_t) num);
+            done += num;
+            position += num;
+        }
+
+        return jmax (0, numToRead);
+    }
+
+private:
+    const Chunks& chunks;
+    int64 position = 0;
+};
+
+//==============================================================================
+/** Encodes the take into one FLAC stream per group of channels. */
+class MemoryTake::AudioWriter  : public RecordingWriter
+{
+public:
+    explicit AudioWriter (MemoryTake& owner)
+        : take (&owner)
+    {
+        FlacAudioFormat flacFormat;
+
+        for (int group = 0; group < take->audio.size(); ++group)
+        {
+            auto numGroupChannels = jmin (maxChannelsPerStream, take->numChannels - group * maxChannelsPerStream);
+            auto stream = std::make_unique<ChunkOutputStream> (*take, *take->audio.getUnchecked (group));
+
+            std::unique_ptr<AudioFormatWriter> writer (flacFormat.createWriterFor (stream.get(), take->sampleRate, (unsigned int) numGroupChannels,
+                                                                                   take->bitsPerSample, {}, 5));
+            if (writer == nullptr)
+                continue;
+
+            stream.release(); // (the writer deletes it)
+            writers.add (writer.release());
+        }
+    }
+
+    bool openedOk() const noexcept                  { return writers.size() == take->audio.size(); }
+
+    bool write (const float* const* channels, int numSamples) override
+    {
+        // Stop at the limit between blocks, rather than running out part-way through a FLAC
+        // frame (allowing for a worst case of no compression, plus a chunk for each stream)
+        auto worstCase = (int64) numSamples * take->numChannels * 4 + (int64) MemoryTakeStore::chunkSize * writers.size();
+
+        if (take->truncated || ! take->store.makeRoom (worstCase, take.get()))
+        {
+            take->truncated = true;
+            return false;
+        }
+
+        bool ok = true;
+
+        for (int group = 0; group < writers.size(); ++group)
+            ok = writers.getUnchecked (group)->writeFromFloatArrays (channels + group * maxChannelsPerStream,
+                                                                    writers.getUnchecked (group)->getNumChannels(), numSamples) && ok;
+
+        take->numSamples += numSamples;
+        return ok;
+    }
+
+    // (everything is already "saved" - there's nothing to make safe from a crash)
+    bool commit() override                          { return true; }
+
+    int getNumChannels() const override             { return take->numChannels; }
+
+    int64 getNumBytesWritten() const override
+    {
+        int64 total = 0;
+
+        for (auto* chunks : take->audio)
+            total += chunks->size;
+
+        return total;
+    }
+
+    static constexpr int maxChannelsPerStream = 8;
+
+private:
+    MemoryTake::Ptr take;
+    OwnedArray<AudioFormatWriter> writers;
+};
+
+//==============================================================================
+MemoryTake::MemoryTake (MemoryTakeStore& owner, const File& audio_, const File& midi_,
+                        double rate, int channels, int bits)
+    : store (owner), audioFile (audio_), midiFile (midi_),
+      sampleRate (rate), numChannels (jmax (1, channels)), bitsPerSample (bits)
+{
+    for (int first = 0; first < numChannels; first += AudioWriter::maxChannelsPerStream)
+        audio.add (new Chunks());
+}
+
+MemoryTake::~MemoryTake()
+{
+    store.release (bytesAllocated);
+}
+
+MemoryTake::Stats MemoryTake::getStats() const
+{
+    Stats stats;
+    stats.numChannels = numChannels;
+    stats.sampleRate = sampleRate;
+    stats.numSamples = numSamples;
+
+    for (auto* chunks : audio)
+        stats.audioBytes += chunks->size;
+
+    stats.midiBytes = midi.size;
+    stats.memoryUsed = bytesAllocated;
+    stats.finished = isFinished();
+    stats.truncated = truncated;
+
+    if (stats.audioBytes > 0)
+        stats.compressionRatio = (double) stats.numSamples * numChannels * (bitsPerSample / 8) / (double) stats.audioBytes;
+
+    return stats;
+}
+
+//==============================================================================
+std::unique_ptr<RecordingWriter> MemoryTake::createAudioWriter()
+{
+    jassert (audio.getFirst()->size == 0);   // (only one writer per take)
+
+    auto writer = std::make_unique<AudioWriter> (*this);
+
+    if (writer->openedOk())
+        return writer;
+
+    return nullptr;
+}
+
+std::unique_ptr<MidiFileStreamWriter> MemoryTake::createMidiWriter (int ticksPerQuarterNote)
+{
+    jassert (midi.size == 0);
+
+    return std::make_unique<MidiFileStreamWriter> (std::make_unique<ChunkOutputStream> (*this, midi), ticksPerQuarterNote);
+}
+
+bool MemoryTake::commit (const File& audioFileToWrite, const File& midiFileToWrite, const WriterFactory& createWriter) const
+{
+    if (! isFinished())
+        return false;
+
+    // Audio: decode every group's stream, and write the groups' channels side by side
+    if (audioFileToWrite != File())
+    {
+        FlacAudioFormat flacFormat;
+        OwnedArray<AudioFormatReader> readers;
+
+        for (auto* chunks : audio)
+        {
+            auto input = std::make_unique<ChunkInputStream> (*chunks);
+            std::unique_ptr<AudioFormatReader> reader (flacFormat.createReaderFor (input.get(), false));
+
+            if (reader == nullptr)
+                return false;
+
+            input.release(); // (the reader deletes it)
+            readers.add (reader.release());
+        }
+
+        auto writer = createWriter (audioFileToWrite, numChannels);
+
+        if (writer == nullptr)
+            return false;
+
+        const int blockSize = 8192;
+        AudioBuffer<float> buffer (numChannels, blockSize);
+        auto length = numSamples.load();
+
+        for (int64 position = 0; position < length; position += blockSize)
+        {
+            auto num = (int) jmin ((int64) blockSize, length - position);
+            auto** channels = buffer.getArrayOfWritePointers();
+
+            // (FLAC decodes to left-justified integers, converted in place like AudioFormatReader does)
+            for (int group = 0; group < readers.size(); ++group)
+            {
+                auto* reader = readers.getUnchecked (group);
+                auto first = group * AudioWriter::maxChannelsPerStream;
+                auto numGroupChannels = (int) reader->numChannels;
+
+                if (! reader->read (reinterpret_cast<int* const*> (channels + first), numGroupChannels, position, num, false))
+                    return false;
+
+                for (int ch = first; ch < first + numGroupChannels; ++ch)
+                    FloatVectorOperations::convertFixedToFloat (channels[ch], reinterpret_cast<const int*> (channels[ch]),
+                                                                1.0f / (float) 0x7fffffff, num);
+            }
+
+            if (! writer->write (buffer.getArrayOfReadPointers(), num))
+                return false;
+        }
+    }
+
+    // Midi: already a complete standard midi file
+    if (midiFileToWrite != File())
+    {
+        midiFileToWrite.deleteFile();
+        FileOutputStream out (midiFileToWrite);
+        ChunkInputStream in (midi);
+
+        if (! out.openedOk() || out.writeFromInputStream (in, -1) != midi.size)
+            return false;
+
+        out.flush();
+        return ! out.getStatus().failed();
+    }
+
+    return true;
+}
+
+//==============================================================================
+bool MemoryTakeStore::allocate (int64 numBytes) noexcept
+{
+    auto used = memoryUsed.load();
+
+    do
+    {
+        if (used + numBytes > memoryLimit)
+            return false;
+    }
+    while (! memoryUsed.compare_exchange_weak (used, used + numBytes));
+
+    return true;
+}
+
+MemoryTake::Ptr MemoryTakeStore::createTake (const File& audioFile, const File& midiFile, double sampleRate,
+                                             int numChannels, int bitsPerSample)
+{
+    const ScopedLock sl (lock);
+    return takes.add (new MemoryTake (*this, audioFile, midiFile, sampleRate, numChannels, bitsPerSample));
+}
+
+int MemoryTakeStore::getNumTakes() const
+{
+    const ScopedLock sl (lock);
+    return takes.size();
+}
+
+MemoryTake::Ptr MemoryTakeStore::getTake (int index) const
+{
+    const ScopedLock sl (lock);
+    return takes[index];
+}
+
+MemoryTake::Ptr MemoryTakeStore::getLastTake() const
+{
+    const ScopedLock sl (lock);
+    return takes.getLast();
+}
+
+void MemoryTakeStore::removeTake (MemoryTake* take)
+{
+    const ScopedLock sl (lock);
+    takes.removeObject (take);
+}
+
+bool MemoryTakeStore::makeRoom (int64 numBytes, const MemoryTake* takeToKeep)
+{
+    // (runs on the writer thread - the oldest finished takes go first, and a take that's still
+    // recording or the one asking is never touched)
+    while (memoryUsed.load() + numBytes > memoryLimit)
+    {
+        MemoryTake::Ptr evicted;
+
+        {
+            const ScopedLock sl (lock);
+
+            for (int i = 0; i < takes.size() && evicted == nullptr; ++i)
+                if (takes.getUnchecked (i) != takeToKeep && takes.getUnchecked (i)->isFinished())
+                    evicted = takes.removeAndReturn (i);
+        }
+
+        if (evicted == nullptr)
+            return false;
+
+        // (its memory is given back here, unless something is still looking at it)
+        ++numTakesEvicted;
+    }
+
+    return true;
+}
@@ -0,0 +1,158 @@
+/*
+  ==============================================================================
+
+    This file contains the store that keeps takes in memory, losslessly
+    compressed, until they're saved or thrown away.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "MidiFileStreamWriter.h"
+#include "RecordingWriter.h"
+
+class MemoryTakeStore;
+
+//==============================================================================
+/**
+    One take held in memory: the audio as FLAC streams (one per group of up to
+    eight channels, which is as many as FLAC allows), and the midi as a
+    standard midi file, both in fixed-size chunks so they grow without ever
+    being copied.
+
+    The writers from createAudioWriter() and createMidiWriter() are used on
+    the writer thread, exactly like a file's. Once both have been deleted the
+    take is finished, and can be saved to any format with commit() (or just
+    released, without anything ever going to disk).
+*/
+class MemoryTake  : public ReferenceCountedObject
+{
+public:
+    //==============================================================================
+    using Ptr = ReferenceCountedObjectPtr<MemoryTake>;
+
+    ~MemoryTake() override;
+
+    struct Stats
+    {
+        int numChannels = 0;
+        double sampleRate = 0.0;
+        int64 numSamples = 0;
+        int64 audioBytes = 0, midiBytes = 0;    // compressed size
+        int64 memoryUsed = 0;                   // including the unused end of each chunk
+        double compressionRatio = 0.0;          // PCM at the take's bit depth, over audioBytes
+        bool finished = false;
+        bool truncated = false;                 // the store's memory limit was reached
+    };
+
+    Stats getStats() const;
+
+    /** The files the take was started with (where commit() would usually put it). */
+    const File& getAudioFile() const noexcept               { return audioFile; }
+    const File& getMidiFile() const noexcept                { return midiFile; }
+
+    bool isFinished() const noexcept                        { return openStreams.load() == 0; }
+
+    //==============================================================================
+    /** The writers for the take (each can only be created once). */
+    std::unique_ptr<RecordingWriter> createAudioWriter();
+    std::unique_ptr<MidiFileStreamWriter> createMidiWriter (int ticksPerQuarterNote);
+
+    /** Opens a writer for the committed audio (a .wav, .ogg or .flac file). */
+    using WriterFactory = std::function<std::unique_ptr<RecordingWriter> (const File& audioFile, int numChannels)>;
+
+    /** Decodes the take into a file of any format, and copies out the midi file. Only works
+        once the take is finished. Runs on the calling thread, and takes as long as writing
+        the file would.
+    */
+    bool commit (const File& audioFileToWrite, const File& midiFileToWrite, const WriterFactory& createWriter) const;
+
+private:
+    //==============================================================================
+    friend class MemoryTakeStore;
+
+    MemoryTake (MemoryTakeStore& owner, const File& audioFile, const File& midiFile,
+                double sampleRate, int numChannels, int bitsPerSample);
+
+    struct Chunks
+    {
+        OwnedArray<MemoryBlock> blocks;
+        std::atomic<int64> size { 0 };
+    };
+
+    class ChunkOutputStream;
+    class ChunkInputStream;
+    class AudioWriter;
+
+    MemoryTakeStore& store;
+    File audioFile, midiFile;
+    double sampleRate;
+    int numChannels, bitsPerSample;
+
+    OwnedArray<Chunks> audio;      // one FLAC stream per group of channels
+    Chunks midi;
+    std::atomic<int> openStreams { 0 };
+    std::atomic<int64> numSamples { 0 }, bytesAllocated { 0 };
+    std::atomic<bool> truncated { false };
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MemoryTake)
+};
+
+//==============================================================================
+/**
+    The takes recorded to memory, and the limit on how much memory they can use
+    between them.
+
+    The memory is allocated a chunk at a time on the writer thread as a take
+    grows, so the audio thread does exactly the same work as when recording to
+    disk. When the limit is reached, the oldest finished takes are evicted to
+    make room (see getNumTakesEvicted()). Only if the take still doesn't fit on
+    its own is the rest of it left out (and the take marked as truncated).
+    Removing a take, once its writers are done with it, gives its memory back.
+*/
+class MemoryTakeStore
+{
+public:
+    //==============================================================================
+    static constexpr int chunkSize = 64 * 1024;
+
+    MemoryTakeStore() = default;
+
+    void setMemoryLimit (int64 numBytes)                    { memoryLimit = jmax ((int64) chunkSize, numBytes); }
+    int64 getMemoryLimit() const noexcept                   { return memoryLimit; }
+    int64 getMemoryUsed() const noexcept                    { return memoryUsed; }
+
+    //==============================================================================
+    /** Adds a new, empty take (files are only used as the default place to commit it to). */
+    MemoryTake::Ptr createTake (const File& audioFile, const File& midiFile, double sampleRate, int numChannels, int bitsPerSample);
+
+    int getNumTakes() const;
+    MemoryTake::Ptr getTake (int index) const;
+    MemoryTake::Ptr getLastTake() const;
+
+    /** Forgets a take. Its memory is freed once nothing else is using it. */
+    void removeTake (MemoryTake* take);
+
+    /** How many finished takes have been thrown away to make room for newer ones. */
+    int getNumTakesEvicted() const noexcept                 { return numTakesEvicted; }
+
+private:
+    //==============================================================================
+    friend class MemoryTake;
+
+    bool allocate (int64 numBytes) noexcept;
+    void release (int64 numBytes) noexcept                  { memoryUsed -= numBytes; }
+    bool makeRoom (int64 numBytes, const MemoryTake* takeToKeep);
+
+    CriticalSection lock;
+    ReferenceCountedArray<MemoryTake> takes;
+    std::atomic<int64> memoryLimit { (int64) 256 * 1024 * 1024 };
+    std::atomic<int64> memoryUsed { 0 };
+    std::atomic<int> numTakesEvicted { 0 };
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MemoryTakeStore)
+};
@@ -0,0 +1,137 @@
+/*
+  ==============================================================================
+
+    This file contains an incremental standard midi file writer.
+
+  ==============================================================================
+*/
+
+#include "MidiFileStreamWriter.h"
+
+//==============================================================================
+MidiFileStreamWriter::MidiFileStreamWriter (std::unique_ptr<OutputStream> destStream, int ppq)
+    : stream (std::move (destStream)),
+      ticksPerQuarterNote (ppq)
+{
+    if (stream == nullptr)
+    {
+        ok = false;
+        return;
+    }
+
+    // Header chunk: format 0, one track
+    ok = stream->writeIntBigEndian ((int) ByteOrder::bigEndianInt ("MThd"))
+      && stream->writeIntBigEndian (6)
+      && stream->writeShortBigEndian (0)
+      && stream->writeShortBigEndian (1)
+      && stream->writeShortBigEndian ((short) ticksPerQuarterNote)
+      && stream->writeIntBigEndian ((int) ByteOrder::bigEndianInt ("MTrk"))
+      && stream->writeIntBigEndian (0);    // (patched by commitTrackLength)
+
+    trackStart = stream->getPosition();
+}
+
+MidiFileStreamWriter::~MidiFileStreamWriter()
+{
+    finish();
+}
+
+//==============================================================================
+bool MidiFileStreamWriter::writeEvent (int tick, const uint8* data, int numBytes)
+{
+    if (! ok || finished || numBytes <= 0)
+        return false;
+
+    tick = jmax (tick, lastTick);
+    ok = writeVariableLengthInt ((uint32) (tick - lastTick));
+    lastTick = tick;
+
+    if (data[0] == 0xf0 && numBytes > 1)
+    {
+        // Sysex messages are stored with a length after the status byte
+        ok = ok && stream->writeByte ((char) 0xf0)
+                && writeVariableLengthInt ((uint32) (numBytes - 1))
+                && stream->write (data + 1, (size_t) numBytes - 1);
+    }
+    else
+    {
+        ok = ok && stream->write (data, (size_t) numBytes);
+    }
+
+    return ok;
+}
+
+void MidiFileStreamWriter::enableSeekIndex (const File& indexFile, double sampleRate)
+{
+    seekIndex = std::make_unique<SeekIndex> (SeekIndex::Kind::midiEvents, sampleRate);
+    seekIndexFile = indexFile;
+}
+
+void MidiFileStreamWriter::addSeekPoint (int64 samplePosition)
+{
+    // (the next event's delta counts from lastTick, so reading can start here with that tick)
+    if (seekIndex != nullptr && ok && ! finished)
+        seekIndex->addPoint (samplePosition, stream->getPosition(), lastTick);
+}
+
+bool MidiFileStreamWriter::flush()
+{
+    if (! ok || finished)
+        return false;
+
+    ok = commitTrackLength();
+    stream->flush();
+    return ok;
+}
+
+bool MidiFileStreamWriter::finish()
+{
+    if (finished || stream == nullptr)
+        return ok;
+
+    const uint8 endOfTrack[] = { 0xff, 0x2f, 0x00 };
+
+    ok = ok && writeVariableLengthInt (0)
+            && stream->write (endOfTrack, sizeof (endOfTrack))
+            && commitTrackLength();
+
+    stream->flush();
+    finished = true;
+
+    if (seekIndex != nullptr && ok)
+        seekIndex->save (seekIndexFile);
+
+    return ok;
+}
+
+//==============================================================================
+bool MidiFileStreamWriter::writeVariableLengthInt (uint32 value)
+{
+    auto buffer = (uint32) (value & 0x7f);
+
+    while ((value >>= 7) != 0)
+    {
+        buffer <<= 8;
+        buffer |= ((value & 0x7f) | 0x80);
+    }
+
+    for (;;)
+    {
+        if (! stream->writeByte ((char) buffer))
+            return false;
+
+        if (buffer & 0x80)
+            buffer >>= 8;
+        else
+            return true;
+    }
+}
+
+bool MidiFileStreamWriter::commitTrackLength()
+{
+    auto end = stream->getPosition();
+
+    return stream->setPosition (trackStart - 4)
+        && stream->writeIntBigEndian ((int) (end - trackStart))
+        && stream->setPosition (end);
+}
@@ -0,0 +1,72 @@
+/*
+  ==============================================================================
+
+    This file contains an incremental standard midi file writer.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "SeekIndex.h"
+
+//==============================================================================
+/**
+    Writes a single-track (format 0) standard midi file event by event, instead of
+    building the whole sequence in memory and serialising it at the end.
+
+    The MTrk chunk length is patched every time the writer is flushed, so a file
+    that is cut off by a crash is still readable up to the last flush. Finishing
+    the file only appends the end-of-track event and patches the length once more.
+*/
+class MidiFileStreamWriter
+{
+public:
+    //==============================================================================
+    MidiFileStreamWriter (std::unique_ptr<OutputStream> destStream, int ticksPerQuarterNote);
+
+    /** Finishes the file if finish() hasn't already been called. */
+    ~MidiFileStreamWriter();
+
+    //==============================================================================
+    /** Appends an event at an absolute tick position. Events must arrive in time order;
+        anything earlier than the last event is written at the same tick as it.
+    */
+    bool writeEvent (int tick, const uint8* data, int numBytes);
+
+    /** Builds a SeekIndex as the events are written, and saves it to indexFile when the
+        file is finished.
+    */
+    void enableSeekIndex (const File& indexFile, double sampleRate);
+
+    /** Marks where the next event starts, for the seek index (if there is one). */
+    void addSeekPoint (int64 samplePosition);
+
+    /** Pushes buffered data to disk and commits the current track length to the header. */
+    bool flush();
+
+    /** Writes the end-of-track event and the final track length. */
+    bool finish();
+
+    //==============================================================================
+    int getTicksPerQuarterNote() const noexcept     { return ticksPerQuarterNote; }
+    int getLastTick() const noexcept                { return lastTick; }
+    int64 getNumBytesWritten() const                { return stream != nullptr ? stream->getPosition() : 0; }
+
+private:
+    //==============================================================================
+    bool writeVariableLengthInt (uint32 value);
+    bool commitTrackLength();
+
+    std::unique_ptr<OutputStream> stream;
+    std::unique_ptr<SeekIndex> seekIndex;
+    File seekIndexFile;
+    int ticksPerQuarterNote;
+    int64 trackStart = 0;
+    int lastTick = 0;
+    bool ok = true, finished = false;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiFileStreamWriter)
+};
@@ -0,0 +1,344 @@
+/*
+  ==============================================================================
+
+    This file contains the streaming midi capture path used by the recorder.
+
+  ==============================================================================
+*/
+
+#include "MidiRecorder.h"
+
+//==============================================================================
+MidiRecorder::MidiRecorder (RecorderMetrics& metricsToUpdate)
+    : metrics (metricsToUpdate),
+      records ((size_t) ringSize, true),
+      sysexPool ((size_t) sysexPoolSize),
+      sysexScratch ((size_t) sysexPoolSize),
+      history ((size_t) historySize, true)
+{
+}
+
+MidiRecorder::~MidiRecorder()
+{
+}
+
+//==============================================================================
+void MidiRecorder::prepare (double newSampleRate, int lookbackSamples)
+{
+    sampleRate = newSampleRate;
+    lookbackLength = lookbackSamples;
+}
+
+void MidiRecorder::release()
+{
+    auto take = stopTake();
+
+    // The audio callback is stopped, so we can stand in for it as the producer
+    process ({}, 0, 0, nextSamplePosition, takes.getRequestedTake());
+
+    waitForTakeToFinish (take, 2000);
+}
+
+int MidiRecorder::startTake (std::unique_ptr<MidiFileStreamWriter> firstSegment,
+                             SegmentFactory segmentFactory, int64 segmentLengthSamples)
+{
+    auto takeWriter = std::make_unique<TakeWriter>();
+    takeWriter->writer = std::move (firstSegment);
+    takeWriter->createSegment = std::move (segmentFactory);
+    takeWriter->segmentLength = takeWriter->createSegment != nullptr ? jmax ((int64) 0, segmentLengthSamples) : 0;
+
+    return takes.startTake (std::move (takeWriter));
+}
+
+void MidiRecorder::process (const MidiBuffer& midiMessages, int startSample, int numSamples, int64 samplePosition,
+                            int requestedTake, double hostTempo)
+{
+    // Pick up any take change requested since the last callback
+    // (boundaries carry the clock position, so the writer knows where the take and the lookback
+    // start, and the host's tempo at that point)
+    if (requestedTake != audioThreadTake && pushTempo (requestedTake, samplePosition, hostTempo))
+    {
+        audioThreadTake = requestedTake;
+        audioThreadTempo = hostTempo;
+    }
+
+    nextSamplePosition = samplePosition + numSamples;
+
+    if (numSamples <= 0)
+        return;
+
+    if (audioThreadTake > 0)
+    {
+        // (if the ring is full, the change is posted again with the next block)
+        if (hostTempo > 0.0 && hostTempo != audioThreadTempo && pushTempo (tempoChange, samplePosition, hostTempo))
+            audioThreadTempo = hostTempo;
+
+        for (auto it = midiMessages.findNextSamplePosition (startSample); it != midiMessages.cend(); ++it)
+        {
+            const auto metadata = *it;
+
+            if (metadata.samplePosition >= startSample + numSamples)
+                break;
+
+            if (! pushRecord (0, samplePosition + metadata.samplePosition - startSample, metadata.data, metadata.numBytes))
+                metrics.addDroppedMidiEvent();
+        }
+    }
+
+    if (lookbackLength.load() > 0)
+    {
+        auto count = historyCount.load();
+
+        for (auto it = midiMessages.findNextSamplePosition (startSample); it != midiMessages.cend(); ++it)
+        {
+            const auto metadata = *it;
+
+            if (metadata.samplePosition >= startSample + numSamples)
+                break;
+
+            if (metadata.numBytes > inlineSize)
+                continue;
+
+            auto& r = history[(int) (count % historySize)];
+            r.position = samplePosition + metadata.samplePosition - startSample;
+            r.take = 0;
+            r.numBytes = (uint32) metadata.numBytes;
+            memcpy (r.data, metadata.data, (size_t) metadata.numBytes);
+
+            historyCount = ++count;
+        }
+    }
+}
+
+//==============================================================================
+int MidiRecorder::useTimeSlice()
+{
+    int start1, size1, start2, size2;
+    recordFifo.prepareToRead (recordFifo.getNumReady(), start1, size1, start2, size2);
+
+    for (int i = 0; i < size1; ++i)  handleRecord (records[start1 + i]);
+    for (int i = 0; i < size2; ++i)  handleRecord (records[start2 + i]);
+
+    recordFifo.finishedRead (size1 + size2);
+
+    // Keep the amount of unflushed midi down to about a second
+    auto now = Time::getMillisecondCounter();
+
+    if (currentWriter != nullptr && now - lastFlushTime > 1000)
+    {
+        currentWriter->flush();
+        lastFlushTime = now;
+        reportBytesWritten();
+    }
+
+    return size1 + size2 > 0 ? 0 : 10;
+}
+
+void MidiRecorder::handleRecord (const EventRecord& record)
+{
+    if (record.take == tempoChange)
+    {
+        double bpm;
+        memcpy (&bpm, record.data, sizeof (bpm));
+        changeTempo (record.position - takeStart + takeOffset, bpm);
+        return;
+    }
+
+    if (record.take != 0)
+    {
+        double hostTempo;
+        memcpy (&hostTempo, record.data, sizeof (hostTempo));
+        switchToTake (record.take, record.position, hostTempo);
+
+        // Recent history goes in ahead of the live events, which are shifted to follow it
+        if (currentWriter != nullptr && lookbackLength.load() > 0)
+            writeLookback (record.position);
+
+        return;
+    }
+
+    auto numBytes = (int) record.numBytes;
+    auto* data = numBytes > inlineSize ? readPooledBytes (numBytes) : record.data;
+
+    writeEvent (record.position - takeStart + takeOffset, data, numBytes);
+}
+
+void MidiRecorder::writeEvent (int64 position, const uint8* data, int numBytes)
+{
+    while (segmentLength > 0 && position >= segmentStart + segmentLength)
+        startNextSegment();
+
+    if (currentWriter != nullptr)
+    {
+        currentWriter->addSeekPoint (position - segmentStart);
+        currentWriter->writeEvent (roundToInt (getTick (position)), data, numBytes);
+    }
+}
+
+void MidiRecorder::changeTempo (int64 position, double bpm)
+{
+    while (segmentLength > 0 && position >= segmentStart + segmentLength)
+        startNextSegment();
+
+    // Ticks carry on from where the old tempo left off
+    tempoTick = getTick (position);
+    tempoPosition = position;
+    tempo = bpm;
+    writeTempo (tempoTick);
+}
+
+void MidiRecorder::writeTempo (double tick)
+{
+    if (currentWriter == nullptr)
+        return;
+
+    auto microsecondsPerQuarterNote = (uint32) roundToInt (60.0e6 / tempo);
+
+    const uint8 setTempo[] = { 0xff, 0x51, 0x03,
+                               (uint8) (microsecondsPerQuarterNote >> 16),
+                               (uint8) (microsecondsPerQuarterNote >> 8),
+                               (uint8) microsecondsPerQuarterNote };
+
+    currentWriter->writeEvent (roundToInt (tick), setTempo, (int) sizeof (setTempo));
+}
+
+double MidiRecorder::getTick (int64 position) const noexcept
+{
+    // (worked out from the last tempo change each time, so rounding never accumulates)
+    auto ppq = currentWriter != nullptr ? currentWriter->getTicksPerQuarterNote() : 96;
+    auto ticksPerSample = ppq * tempo / (60.0 * sampleRate.load());
+
+    return tempoTick + (double) (position - tempoPosition) * ticksPerSample;
+}
+
+void MidiRecorder::writeLookback (int64 endPosition)
+{
+    auto startPosition = jmax ((int64) 0, endPosition - lookbackLength.load());
+    auto count = historyCount.load();
+
+    for (auto i = jmax ((int64) 0, count - historySize); i < count; ++i)
+    {
+        auto r = history[(int) (i % historySize)];
+
+        // Skip anything the audio thread overwrote (or was overwriting) while we read it
+        if (i + historySize <= historyCount.load())
+            continue;
+
+        if (r.position >= startPosition && r.position < endPosition)
+            writeEvent (r.position - startPosition, r.data, (int) r.numBytes);
+    }
+
+    takeOffset = endPosition - startPosition;
+}
+
+const uint8* MidiRecorder::readPooledBytes (int numBytes)
+{
+    // Pooled bytes are consumed in the same order the records were pushed, so they're
+    // always at the front of the pool
+    int start1, size1, start2, size2;
+    sysexFifo.prepareToRead (numBytes, start1, size1, start2, size2);
+
+    if (size2 == 0)
+    {
+        sysexFifo.finishedRead (size1);
+        return sysexPool + start1;
+    }
+
+    memcpy (sysexScratch, sysexPool + start1, (size_t) size1);
+    memcpy (sysexScratch + size1, sysexPool + start2, (size_t) size2);
+    sysexFifo.finishedRead (size1 + size2);
+    return sysexScratch;
+}
+
+void MidiRecorder::switchToTake (int take, int64 position, double hostTempo)
+{
+    // Finishing only appends the end-of-track event and patches the header
+    reportBytesWritten();
+    currentWriter.reset();
+
+    auto next = takes.switchToTake (take, writerTake);
+    currentWriter = next != nullptr ? std::move (next->writer) : nullptr;
+    createSegment = next != nullptr ? std::move (next->createSegment) : SegmentFactory();
+    segmentLength = next != nullptr ? next->segmentLength : 0;
+    segmentStart = 0;
+    segmentIndex = 0;
+
+    bytesReported = currentWriter != nullptr ? currentWriter->getNumBytesWritten() : 0;
+    writerTake = jmax (0, take);
+    takeStart = position;
+    takeOffset = 0;
+    lastFlushTime = Time::getMillisecondCounter();
+
+    // Each take starts at tick 0 with its tempo
+    tempo = hostTempo > 0.0 ? hostTempo : defaultTempo.load();
+    tempoTick = 0.0;
+    tempoPosition = 0;
+    writeTempo (0.0);
+}
+
+void MidiRecorder::startNextSegment()
+{
+    // (the old segment is finished before the next is opened, as for the audio)
+    reportBytesWritten();
+    currentWriter.reset();
+
+    segmentStart += segmentLength;
+    currentWriter = createSegment (++segmentIndex);
+    bytesReported = currentWriter != nullptr ? currentWriter->getNumBytesWritten() : 0;
+
+    // Ticks restart from zero in each segment, at the tempo in force
+    tempoTick = 0.0;
+    tempoPosition = segmentStart;
+    writeTempo (0.0);
+}
+
+void MidiRecorder::reportBytesWritten()
+{
+    if (currentWriter == nullptr)
+        return;
+
+    auto total = currentWriter->getNumBytesWritten();
+    metrics.addBytesWritten (total - bytesReported);
+    bytesReported = total;
+}
+
+//==============================================================================
+bool MidiRecorder::pushTempo (int take, int64 position, double bpm) noexcept
+{
+    uint8 data[sizeof (double)];
+    memcpy (data, &bpm, sizeof (bpm));
+    return pushRecord (take, position, data, (int) sizeof (data));
+}
+
+bool MidiRecorder::pushRecord (int take, int64 position, const uint8* data, int numBytes) noexcept
+{
+    // (only this thread adds to the rings, so the free space can't shrink under us)
+    if (recordFifo.getFreeSpace() < 1)
+        return false;
+
+    if (numBytes > inlineSize)
+    {
+        if (sysexFifo.getFreeSpace() < numBytes)
+            return false;
+
+        int start1, size1, start2, size2;
+        sysexFifo.prepareToWrite (numBytes, start1, size1, start2, size2);
+        memcpy (sysexPool + start1, data, (size_t) size1);
+        memcpy (sysexPool + start2, data + size1, (size_t) size2);
+        sysexFifo.finishedWrite (numBytes);
+    }
+
+    int start1, size1, start2, size2;
+    recordFifo.prepareToWrite (1, start1, size1, start2, size2);
+
+    auto& r = records[start1];
+    r.position = position;
+    r.take = take;
+    r.numBytes = (uint32) numBytes;
+
+    if (numBytes <= inlineSize && numBytes > 0)
+        memcpy (r.data, data, (size_t) numBytes);
+
+    recordFifo.finishedWrite (1);
+    return true;
+}
@@ -0,0 +1,170 @@
+/*
+  ==============================================================================
+
+    This file contains the streaming midi capture path used by the recorder.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "MidiFileStreamWriter.h"
+#include "RecorderMetrics.h"
+#include "TakeHandover.h"
+
+//==============================================================================
+/**
+    Streams incoming midi to a MidiFileStreamWriter on a background TimeSliceThread.
+
+    The audio thread copies each event into a fixed-size POD record in a
+    preallocated ring, in O(1) and without allocating: short messages are stored
+    inline in the record, longer ones (sysex) go into a pooled byte ring that is
+    consumed in the same order. Take changes are posted into the record ring as
+    markers, so the writer thread sees them in order with the events.
+
+    Events are stamped with the caller's 64-bit sample clock (the same one the
+    audio takes start on), and only turned into midi ticks on the writer thread,
+    from the file's PPQ and a tempo: a fixed one, or the host's, in which case a
+    tempo change is posted into the ring whenever it moves. The writer
+    thread flushes the file about once a second, so memory stays flat however
+    long the take runs and stopping only has to write the end of the track.
+
+    Like the AudioRecorder, it can keep a lookback history of recent (non-sysex)
+    events, which is written into each new take ahead of the live events. A take
+    can also be split into fixed-length segments, lined up with the audio ones.
+
+    Dropped events and bytes written are reported to a RecorderMetrics owned by
+    the caller.
+*/
+class MidiRecorder  : public TimeSliceClient
+{
+public:
+    //==============================================================================
+    explicit MidiRecorder (RecorderMetrics& metricsToUpdate);
+    ~MidiRecorder() override;
+
+    //==============================================================================
+    /** Sets the rate used to convert sample positions into ticks, and how much
+        history to put in front of each take (0 to disable).
+    */
+    void prepare (double sampleRate, int lookbackSamples);
+
+    /** Ends any open take from the calling thread.
+        Only call this while the audio callback is stopped (e.g. from releaseResources).
+    */
+    void release();
+
+    /** Copies the events from part of a block into the ring. Called on the audio thread;
+        never blocks and never allocates.
+
+        Only events from startSample to startSample + numSamples are taken, so a block
+        can be split where a take starts. samplePosition is the sample clock at startSample,
+        requestedTake the take to feed (see getRequestedTake), and hostTempo the host's
+        tempo in bpm, or 0 to use the one set with setTempo.
+    */
+    void process (const MidiBuffer& midiMessages, int startSample, int numSamples, int64 samplePosition,
+                  int requestedTake, double hostTempo = 0.0);
+
+    /** The take the audio thread should be feeding. */
+    int getRequestedTake() const noexcept                           { return takes.getRequestedTake(); }
+
+    /** The tempo used to turn sample positions into ticks when the host doesn't give
+        one. Applies from the next take.
+    */
+    void setTempo (double bpm) noexcept                             { defaultTempo = jlimit (1.0, 1000.0, bpm); }
+
+    //==============================================================================
+    /** Creates the writer for a segment of a split take (0 is the first). */
+    using SegmentFactory = std::function<std::unique_ptr<MidiFileStreamWriter> (int segmentIndex)>;
+
+    int startTake (std::unique_ptr<MidiFileStreamWriter> writer)    { return startTake (std::move (writer), {}, 0); }
+
+    /** Starts a take that rolls over to a new file every segmentLengthSamples (0 for one
+        file). The split happens on the writer thread, at the same sample positions as a
+        SegmentedRecordingWriter with the same length, and event times restart from zero in
+        each segment. A segment's file is created when its first event (or a later one)
+        arrives.
+    */
+    int startTake (std::unique_ptr<MidiFileStreamWriter> firstSegment, SegmentFactory createSegment, int64 segmentLengthSamples);
+
+    int stopTake()                                                  { return takes.stopTake(); }
+    bool isTakeFinished (int takeNumber) const noexcept             { return takes.isTakeFinished (takeNumber); }
+    bool waitForTakeToFinish (int takeNumber, int timeoutMs)        { return takes.waitForTakeToFinish (takeNumber, timeoutMs); }
+
+    //==============================================================================
+    int useTimeSlice() override;
+
+private:
+    //==============================================================================
+    static constexpr int inlineSize = 16;
+
+    struct EventRecord
+    {
+        int64 position;         // on the sample clock
+        int32 take;             // non-zero for take boundaries (and tempoChange)
+        uint32 numBytes;        // anything longer than inlineSize lives in the sysex pool
+        uint8 data[inlineSize]; // (the host tempo, for boundaries and tempo changes)
+    };
+
+    static constexpr int32 tempoChange = std::numeric_limits<int32>::min();
+
+    struct TakeWriter
+    {
+        std::unique_ptr<MidiFileStreamWriter> writer;
+        SegmentFactory createSegment;
+        int64 segmentLength;
+    };
+
+    bool pushRecord (int take, int64 position, const uint8* data, int numBytes) noexcept;
+    bool pushTempo (int take, int64 position, double bpm) noexcept;
+    void handleRecord (const EventRecord& record);
+    void writeEvent (int64 position, const uint8* data, int numBytes);
+    void changeTempo (int64 position, double bpm);
+    void writeTempo (double tick);
+    double getTick (int64 position) const noexcept;
+    void writeLookback (int64 endPosition);
+    const uint8* readPooledBytes (int numBytes);
+    void switchToTake (int take, int64 position, double hostTempo);
+    void startNextSegment();
+    void reportBytesWritten();
+
+    //==============================================================================
+    static constexpr int ringSize = 8192;
+    HeapBlock<EventRecord> records;
+    AbstractFifo recordFifo { ringSize };
+
+    static constexpr int sysexPoolSize = 65536;
+    HeapBlock<uint8> sysexPool, sysexScratch;
+    AbstractFifo sysexFifo { sysexPoolSize };
+
+    std::atomic<double> sampleRate { 44100.0 }, defaultTempo { 120.0 };
+
+    static constexpr int historySize = 16384;
+    HeapBlock<EventRecord> history;
+    std::atomic<int64> historyCount { 0 };  // total events ever written to the history
+    std::atomic<int> lookbackLength { 0 };
+
+    TakeHandover<TakeWriter> takes;
+    RecorderMetrics& metrics;
+
+    // Audio thread only
+    int audioThreadTake = 0;
+    double audioThreadTempo = 0.0;
+    int64 nextSamplePosition = 0;
+
+    // Writer thread only
+    int writerTake = 0;
+    std::unique_ptr<MidiFileStreamWriter> currentWriter;
+    int64 takeStart = 0, takeOffset = 0;
+    double tempo = 120.0, tempoTick = 0.0;
+    int64 tempoPosition = 0;
+    SegmentFactory createSegment;
+    int64 segmentLength = 0, segmentStart = 0;
+    int segmentIndex = 0;
+    uint32 lastFlushTime = 0;
+    int64 bytesReported = 0;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiRecorder)
+};
@@ -0,0 +1,132 @@
+/*
+  ==============================================================================
+
+    This file contains the writer that spreads compressed encoding over a pool
+    of worker threads.
+
+  ==============================================================================
+*/
+
+#include "ParallelEncodingWriter.h"
+
+//==============================================================================
+ParallelEncodingWriter::Group::Group (std::unique_ptr<RecordingWriter> w, int first, int num)
+    : ThreadPoolJob ("encoder"),
+      writer (std::move (w)),
+      firstChannel (first),
+      buffer (num, chunkSize)
+{
+}
+
+ThreadPoolJob::JobStatus ParallelEncodingWriter::Group::runJob()
+{
+    if (! writer->write (buffer.getArrayOfReadPointers(), numSamples))
+        failed = true;
+
+    bytesWritten = writer->getNumBytesWritten();
+    return jobHasFinished;
+}
+
+//==============================================================================
+ParallelEncodingWriter::ParallelEncodingWriter (ThreadPool& threadPool, const GroupFactory& createGroup,
+                                                int channels, int channelsPerGroup)
+    : pool (threadPool), numChannels (channels)
+{
+    channelsPerGroup = jmax (1, channelsPerGroup);
+
+    for (int first = 0; first < numChannels; first += channelsPerGroup)
+    {
+        auto num = jmin (channelsPerGroup, numChannels - first);
+
+        if (auto writer = createGroup (first, num))
+            groups.add (new Group (std::move (writer), first, num));
+        else
+            ok = false;
+    }
+}
+
+ParallelEncodingWriter::~ParallelEncodingWriter()
+{
+    waitForGroups();
+}
+
+//==============================================================================
+bool ParallelEncodingWriter::write (const float* const* channels, int numSamples)
+{
+    if (! ok)
+        return false;
+
+    for (int done = 0; done < numSamples;)
+    {
+        auto num = jmin (chunkSize, numSamples - done);
+
+        // The previous chunk has to be out of the buffers before they're refilled
+        waitForGroups();
+
+        for (auto* group : groups)
+        {
+            for (int ch = 0; ch < group->buffer.getNumChannels(); ++ch)
+                group->buffer.copyFrom (ch, 0, channels[group->firstChannel + ch] + done, num);
+
+            group->numSamples = num;
+            pool.addJob (group, false);
+        }
+
+        done += num;
+    }
+
+    for (auto* group : groups)
+        if (group->failed.load())
+            return false;
+
+    return true;
+}
+
+bool ParallelEncodingWriter::commit()
+{
+    waitForGroups();
+
+    bool committed = true;
+
+    for (auto* group : groups)
+        committed = group->writer->commit() && committed;
+
+    return committed;
+}
+
+int64 ParallelEncodingWriter::getNumBytesWritten() const
+{
+    int64 total = 0;
+
+    for (auto* group : groups)
+        total += group->bytesWritten.load();
+
+    return total;
+}
+
+void ParallelEncodingWriter::waitForGroups()
+{
+    for (auto* group : groups)
+        pool.waitForJobToFinish (group, -1);
+}
+
+//==============================================================================
+ThreadPool& ParallelEncodingWriter::SharedPool::get()
+{
+    const ScopedLock sl (lock);
+
+    // (one core is left for the writer threads and the audio callback)
+    if (pool == nullptr)
+        pool = std::make_unique<ThreadPool> (jlimit (1, 8, SystemStats::getNumCpus() - 1));
+
+    return *pool;
+}
+
+//==============================================================================
+File ParallelEncodingWriter::getGroupFile (const File& takeFile, int firstChannel, int numChannels)
+{
+    return takeFile.getSiblingFile (takeFile.getFileNameWithoutExtension()
+                                      + "-ch" + String (firstChannel + 1).paddedLeft ('0', 2)
+                                      + "-" + String (firstChannel + numChannels).paddedLeft ('0', 2)
+                                      + takeFile.getFileExtension());
+}
@@ -0,0 +1,99 @@
+/*
+  ==============================================================================
+
+    This file contains the writer that spreads compressed encoding over a pool
+    of worker threads.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "RecordingWriter.h"
+
+//==============================================================================
+/**
+    Splits a take's channels into groups and encodes each group with its own
+    writer on a ThreadPool, so an expensive codec (Ogg Vorbis, FLAC) can use
+    more than one core.
+
+    Each write() copies the block into the groups' buffers and queues one job per
+    group. It only waits for the previous block's jobs, so encoding overlaps with
+    the writer thread draining the ring. Every group writes its own file, and a
+    group only ever has one job in flight, so each file is written strictly in
+    order.
+*/
+class ParallelEncodingWriter  : public RecordingWriter
+{
+public:
+    //==============================================================================
+    /** Creates the writer for the channels [firstChannel, firstChannel + numChannels). */
+    using GroupFactory = std::function<std::unique_ptr<RecordingWriter> (int firstChannel, int numChannels)>;
+
+    ParallelEncodingWriter (ThreadPool& pool, const GroupFactory& createGroup, int numChannels, int channelsPerGroup);
+
+    /** Waits for the encoders to finish, then closes every group's file. */
+    ~ParallelEncodingWriter() override;
+
+    /** True if every group's writer could be created. */
+    bool openedOk() const noexcept                  { return ok; }
+
+    //==============================================================================
+    bool write (const float* const* channels, int numSamples) override;
+    bool commit() override;
+
+    int getNumChannels() const override             { return numChannels; }
+    int64 getNumBytesWritten() const override;
+
+    int getNumGroups() const noexcept               { return groups.size(); }
+
+    /** The file a group's channels go into, when a take is split: "recording-ch01-02.ogg". */
+    static File getGroupFile (const File& takeFile, int firstChannel, int numChannels);
+
+    static constexpr int chunkSize = 16384;
+
+    //==============================================================================
+    /** The pool the encoders run on, shared by every instance in the process (hold one
+        with a SharedResourcePointer). Its threads are only started for the first
+        compressed take.
+    */
+    class SharedPool
+    {
+    public:
+        SharedPool() = default;
+
+        ThreadPool& get();
+
+    private:
+        CriticalSection lock;
+        std::unique_ptr<ThreadPool> pool;
+
+        JUCE_DECLARE_NON_COPYABLE (SharedPool)
+    };
+
+private:
+    //==============================================================================
+    struct Group  : public ThreadPoolJob
+    {
+        Group (std::unique_ptr<RecordingWriter> w, int first, int num);
+        JobStatus runJob() override;
+
+        std::unique_ptr<RecordingWriter> writer;
+        int firstChannel;
+        AudioBuffer<float> buffer;
+        int numSamples = 0;
+        std::atomic<int64> bytesWritten { 0 };
+        std::atomic<bool> failed { false };
+    };
+
+    void waitForGroups();
+
+    ThreadPool& pool;
+    OwnedArray<Group> groups;
+    int numChannels;
+    bool ok = true;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ParallelEncodingWriter)
+};
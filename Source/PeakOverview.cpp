@@ -0,0 +1,328 @@
+/*
+  ==============================================================================
+
+    This file contains the min/max/RMS overviews that are built while a take
+    is written and saved next to it.
+
+  ==============================================================================
+*/
+
+#include "PeakOverview.h"
+
+#if JUCE_USE_SSE_INTRINSICS
+ #include <emmintrin.h>
+#elif JUCE_USE_ARM_NEON
+ #include <arm_neon.h>
+#endif
+
+// Sidecar layout (little-endian): "PKOV", version, numChannels, sampleRate (double),
+// numSamples (int64), numLevels, then for each level: samplesPerBin, numBins (int64)
+// and numBins * numChannels bins of three int16s.
+static const char overviewMagic[] = { 'P', 'K', 'O', 'V' };
+static constexpr int overviewVersion = 1;
+
+static int16 toInt16 (float value) noexcept
+{
+    return (int16) roundToInt (jlimit (-1.0f, 1.0f, value) * 32767.0f);
+}
+
+//==============================================================================
+void PeakOverview::Level::add (Bin bin)
+{
+    if (size == (int64) chunks.size() * binsPerChunk)
+        chunks.add (new HeapBlock<Bin> ((size_t) binsPerChunk));
+
+    (*chunks.getLast())[size % binsPerChunk] = bin;
+    ++size;
+}
+
+//==============================================================================
+int PeakOverview::findLevel (double samplesPerPixel) const
+{
+    int level = 0;
+
+    while (level + 1 < levels.size() && levels[level + 1]->samplesPerBin <= samplesPerPixel)
+        ++level;
+
+    return level;
+}
+
+File PeakOverview::getFileFor (const File& audioFile)
+{
+    return File (audioFile.getFullPathName() + ".peaks");
+}
+
+//==============================================================================
+bool PeakOverview::writeTo (OutputStream& stream) const
+{
+    bool ok = stream.write (overviewMagic, sizeof (overviewMagic))
+               && stream.writeInt (overviewVersion)
+               && stream.writeInt (numChannels)
+               && stream.writeDouble (sampleRate)
+               && stream.writeInt64 (numSamples)
+               && stream.writeInt (levels.size());
+
+    for (int i = 0; i < levels.size(); ++i)
+    {
+        auto* level = levels.getUnchecked (i);
+        ok = ok && stream.writeInt (level->samplesPerBin)
+                && stream.writeInt64 (getNumBins (i));
+
+        // (the bins are already in file order, so each chunk goes out in one write)
+        for (int64 start = 0; ok && start < level->size; start += binsPerChunk)
+        {
+            auto num = (int) jmin ((int64) binsPerChunk, level->size - start);
+            auto* bins = level->chunks.getUnchecked ((int) (start / binsPerChunk))->getData();
+
+           #if JUCE_LITTLE_ENDIAN
+            ok = stream.write (bins, (size_t) num * sizeof (Bin));
+           #else
+            for (int i = 0; i < num; ++i)
+                ok = ok && stream.writeShort (bins[i].minimum) && stream.writeShort (bins[i].maximum) && stream.writeShort (bins[i].rms);
+           #endif
+        }
+    }
+
+    return ok;
+}
+
+std::unique_ptr<PeakOverview> PeakOverview::readFrom (InputStream& stream)
+{
+    char magic[sizeof (overviewMagic)];
+
+    if (stream.read (magic, (int) sizeof (magic)) != (int) sizeof (magic)
+         || memcmp (magic, overviewMagic, sizeof (magic)) != 0
+         || stream.readInt() != overviewVersion)
+        return nullptr;
+
+    auto overview = std::make_unique<PeakOverview>();
+    overview->numChannels = stream.readInt();
+    overview->sampleRate = stream.readDouble();
+    overview->numSamples = stream.readInt64();
+    auto numLevels = stream.readInt();
+
+    if (overview->numChannels <= 0 || numLevels <= 0 || numLevels > 32)
+        return nullptr;
+
+    for (int i = 0; i < numLevels; ++i)
+    {
+        auto* level = overview->levels.add (new Level());
+        level->samplesPerBin = stream.readInt();
+        auto numBins = stream.readInt64() * overview->numChannels;
+
+        // (a truncated or corrupt file mustn't make us allocate more than it could hold)
+        if (level->samplesPerBin <= 0 || numBins < 0
+             || (stream.getTotalLength() >= 0 && numBins * (int64) sizeof (Bin) > stream.getNumBytesRemaining()))
+            return nullptr;
+
+        for (int64 j = 0; j < numBins; ++j)
+        {
+            Bin bin;
+            bin.minimum = stream.readShort();
+            bin.maximum = stream.readShort();
+            bin.rms = stream.readShort();
+            level->add (bin);
+        }
+    }
+
+    if (! stream.isExhausted())
+        return nullptr;
+
+    return overview;
+}
+
+std::unique_ptr<PeakOverview> PeakOverview::readFrom (const File& file)
+{
+    FileInputStream stream (file);
+
+    if (! stream.openedOk())
+        return nullptr;
+
+    BufferedInputStream buffered (stream, 65536);
+    return readFrom (buffered);
+}
+
+//==============================================================================
+void PeakOverview::measure (const float* samples, int numSamples, float& minimum, float& maximum, double& sumOfSquares) noexcept
+{
+    int i = 0;
+    auto lo = minimum, hi = maximum;
+    float squares = 0.0f;
+
+   #if JUCE_USE_SSE_INTRINSICS
+    if (numSamples >= 4)
+    {
+        auto vmin = _mm_set1_ps (lo);
+        auto vmax = _mm_set1_ps (hi);
+        auto vsum = _mm_setzero_ps();
+
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            auto x = _mm_loadu_ps (samples + i);
+            vmin = _mm_min_ps (vmin, x);
+            vmax = _mm_max_ps (vmax, x);
+            vsum = _mm_add_ps (vsum, _mm_mul_ps (x, x));
+        }
+
+        float mins[4], maxs[4], sums[4];
+        _mm_storeu_ps (mins, vmin);
+        _mm_storeu_ps (maxs, vmax);
+        _mm_storeu_ps (sums, vsum);
+
+        lo = jmin (mins[0], mins[1], jmin (mins[2], mins[3]));
+        hi = jmax (maxs[0], maxs[1], jmax (maxs[2], maxs[3]));
+        squares = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+    }
+   #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+    if (numSamples >= 4)
+    {
+        auto vmin = vdupq_n_f32 (lo);
+        auto vmax = vdupq_n_f32 (hi);
+        auto vsum = vdupq_n_f32 (0.0f);
+
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            auto x = vld1q_f32 (samples + i);
+            vmin = vminq_f32 (vmin, x);
+            vmax = vmaxq_f32 (vmax, x);
+            vsum = vmlaq_f32 (vsum, x, x);
+        }
+
+        lo = vminvq_f32 (vmin);
+        hi = vmaxvq_f32 (vmax);
+        squares = vaddvq_f32 (vsum);
+    }
+   #endif
+
+    for (; i < numSamples; ++i)
+    {
+        auto x = samples[i];
+        lo = jmin (lo, x);
+        hi = jmax (hi, x);
+        squares += x * x;
+    }
+
+    minimum = lo;
+    maximum = hi;
+    sumOfSquares += squares;
+}
+
+//==============================================================================
+PeakOverview::Builder::Builder (int numChannels, double sampleRate, int samplesPerBin, int numLevels, int levelRatio)
+{
+    overview.numChannels = jmax (1, numChannels);
+    overview.sampleRate = sampleRate;
+
+    for (int i = 0; i < jmax (1, numLevels); ++i)
+    {
+        auto* level = overview.levels.add (new Level());
+        level->samplesPerBin = jmax (1, samplesPerBin);
+        samplesPerBin *= jmax (2, levelRatio);
+
+        auto* acc = accumulators.add (new HeapBlock<Accumulator> ((size_t) overview.numChannels));
+
+        for (int ch = 0; ch < overview.numChannels; ++ch)
+            (*acc)[ch] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0.0 };
+
+        samplesInBin.add (0);
+    }
+}
+
+void PeakOverview::Builder::addSamples (const float* const* channels, int numSamples)
+{
+    auto& acc = *accumulators.getUnchecked (0);
+    auto samplesPerBin = (int64) overview.levels.getUnchecked (0)->samplesPerBin;
+
+    // Only the finest level looks at the samples - the others are built from its bins
+    for (int done = 0; done < numSamples;)
+    {
+        auto num = (int) jmin ((int64) (numSamples - done), samplesPerBin - samplesInBin.getReference (0));
+
+        for (int ch = 0; ch < overview.numChannels; ++ch)
+            measure (channels[ch] + done, num, acc[ch].minimum, acc[ch].maximum, acc[ch].sumOfSquares);
+
+        done += num;
+        samplesInBin.getReference (0) += num;
+
+        if (samplesInBin.getReference (0) == samplesPerBin)
+            finishBin (0);
+    }
+
+    overview.numSamples += numSamples;
+}
+
+const PeakOverview& PeakOverview::Builder::finish()
+{
+    // (working upwards, so each partial bin is folded into the level above before it's closed)
+    for (int i = 0; i < overview.levels.size(); ++i)
+        if (samplesInBin[i] > 0)
+            finishBin (i);
+
+    return overview;
+}
+
+void PeakOverview::Builder::finishBin (int level)
+{
+    auto& acc = *accumulators.getUnchecked (level);
+    auto count = samplesInBin[level];
+    auto& bins = *overview.levels.getUnchecked (level);
+    auto hasNext = level + 1 < overview.levels.size();
+
+    for (int ch = 0; ch < overview.numChannels; ++ch)
+    {
+        auto& a = acc[ch];
+        bins.add ({ toInt16 (a.minimum), toInt16 (a.maximum),
+                    toInt16 ((float) std::sqrt (a.sumOfSquares / (double) count)) });
+
+        if (hasNext)
+        {
+            auto& next = (*accumulators.getUnchecked (level + 1))[ch];
+            next.minimum = jmin (next.minimum, a.minimum);
+            next.maximum = jmax (next.maximum, a.maximum);
+            next.sumOfSquares += a.sumOfSquares;
+        }
+
+        a = { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0.0 };
+    }
+
+    samplesInBin.set (level, 0);
+
+    if (hasNext)
+    {
+        samplesInBin.getReference (level + 1) += count;
+
+        if (samplesInBin[level + 1] == overview.levels.getUnchecked (level + 1)->samplesPerBin)
+            finishBin (level + 1);
+    }
+}
+
+//==============================================================================
+PeakOverviewWriter::PeakOverviewWriter (std::unique_ptr<RecordingWriter> writerToUse, const File& overviewFile, double sampleRate)
+    : writer (std::move (writerToUse)),
+      file (overviewFile),
+      builder (writer->getNumChannels(), sampleRate)
+{
+}
+
+PeakOverviewWriter::~PeakOverviewWriter()
+{
+    // The audio file is finished first, so the overview never describes more than it holds
+    writer.reset();
+
+    auto& overview = builder.finish();
+
+    file.deleteFile();
+    FileOutputStream stream (file, 65536);
+
+    if (! stream.openedOk())
+        return;
+
+    if (! overview.writeTo (stream) || (stream.flush(), stream.getStatus().failed()))
+        file.deleteFile();
+}
+
+bool PeakOverviewWriter::write (const float* const* channels, int numSamples)
+{
+    builder.addSamples (channels, numSamples);
+    return writer->write (channels, numSamples);
+}
@@ -0,0 +1,162 @@
+/*
+  ==============================================================================
+
+    This file contains the min/max/RMS overviews that are built while a take
+    is written and saved next to it.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "RecordingWriter.h"
+
+//==============================================================================
+/**
+    A multi-resolution waveform overview of a take: for each of several levels
+    of decimation, the minimum, maximum and RMS of every channel over each bin
+    of samples.
+
+    Level 0 has the smallest bins, and each level's bins are a fixed multiple
+    of the previous level's. To draw a waveform, pick the level whose bins are
+    closest to (but no bigger than) a pixel's worth of samples with
+    findLevel().
+
+    The overview is saved as a small sidecar file next to the audio (see
+    getFileFor()). All values are quantised to 16 bits, so it takes 6 bytes per
+    channel per bin - a few megabytes per channel-hour at the finest level. The
+    bins are kept in fixed-size chunks, so a long, wide take's overview grows
+    without being copied and is indexed with 64-bit positions.
+*/
+class PeakOverview
+{
+public:
+    //==============================================================================
+    struct Bin
+    {
+        int16 minimum, maximum, rms;    // (full scale is 32767)
+    };
+
+    PeakOverview() = default;
+
+    //==============================================================================
+    int getNumChannels() const noexcept                     { return numChannels; }
+    double getSampleRate() const noexcept                   { return sampleRate; }
+    int64 getNumSamples() const noexcept                    { return numSamples; }
+
+    int getNumLevels() const noexcept                       { return levels.size(); }
+    int getSamplesPerBin (int level) const                  { return levels[level]->samplesPerBin; }
+    int64 getNumBins (int level) const                      { return levels[level]->size / jmax (1, numChannels); }
+
+    Bin getBin (int level, int channel, int64 index) const  { return levels[level]->get (index * numChannels + channel); }
+
+    /** The coarsest level whose bins are no bigger than the given number of samples. */
+    int findLevel (double samplesPerPixel) const;
+
+    //==============================================================================
+    /** The sidecar file for an audio file ("recording.wav.peaks"). */
+    static File getFileFor (const File& audioFile);
+
+    bool writeTo (OutputStream& stream) const;
+    static std::unique_ptr<PeakOverview> readFrom (InputStream& stream);
+    static std::unique_ptr<PeakOverview> readFrom (const File& file);
+
+    //==============================================================================
+    /** Finds the minimum, maximum and sum of squares of a block of samples in one
+        vectorised pass. The results are combined with what's already there.
+    */
+    static void measure (const float* samples, int numSamples, float& minimum, float& maximum, double& sumOfSquares) noexcept;
+
+    //==============================================================================
+    class Builder;
+
+private:
+    //==============================================================================
+    static constexpr int binsPerChunk = 16384;
+
+    struct Level
+    {
+        int samplesPerBin;
+        OwnedArray<HeapBlock<Bin>> chunks;  // (binsPerChunk each, channels interleaved)
+        int64 size = 0;                     // bins in all the chunks
+
+        void add (Bin bin);
+        Bin get (int64 index) const noexcept    { return (*chunks.getUnchecked ((int) (index / binsPerChunk)))[index % binsPerChunk]; }
+    };
+
+    int numChannels = 0;
+    double sampleRate = 0.0;
+    int64 numSamples = 0;
+    OwnedArray<Level> levels;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PeakOverview)
+};
+
+//==============================================================================
+/**
+    Builds an overview a block at a time, as the samples are written.
+
+    Each finished bin is folded into the level above it, so every level is
+    kept up to date in one pass with no re-reading, and each level's RMS
+    is exact rather than an average of averages.
+*/
+class PeakOverview::Builder
+{
+public:
+    Builder (int numChannels, double sampleRate, int samplesPerBin = 256, int numLevels = 5, int levelRatio = 4);
+
+    void addSamples (const float* const* channels, int numSamples);
+
+    /** Closes off any partly filled bins, and returns the finished overview. */
+    const PeakOverview& finish();
+
+private:
+    struct Accumulator
+    {
+        float minimum, maximum;
+        double sumOfSquares;
+    };
+
+    void finishBin (int level);
+
+    PeakOverview overview;
+    OwnedArray<HeapBlock<Accumulator>> accumulators;
+    Array<int64> samplesInBin;
+
+    JUCE_DECLARE_NON_COPYABLE (Builder)
+};
+
+//==============================================================================
+/**
+    Passes a take through to another writer, building its overview on the way,
+    and saves the overview once the take is finished.
+
+    Everything happens on the writer thread, so the overview is ready as soon as
+    the take has been finalised.
+*/
+class PeakOverviewWriter  : public RecordingWriter
+{
+public:
+    PeakOverviewWriter (std::unique_ptr<RecordingWriter> writerToUse, const File& overviewFile, double sampleRate);
+
+    /** Finalises the wrapped writer, then saves the overview. */
+    ~PeakOverviewWriter() override;
+
+    //==============================================================================
+    bool write (const float* const* channels, int numSamples) override;
+    bool commit() override                                  { return writer->commit(); }
+
+    int getNumChannels() const override                     { return writer->getNumChannels(); }
+    int64 getNumBytesWritten() const override               { return writer->getNumBytesWritten(); }
+    void setStartPosition (TimelinePosition position) override   { writer->setStartPosition (position); }
+
+private:
+    std::unique_ptr<RecordingWriter> writer;
+    File file;
+    PeakOverview::Builder builder;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PeakOverviewWriter)
+};
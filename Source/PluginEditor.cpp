@@ -15,7 +15,8 @@ AudioMidiRecorderPluginProcessorEditor::AudioMidiRecorderPluginProcessorEditor (
 {
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (200, 200);
+    levels = std::make_unique<LevelMonitor::Snapshot>();
+    setSize (300, 408);
     
     // GUI Elements
     /*
@@ -34,6 +35,49 @@ AudioMidiRecorderPluginProcessorEditor::AudioMidiRecorderPluginProcessorEditor (
     recordButton.addListener(this);
     recordButton.setButtonText("Record");
     recordButton.setColour(TextButton::buttonColourId,Colours::green);
+    
+    // Setup Recording Format (used for .wav takes)
+    addAndMakeVisible(formatBox);
+    formatBox.addItem("16-bit", 1);
+    formatBox.addItem("24-bit", 2);
+    formatBox.addItem("32-bit int", 3);
+    formatBox.addItem("32-bit float", 4);
+    formatBox.setSelectedId((int) audioProcessor.getRecordingFormat() + 1, dontSendNotification);
+    formatBox.onChange = [this] { audioProcessor.setRecordingFormat ((WavRecordingWriter::SampleFormat) (formatBox.getSelectedId() - 1)); };
+    
+    // Auto-record: Record arms the take, and the first note or sound starts it
+    addAndMakeVisible(autoRecordButton);
+    autoRecordButton.setToggleState(audioProcessor.getAutoRecord().enabled, dontSendNotification);
+    autoRecordButton.onClick = [this] {
+        auto options = audioProcessor.getAutoRecord();
+        options.enabled = autoRecordButton.getToggleState();
+        audioProcessor.setAutoRecord (options);
+    };
+    
+    // Playback of the last take (streamed from disk), and overdubbing: Record then plays the last
+    // take while recording the next one alongside it
+    addAndMakeVisible(playButton);
+    playButton.onClick = [this] {
+        if (audioProcessor.isPlaying())
+            audioProcessor.stopPlayback();
+        else
+            audioProcessor.playLastTake();
+        
+        updatePlayButton();
+    };
+    updatePlayButton();
+    
+    addAndMakeVisible(overdubButton);
+    
+    // Memory takes: the latest one is kept until it's saved to disk or thrown away
+    addAndMakeVisible(saveTakeButton);
+    saveTakeButton.onClick = [this] { finishMemoryTake (true); };
+    addAndMakeVisible(discardTakeButton);
+    discardTakeButton.onClick = [this] { finishMemoryTake (false); };
+    updateMemoryTakeButtons();
+    
+    // Refresh the levels at 30Hz (and the telemetry every 8th time)
+    startTimerHz (30);
 }
 
 AudioMidiRecorderPluginProcessorEditor::~AudioMidiRecorderPluginProcessorEditor()
@@ -45,9 +89,54 @@ void AudioMidiRecorderPluginProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-    g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Midi Volume", 0, 0, getWidth(), 30, juce::Justification::centred, 1);
+    
+    // Live levels (the waveform is already drawn, so this is just a blit)
+    g.drawImageAt (waveformImage, waveformArea.getX(), waveformArea.getY());
+    
+    for (int ch = 0; ch < levels->numChannels; ++ch) {
+        auto bounds = getMeterBounds (ch);
+        
+        if (! g.clipRegionIntersects (bounds))
+            continue;
+        
+        g.setColour (juce::Colours::black);
+        g.fillRect (bounds);
+        g.setColour (juce::Colours::darkgreen);
+        g.fillRect (bounds.withTop (bounds.getBottom() - meterRmsHeights[ch]));
+        g.setColour (levels->peak[ch] >= 1.0f ? juce::Colours::red : juce::Colours::limegreen);
+        g.fillRect (bounds.getX(), bounds.getBottom() - meterPeakHeights[ch], bounds.getWidth(), 2);
+    }
+    
+    // Telemetry
+    StringArray lines;
+    lines.add ("Callback p50/p99/max: " + String (metrics.callbackP50, 0) + " / " + String (metrics.callbackP99, 0)
+                 + " / " + String (metrics.callbackMax, 0) + " us");
+    lines.add ("FIFO: " + String (metrics.fifoCapacityMs, 0) + " ms, high water " + String (metrics.fifoHighWater * 100.0, 1)
+                 + "%   Writer lag: " + String (metrics.writerLagMs, 1) + " ms (max " + String (metrics.maxWriterLagMs, 1) + ")");
+    lines.add ("Dropped: " + String (metrics.droppedSamples) + " samples, " + String (metrics.droppedMidiEvents) + " midi events");
+    lines.add ("Written: " + String (metrics.bytesWritten / (1024.0 * 1024.0), 2) + " MB"
+                 + (finalizing ? "   Finalizing previous take..." : ""));
+    
+    // Memory takes: how much of the store's limit is used, and how well the latest take compresses
+    if (audioProcessor.isRecordingToMemory()) {
+        auto& store = audioProcessor.getMemoryTakes();
+        String line ("Memory: " + String (store.getMemoryUsed() / (1024.0 * 1024.0), 1) + " of "
+                       + String (audioProcessor.getMemoryLimitMegabytes()) + " MB");
+        
+        if (auto take = store.getLastTake()) {
+            auto stats = take->getStats();
+            line << ", last take " << String (stats.compressionRatio, 2) << ":1" << (stats.truncated ? " (cut short)" : "");
+        }
+        
+        if (store.getNumTakesEvicted() > 0)
+            line << ", " << store.getNumTakesEvicted() << " older evicted";
+        
+        lines.add (line);
+    }
+    
+    g.setColour (metrics.droppedSamples > 0 || metrics.droppedMidiEvents > 0 ? juce::Colours::orange : juce::Colours::lightgrey);
+    g.setFont (12.0f);
+    g.drawFittedText (lines.joinIntoString ("\n"), metricsArea.reduced (4), juce::Justification::topLeft, lines.size());
 }
 
 void AudioMidiRecorderPluginProcessorEditor::resized()
@@ -57,44 +146,200 @@ void AudioMidiRecorderPluginProcessorEditor::resized()
     
     // GUI Components
     //midiVolume.setBounds(40, 30, 20, getHeight() - 60);
-    recordButton.setBounds(0,0,getWidth(),getHeight());
+    auto area = getLocalBounds();
+    auto topRow = area.removeFromTop(24);
+    autoRecordButton.setBounds(topRow.removeFromRight(110));
+    formatBox.setBounds(topRow);
+    auto playRow = area.removeFromTop(24);
+    overdubButton.setBounds(playRow.removeFromRight(110));
+    playButton.setBounds(playRow);
+    auto memoryRow = area.removeFromTop(24);
+    discardTakeButton.setBounds(memoryRow.removeFromRight(memoryRow.getWidth() / 2));
+    saveTakeButton.setBounds(memoryRow);
+    metricsArea = area.removeFromBottom(72);
+    
+    auto levelsArea = area.removeFromBottom(80).reduced(4, 2);
+    auto numMeters = jlimit (1, LevelMonitor::maxChannels, audioProcessor.getTotalNumInputChannels());
+    metersArea = levelsArea.removeFromRight(numMeters * 6);
+    waveformArea = levelsArea.withTrimmedRight(4);
+    recordButton.setBounds(area);
+    
+    // (the image is redrawn from the whole history at its new size)
+    waveformImage = Image (Image::RGB, jmax (1, waveformArea.getWidth()), jmax (1, waveformArea.getHeight()), true);
+    drawWaveformColumns (LevelMonitor::historySize);
+}
+
+juce::Rectangle<int> AudioMidiRecorderPluginProcessorEditor::getMeterBounds (int channel) const
+{
+    return { metersArea.getX() + channel * 6, metersArea.getY(), 5, metersArea.getHeight() };
+}
+
+void AudioMidiRecorderPluginProcessorEditor::updateLevels()
+{
+    // (never blocks the audio thread, and only copies the columns we haven't got yet)
+    auto numNewColumns = audioProcessor.getLevelMonitor().copySnapshot (*levels);
+    
+    if (numNewColumns > 0) {
+        drawWaveformColumns (numNewColumns);
+        repaint (waveformArea);
+    }
+    
+    // Meters on a -60 to 0 dB scale, repainted only where a bar has moved
+    auto toHeight = [this] (float gain) {
+        auto proportion = (Decibels::gainToDecibels (gain, -60.0f) + 60.0f) / 60.0f;
+        return roundToInt (proportion * (float) metersArea.getHeight());
+    };
+    
+    for (int ch = 0; ch < levels->numChannels; ++ch) {
+        auto peakHeight = toHeight (levels->peak[ch]);
+        auto rmsHeight = toHeight (levels->rms[ch]);
+        
+        if (peakHeight != meterPeakHeights[ch] || rmsHeight != meterRmsHeights[ch]) {
+            meterPeakHeights[ch] = peakHeight;
+            meterRmsHeights[ch] = rmsHeight;
+            repaint (getMeterBounds (ch));
+        }
+    }
+}
+
+void AudioMidiRecorderPluginProcessorEditor::drawWaveformColumns (int64 numNewColumns)
+{
+    // One pixel per column, newest on the right: scroll the image left and draw the new ones
+    auto width = waveformImage.getWidth();
+    auto height = waveformImage.getHeight();
+    auto numColumns = levels->numColumns;
+    auto numToDraw = (int) jmin (numNewColumns, numColumns, (int64) jmin (width, LevelMonitor::historySize));
+    
+    if (numNewColumns < width)
+        waveformImage.moveImageSection (0, 0, (int) numNewColumns, 0, width - (int) numNewColumns, height);
+    
+    waveformImage.clear ({ jmax (0, width - (int) numNewColumns), 0, width, height }, juce::Colours::black);
+    
+    auto numLanes = levels->numChannels;
+    
+    if (numLanes == 0 || numToDraw <= 0)
+        return;
+    
+    Graphics g (waveformImage);
+    auto laneHeight = (float) height / (float) numLanes;
+    
+    for (auto i = numColumns - numToDraw; i < numColumns; ++i) {
+        auto x = width - (int) (numColumns - i);
+        
+        for (int ch = 0; ch < numLanes; ++ch) {
+            auto& column = levels->getColumn (i, ch);
+            auto centre = laneHeight * ((float) ch + 0.5f);
+            auto top = centre - jlimit (-1.0f, 1.0f, column.maximum) * laneHeight * 0.5f;
+            auto bottom = centre - jlimit (-1.0f, 1.0f, column.minimum) * laneHeight * 0.5f;
+            
+            g.setColour (column.maximum >= 1.0f || column.minimum <= -1.0f ? juce::Colours::red : juce::Colours::limegreen);
+            g.fillRect (juce::Rectangle<float> ((float) x, top, 1.0f, jmax (1.0f, bottom - top)));
+        }
+    }
+}
+
+void AudioMidiRecorderPluginProcessorEditor::timerCallback()
+{
+    updateLevels();
+    
+    if (++timerTicks % 8 != 0)
+        return;
+    
+    metrics = audioProcessor.getMetrics();
+    finalizing = audioProcessor.isFinalizing();
+    repaint (metricsArea);
+    
+    // Another instance in the same recording group may have started or stopped the take (or
+    // an armed take may have triggered, or timed out and re-armed)
+    if (audioProcessor.isRecording() != recording || audioProcessor.isArmed() != armed)
+        updateRecordButton();
+    
+    // (playback stops by itself at the end of the take)
+    if (audioProcessor.isPlaying() != playing)
+        updatePlayButton();
+    
+    updateMemoryTakeButtons();
+}
+
+void AudioMidiRecorderPluginProcessorEditor::updateRecordButton()
+{
+    recording = audioProcessor.isRecording();
+    armed = audioProcessor.isArmed();
+    recordButton.setButtonText(armed ? "Armed (Stop)" : recording ? "Stop Recording" : "Record");
+    recordButton.setColour(TextButton::buttonColourId, armed ? Colours::orange : recording ? Colours::red : Colours::green);
+}
+
+void AudioMidiRecorderPluginProcessorEditor::updateMemoryTakeButtons()
+{
+    // (only a finished take can be saved - its writers may still be busy on the writer thread)
+    auto take = audioProcessor.getMemoryTakes().getLastTake();
+    auto canFinish = audioProcessor.isRecordingToMemory() && take != nullptr && take->isFinished() && ! recording;
+    saveTakeButton.setEnabled(canFinish);
+    discardTakeButton.setEnabled(canFinish);
+}
+
+void AudioMidiRecorderPluginProcessorEditor::finishMemoryTake (bool save)
+{
+    auto& store = audioProcessor.getMemoryTakes();
+    auto take = store.getLastTake();
+    
+    if (take == nullptr || ! take->isFinished())
+        return;
+    
+    // Saving decodes the whole take into its files here, so it's kept if that fails
+    if (save && ! audioProcessor.commitMemoryTake (*take, take->getAudioFile(), take->getMidiFile())) {
+        AlertWindow::showMessageBoxAsync (AlertWindow::WarningIcon, "Save Take",
+                                          "Couldn't write " + take->getAudioFile().getFullPathName());
+        return;
+    }
+    
+    store.removeTake (take.get());
+    updateMemoryTakeButtons();
+    repaint (metricsArea);
+}
+
+void AudioMidiRecorderPluginProcessorEditor::updatePlayButton()
+{
+    playing = audioProcessor.isPlaying();
+    playButton.setButtonText(playing ? "Stop Playback" : "Play Last Take");
 }
 
 void AudioMidiRecorderPluginProcessorEditor::buttonClicked (Button* button)
 {
-    if (!recording){
+    if (!recording && !armed){
         // Start Recording
-        // Setup Recording Driectory
-        auto docsDir = File::getSpecialLocation (File::userDocumentsDirectory);
-        auto parentDir = File(docsDir.getFullPathName()+"/AudioMidiRecordings" );
-        parentDir.createDirectory();
-        
-        // Audio Recording File (Swap between .wav and .ogg formats here)
-        audioRecordingFile = parentDir.getNonexistentChildFile("recording", ".wav");    //Wav Audio File Format
+        // Audio Recording File (Swap between .wav, .ogg and .flac formats here)
+        // (usually already open - see setPrearmTakes)
+        audioRecordingFile = audioProcessor.getNextRecordingFile();    //Wav Audio File Format
         //audioRecordingFile = parentDir.getNonexistentChildFile("dinverno_system_recording", ".ogg");  //OGG Audio File Format
+        //audioRecordingFile = parentDir.getNonexistentChildFile("dinverno_system_recording", ".flac");  //FLAC Audio File Format
         
         // Midi Recording File (same name as audio file - will overwrite if file exists)
-        midiRecordingFile = parentDir.getChildFile(audioRecordingFile.getFileNameWithoutExtension()+".mid");
+        midiRecordingFile = audioRecordingFile.withFileExtension(".mid");
         
-        // Tell Audio Processor to start recording
-        audioProcessor.startRecordingAudio(audioRecordingFile);
-        audioProcessor.startRecordingMidi(midiRecordingFile);
+        // Tell Audio Processor to start recording (both takes begin on the same sample), or with
+        // auto-record, to wait for the first note or sound. Overdubbing starts the new take with the
+        // last one's playback (or records as usual if there's nothing to play yet).
+        if (overdubButton.getToggleState() && audioProcessor.overdub(audioRecordingFile, midiRecordingFile))
+            updatePlayButton();
+        else if (audioProcessor.getAutoRecord().enabled)
+            audioProcessor.armRecording(audioRecordingFile, midiRecordingFile);
+        else
+            audioProcessor.startRecording(audioRecordingFile, midiRecordingFile);
         
         // Update GUI
-        recordButton.setButtonText("Stop Recording");
-        recordButton.setColour(TextButton::buttonColourId,Colours::red);
-        recording = true;
+        updateRecordButton();
         
     }else{
-        // Stop Recording
+        // Stop Recording (or disarm)
         
         // Tell Audio Processor to Stop Recording
-        audioProcessor.stopRecordingAudio();
-        audioProcessor.stopRecordingMidi();
+        // (returns straight away - the files are finalized in the background, see timerCallback)
+        audioProcessor.stopRecording();
+        finalizing = audioProcessor.isFinalizing();
+        repaint (metricsArea);
         
         // Update GUI
-        recordButton.setButtonText("Record");
-        recordButton.setColour(TextButton::buttonColourId,Colours::green);
-        recording = false;
+        updateRecordButton();
     }
 }
@@ -15,7 +15,8 @@
 /**
 */
 class AudioMidiRecorderPluginProcessorEditor  : public AudioProcessorEditor,
-                                        public Button::Listener
+                                        public Button::Listener,
+                                        private Timer
 {
 public:
     AudioMidiRecorderPluginProcessorEditor (AudioMidiRecorderPluginProcessor&);
@@ -29,7 +30,12 @@ public:
     // Listener interface for buttons
     void buttonClicked (Button* button) override;
     
+    // Polls the live levels and the recorder's telemetry
+    void timerCallback() override;
+    
     bool recording = false;
+    bool armed = false;
+    bool playing = false;
 private:
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
@@ -38,6 +44,32 @@ private:
     // GUI Objects
     //juce::Slider midiVolume; // [1]
     TextButton recordButton;
+    ComboBox formatBox;
+    ToggleButton autoRecordButton { "Auto-record" };
+    TextButton playButton;
+    ToggleButton overdubButton { "Overdub" };
+    TextButton saveTakeButton { "Save Take" }, discardTakeButton { "Discard Take" };
+    
+    // Telemetry
+    RecorderMetrics::Snapshot metrics;
+    bool finalizing = false;
+    juce::Rectangle<int> metricsArea;
+    int timerTicks = 0;
+    
+    // Live levels: the waveform is drawn into an image a few columns at a time as they arrive,
+    // and each meter is only repainted when its bar moves
+    std::unique_ptr<LevelMonitor::Snapshot> levels;
+    Image waveformImage;
+    juce::Rectangle<int> waveformArea, metersArea;
+    int meterPeakHeights[LevelMonitor::maxChannels] = {}, meterRmsHeights[LevelMonitor::maxChannels] = {};
+    
+    void updateRecordButton();
+    void updatePlayButton();
+    void updateMemoryTakeButtons();
+    void finishMemoryTake (bool save);
+    void updateLevels();
+    void drawWaveformColumns (int64 numNewColumns);
+    juce::Rectangle<int> getMeterBounds (int channel) const;
     
     // GUI Control
     //void sliderValueChanged(juce::Slider* slider) override;
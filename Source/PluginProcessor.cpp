@@ -21,17 +21,21 @@ AudioMidiRecorderPluginProcessor::AudioMidiRecorderPluginProcessor()
                      #endif
                        ),
         recordingAudio(false),
-        recordingMidi(false),
-        writeThread("write thread")
+        recordingMidi(false)
 #endif
 {
-    midiRecordingFile = MidiFile();
-    midiSequence = MidiMessageSequence();
-    recordingTime = 0;
+    setHeaderCommitSeconds (headerCommitSeconds);
 }
 
 AudioMidiRecorderPluginProcessor::~AudioMidiRecorderPluginProcessor()
 {
+    discardPreparedTake();
+    groupRegistry->leave (recordingGroup, this);
+    
+    ioService->removeClient (&audioRecorder);
+    ioService->removeClient (&midiRecorder);
+    ioService->removeClient (&metricsLogger);
+    ioService->removeClient (&player);
 }
 
 //==============================================================================
@@ -102,17 +106,68 @@ void AudioMidiRecorderPluginProcessor::prepareToPlay (double sampleRate, int sam
     // Use this method as the place to do any pre-playback
     // initialisation that you need..
     mSampleRate = sampleRate;
+    mBlockSize = samplesPerBlock;
+    
+    // Allocate the capture ring and lookback history before the audio thread can use them
+    auto numChannels = jmax (1, getTotalNumInputChannels());
+    auto lookbackSamples = (int) (lookbackSeconds * sampleRate);
+    audioRecorder.prepare (numChannels, calculateFifoSize (numChannels), lookbackSamples, samplesPerBlock);
+    midiRecorder.prepare (sampleRate, lookbackSamples);
+    metrics.setFifoCapacity (audioRecorder.getFifoSize(), sampleRate);
+    levelMonitor.prepare (getTotalNumInputChannels(), sampleRate);
+    
+    numInputPointers = jmax (1, getTotalNumInputChannels());
+    inputPointers.malloc ((size_t) numInputPointers);
+    setAutoRecord (autoRecord);
+    
+    updateWriteBatchSize();
+    
+    // Register with the shared writer threads (each take moves its recorder to the thread for
+    // its file's disk, if that's somewhere else)
+    auto directory = getRecordingDirectory();
+    ioService->addClient (&audioRecorder, directory);
+    ioService->addClient (&midiRecorder, directory);
+    ioService->addClient (&metricsLogger, directory);
+    
+    // Playback's read-ahead buffer (with the reader off its thread while it's reallocated)
+    ioService->removeClient (&player);
+    player.prepare (getTotalNumOutputChannels(), sampleRate, (int) (playbackPrefetchSeconds * sampleRate));
+    ioService->addClient (&player, directory);
+    overdubTakes = 0;
+    overdubbing = false;
+    playPending = false;
     
-    // Start Audio Recording Thread
-    writeThread.startThread();
+    // Get the first take's files open while nothing is happening
+    prepareNextTake();
 }
 
 void AudioMidiRecorderPluginProcessor::releaseResources()
 {
     // When playback stops, you can use this as an opportunity to free up any
     // spare memory, etc.
-    stopRecordingAudio();
-    writeThread.stopThread (1000);
+    // (the audio callback has stopped, so the recorder can close the take itself)
+    auto neverStarted = armedTakes.exchange (0) != 0;
+    neverStarted = overdubTakes.exchange (0) != 0 || neverStarted;
+    armPending = false;
+    playPending = false;
+    autoRecordedTakes = 0;
+    audioRecorder.release();
+    midiRecorder.release();
+    recordingAudio = false;
+    recordingMidi = false;
+    publishRequestedTakes();
+    discardPreparedTake();
+    
+    // (an armed take's writers have been closed by now, so its files can go straight away)
+    if (neverStarted && takeAudioFile != File())
+        deleteTakeFiles (takeAudioFile, takeMidiFile);
+    
+    deleteDisarmedTake();
+    
+    ioService->removeClient (&audioRecorder);
+    ioService->removeClient (&midiRecorder);
+    ioService->removeClient (&metricsLogger);
+    ioService->removeClient (&player);
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -123,9 +178,9 @@ bool AudioMidiRecorderPluginProcessor::isBusesLayoutSupported (const BusesLayout
     return true;
   #else
     // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    // Any discrete layout up to 32 channels can be recorded - the file follows the bus.
+    if (layouts.getMainOutputChannelSet().isDisabled()
+     || layouts.getMainOutputChannelSet().size() > 32)
         return false;
 
     // This checks if the input layout matches the output layout
@@ -141,109 +196,769 @@ bool AudioMidiRecorderPluginProcessor::isBusesLayoutSupported (const BusesLayout
 
 void AudioMidiRecorderPluginProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
-    // Record Midi Data to Sequence
-    if (recordingMidi){
-        // Initialise and clear variables
-        int numSamples = buffer.getNumSamples();
-        double numSecondsInThisBlock = numSamples / mSampleRate;
-        double endTime = recordingTime + numSecondsInThisBlock;
-
+    auto callbackStart = Time::getHighResolutionTicks();
+    auto numSamples = buffer.getNumSamples();
+    
+    // Levels and waveform for the editor (published without locks - see LevelMonitor)
+    levelMonitor.process (buffer.getArrayOfReadPointers(), getTotalNumInputChannels(), numSamples);
+    
+    AudioPlayHead::CurrentPositionInfo positionInfo;
+    auto* playHead = getPlayHead();
+    auto hasPosition = playHead != nullptr && playHead->getCurrentPosition (positionInfo);
+    
+    // Both recorders pick up take changes from one snapshot, so takes started together begin
+    // on the same sample
+    auto takes = requestedTakes.load();
+    
+    // Playback starts once its read-ahead is full, and an overdub's takes start with it. (The
+    // exchange fails if the message thread stops at the same moment.)
+    if (player.update()) {
+        auto overdub = overdubTakes.load();
         
-        // Iterate over midi Messages add to midi sequence recording
-        int time;
-        juce::MidiMessage m;
-        for (juce::MidiBuffer::Iterator i (midiMessages); i.getNextEvent(m, time);)
-        {
-            // Get time of midi event and convert into ticks per quarter note (1s = 192 ticks)
-            double offset = (double)time/(double)numSamples * numSecondsInThisBlock;
-            double mTime = 192 * (recordingTime + offset);
-            m.setTimeStamp(mTime);
-            midiSequence.addEvent(m,0);
-        }
-        recordingTime = endTime;
+        if (overdub != 0 && overdubTakes.compare_exchange_strong (overdub, 0) && requestedTakes.compare_exchange_strong (takes, overdub))
+            takes = overdub;
+    }
+    
+    // An armed take starts on the sample that triggers it, so the block is split there
+    auto previousTakes = takes;
+    auto switchAt = updateAutoRecord (buffer, midiMessages, takes);
+    
+    // Record Midi Data to file (in seperate thread)
+    // (events are stamped with the sample clock; ticks are worked out on the writer thread)
+    auto tempo = followHostTempo.load() && hasPosition && positionInfo.bpm > 0.0 ? positionInfo.bpm : 0.0;
+    
+    if (tempo > 0.0)
+        hostTempo = tempo;
+    
+    // Where this block sits on the timeline shared with other instances (used to line up the
+    // takes of a recording group): the host's playhead while it's playing, otherwise the wall clock
+    TimelinePosition timelinePosition;
+    
+    if (hasPosition && positionInfo.isPlaying) {
+        timelinePosition.samples = positionInfo.timeInSamples;
+        timelinePosition.fromHost = true;
+    } else {
+        timelinePosition.samples = (int64) (Time::highResolutionTicksToSeconds (callbackStart) * mSampleRate);
     }
     
     // Record Audio Data to file (in seperate thread)
-    if (recordingAudio){
-        const ScopedLock sl (writerLock);
-        if (activeWriter.load() != nullptr) {
-            activeWriter.load()->write (buffer.getArrayOfReadPointers (), buffer.getNumSamples());
+    // (lock-free: the recorders only copy into their rings and pick up take changes here)
+    if (switchAt > 0)
+        recordBlock (buffer, midiMessages, 0, switchAt, previousTakes, tempo, timelinePosition);
+    
+    recordBlock (buffer, midiMessages, switchAt, numSamples - switchAt, takes, tempo, timelinePosition);
+    
+    // Playback goes on top of the input once it's been recorded, and its midi after the input's
+    player.process (buffer.getArrayOfWritePointers(), jmin (getTotalNumOutputChannels(), buffer.getNumChannels()),
+                    numSamples, midiMessages);
+    
+    // The sample clock only ever moves here, once per block
+    samplePosition += numSamples;
+    
+    // Callback timing goes into a lock-free histogram
+    metrics.addCallbackDuration (1.0e6 * Time::highResolutionTicksToSeconds (Time::getHighResolutionTicks() - callbackStart));
+}
+
+void AudioMidiRecorderPluginProcessor::recordBlock (const AudioBuffer<float>& buffer, const MidiBuffer& midiMessages,
+                                                    int startSample, int numSamples, uint64 takes, double tempo,
+                                                    TimelinePosition timelinePosition) noexcept {
+    auto audioTake = (int) (int32) (uint32) (takes >> 32);
+    auto midiTake = (int) (int32) (uint32) takes;
+    
+    midiRecorder.process (midiMessages, startSample, numSamples, samplePosition + startSample, midiTake, tempo);
+    
+    auto numChannels = jmin (getTotalNumInputChannels(), buffer.getNumChannels(), numInputPointers);
+    
+    for (int ch = 0; ch < numChannels; ++ch)
+        inputPointers[ch] = buffer.getReadPointer (ch) + startSample;
+    
+    timelinePosition.samples += startSample;
+    audioRecorder.process (inputPointers, numChannels, numSamples, audioTake, timelinePosition);
+}
+
+// The first sample in the block that counts as activity for auto-record, or -1
+static int findAutoRecordTrigger (const AudioBuffer<float>& buffer, int numChannels, const MidiBuffer& midiMessages,
+                                  bool onMidi, bool onAudio, float threshold) noexcept {
+    auto numSamples = buffer.getNumSamples();
+    auto first = -1;
+    
+    if (onMidi) {
+        // (read straight from the raw bytes, since building a MidiMessage could allocate)
+        for (const auto metadata : midiMessages) {
+            if (metadata.numBytes >= 3 && (metadata.data[0] & 0xf0) == 0x90 && metadata.data[2] > 0) {
+                first = metadata.samplePosition;
+                break;
+            }
+        }
+    }
+    
+    if (onAudio) {
+        for (int ch = 0; ch < numChannels; ++ch) {
+            auto* samples = buffer.getReadPointer (ch);
+            auto end = first >= 0 ? first : numSamples;
+            
+            // Vectorised check of the whole block first; only a block that crosses is searched
+            auto range = FloatVectorOperations::findMinAndMax (samples, end);
+            
+            if (jmax (range.getEnd(), -range.getStart()) < threshold)
+                continue;
+            
+            for (int i = 0; i < end; ++i) {
+                if (std::abs (samples[i]) >= threshold) {
+                    first = i;
+                    break;
+                }
+            }
         }
     }
+    
+    return first;
 }
 
-void AudioMidiRecorderPluginProcessor::startRecordingAudio (const File& audioFile) {
-    // Exit if already recording
-    if (recordingAudio)
-        return;
+int AudioMidiRecorderPluginProcessor::updateAutoRecord (const AudioBuffer<float>& buffer, const MidiBuffer& midiMessages,
+                                                        uint64& takes) noexcept {
+    auto onMidi = autoRecordOnMidi.load();
+    auto onAudio = autoRecordOnAudio.load();
+    auto threshold = autoRecordThreshold.load();
+    auto numChannels = jmin (getTotalNumInputChannels(), buffer.getNumChannels());
     
-    // Clear and reset writers
-    stopRecordingAudio();
+    // Armed: the take was queued by armRecording, and starts on the first trigger. (Either
+    // exchange fails if the message thread disarms or stops at the same moment.)
+    auto armed = armedTakes.load();
+    
+    if (armed != 0) {
+        auto offset = findAutoRecordTrigger (buffer, numChannels, midiMessages, onMidi, onAudio, threshold);
+        
+        if (offset >= 0 && armedTakes.compare_exchange_strong (armed, 0) && requestedTakes.compare_exchange_strong (takes, armed)) {
+            takes = armed;
+            autoRecordedTakes = armed;
+            lastActivityPosition = samplePosition + offset;
+            return offset;
+        }
+        
+        return 0;
+    }
+    
+    // Recording: stop once nothing has happened for the idle time
+    if (autoRecordedTakes == 0)
+        return 0;
+    
+    // (stopped, or replaced by another take, from the message thread)
+    if (takes != autoRecordedTakes) {
+        autoRecordedTakes = 0;
+        return 0;
+    }
     
-    // Create an OutputStream to write to our destination file...
+    if (findAutoRecordTrigger (buffer, numChannels, midiMessages, onMidi, onAudio, threshold) >= 0) {
+        lastActivityPosition = samplePosition + buffer.getNumSamples();
+    } else if (samplePosition - lastActivityPosition >= autoRecordIdleSamples.load()) {
+        // Both takes stop here; the message thread catches the recorders up (see timerCallback)
+        auto audioTake = (int) (int32) (uint32) (takes >> 32);
+        auto midiTake = (int) (int32) (uint32) takes;
+        auto stopped = ((uint64) (uint32) -audioTake << 32) | (uint64) (uint32) -midiTake;
+        
+        if (requestedTakes.compare_exchange_strong (takes, stopped)) {
+            takes = stopped;
+            autoRecordStopped = true;
+        }
+        
+        autoRecordedTakes = 0;
+    }
+    
+    return 0;
+}
+
+//==============================================================================
+// Opens one Ogg Vorbis or FLAC file
+static std::unique_ptr<RecordingWriter> createCompressedWriter (const File& audioFile, double sampleRate, int numChannels,
+                                                                WavRecordingWriter::SampleFormat format, bool writeSeekIndex) {
     audioFile.deleteFile();
+    std::unique_ptr<OutputStream> audioStream (audioFile.createOutputStream());
+    
+    if (audioStream == nullptr)
+        return nullptr;
+    
+    // Ogg pages are indexed on their way to the file (the index is saved when the writer deletes the stream)
+    if (writeSeekIndex && audioFile.hasFileExtension(".ogg"))
+        audioStream = std::make_unique<OggPageIndexStream> (std::move (audioStream), SeekIndex::getFileFor (audioFile), sampleRate);
+    
+    std::unique_ptr<AudioFormatWriter> audioWriter;
+    
+    if (audioFile.hasFileExtension(".flac")){
+        // FLAC file Recorder (lossless, 16 or 24 bits)
+        FlacAudioFormat flacFormat;
+        auto bitsPerSample = format == WavRecordingWriter::SampleFormat::int16 ? 16 : 24;
+        audioWriter.reset (flacFormat.createWriterFor (audioStream.get(),sampleRate,(unsigned int) numChannels,bitsPerSample,{},5));
+    }else{
+        // OGG file Recorder
+        OggVorbisAudioFormat oggFormat;
+        audioWriter.reset (oggFormat.createWriterFor (audioStream.get(),sampleRate,(unsigned int) numChannels,16,{},8));
+    }
+    
+    if (audioWriter == nullptr)
+        return nullptr;
+    
+    auto& stream = *audioStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
+    return std::make_unique<AudioFormatRecordingWriter> (std::move (audioWriter), stream);
+}
+
+std::unique_ptr<RecordingWriter> AudioMidiRecorderPluginProcessor::createAudioWriter (const File& audioFile, const AudioWriterSettings& settings) {
+    auto audioWriter = openAudioWriter (audioFile, settings);
     
-    if ( auto audioStream = std::unique_ptr<FileOutputStream> (audioFile.createOutputStream()) ) {
+    // The overview is built on the writer thread as the take goes to disk, and saved next to it
+    // when the take is finalised
+    if (audioWriter != nullptr && settings.writeOverview)
+        return std::make_unique<PeakOverviewWriter> (std::move (audioWriter), PeakOverview::getFileFor (audioFile), settings.sampleRate);
+    
+    return audioWriter;
+}
+
+std::unique_ptr<RecordingWriter> AudioMidiRecorderPluginProcessor::openAudioWriter (const File& audioFile, const AudioWriterSettings& settings) {
+    // (this only uses its arguments, since it's also called on the writer thread)
+    auto sampleRate = settings.sampleRate;
+    auto numChannels = settings.numChannels;
+    auto format = settings.format;
+    auto outputMode = settings.outputMode;
+    
+    if (audioFile.hasFileExtension(".ogg") || audioFile.hasFileExtension(".flac")){
+        if (settings.encoderPool == nullptr)
+            return createCompressedWriter (audioFile, sampleRate, numChannels, format, settings.writeSeekIndex);
+        
+        // Each group of channels is encoded into its own file on the worker pool
+        auto groupSize = jmax (1, audioFile.hasFileExtension(".flac") ? jmin (8, settings.channelsPerEncoder) : settings.channelsPerEncoder);
+        auto singleGroup = numChannels <= groupSize;
+        
+        auto getGroupFile = [&] (int firstChannel, int numGroupChannels) {
+            return singleGroup ? audioFile : ParallelEncodingWriter::getGroupFile (audioFile, firstChannel, numGroupChannels);
+        };
+        
+        auto audioWriter = std::make_unique<ParallelEncodingWriter> (*settings.encoderPool, [&] (int firstChannel, int numGroupChannels) {
+            return createCompressedWriter (getGroupFile (firstChannel, numGroupChannels), sampleRate, numGroupChannels, format, settings.writeSeekIndex);
+        }, numChannels, groupSize);
+        
+        if (audioWriter->openedOk())
+            return audioWriter;
+        
+        // (the groups that did open are closed, and their files deleted, rather than left half made)
+        audioWriter.reset();
+        
+        for (int first = 0; first < numChannels; first += groupSize) {
+            auto groupFile = getGroupFile (first, jmin (groupSize, numChannels - first));
+            groupFile.deleteFile();
+            SeekIndex::getFileFor (groupFile).deleteFile();
+        }
+    }else if (audioFile.hasFileExtension(".wav")){
+        // Wav File Recorder
+        // Create an OutputStream to write to our destination file...
+        audioFile.deleteFile();
         
-        if (audioFile.hasFileExtension(".ogg")){
-            // OGG file Recorder
-            OggVorbisAudioFormat oggFormat;
+        // Memory-mapped: the file is preallocated and mapped here, then filled in place
+        if (outputMode == WavOutputMode::memoryMapped) {
+            auto mappedStream = std::make_unique<MappedFileOutputStream> (audioFile);
             
-            if (auto audioWriter = oggFormat.createWriterFor (audioStream.get(),mSampleRate,1,16,{},8) ) {
-                
-                audioStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
-                
-                // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
-                // write the data to disk on our background thread.
-                threadedWriter.reset (new AudioFormatWriter::ThreadedWriter (audioWriter, writeThread, 32768));
-                //threaded = new AudioFormatWriter::ThreadedWriter (writer, writeThread, 16384);
-                
-                // And now, swap over our active writer pointer so that the audio callback will start using it..
-                const ScopedLock sl (writerLock);
-                activeWriter = threadedWriter.get();
+            if (mappedStream->openedOk()) {
+                auto audioWriter = std::make_unique<WavRecordingWriter> (std::move (mappedStream), sampleRate, numChannels, format, settings.dither);
                 
+                if (audioWriter->openedOk()) {
+                    if (settings.writeSeekIndex)
+                        audioWriter->writeSeekIndex (SeekIndex::getFileFor (audioFile));
+                    
+                    return audioWriter;
+                }
             }
-        }else if (audioFile.hasFileExtension(".wav")){
-           // Wav File Recorder
-            // Audio File Format
-            WavAudioFormat format;
+        }
+        
+        std::unique_ptr<OutputStream> audioStream;
+        
+        // Preallocated, block-aligned writes (falls back to a FileOutputStream where it isn't available)
+        if (outputMode == WavOutputMode::preallocated || outputMode == WavOutputMode::directIO) {
+            DirectFileOutputStream::Options options;
+            options.useDirectIO = outputMode == WavOutputMode::directIO;
             
-            if (auto audioWriter = format.createWriterFor (audioStream.get(), mSampleRate, 1, 16, {}, 0) ) {
-                
-                audioStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
-                
-                // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
-                // write the data to disk on our background thread.
-                threadedWriter.reset (new AudioFormatWriter::ThreadedWriter (audioWriter, writeThread, 32768));
-                //threaded = new AudioFormatWriter::ThreadedWriter (writer, writeThread, 16384);
-                
-                // And now, swap over our active writer pointer so that the audio callback will start using it..
-                const ScopedLock sl (writerLock);
-                activeWriter = threadedWriter.get();
-                
-            }
+            auto directStream = std::make_unique<DirectFileOutputStream> (audioFile, options);
+            
+            if (directStream->openedOk())
+                audioStream = std::move (directStream);
+        }
+        
+        if (audioStream == nullptr)
+            audioStream = audioFile.createOutputStream();
+        
+        // (converts and interleaves on the writer thread with the vectorised kernels)
+        auto audioWriter = std::make_unique<WavRecordingWriter> (std::move (audioStream), sampleRate, numChannels, format, settings.dither);
+        
+        if (audioWriter->openedOk()) {
+            if (settings.writeSeekIndex)
+                audioWriter->writeSeekIndex (SeekIndex::getFileFor (audioFile));
+            
+            return audioWriter;
         }
     }
     
+    return nullptr;
+}
+
+void AudioMidiRecorderPluginProcessor::startRecording (const File& audioFile, const File& midiFile) {
+    // If these are the files prepared in the background, their writers only need handing over
+    startTake (audioFile, midiFile, claimPreparedTake (audioFile, midiFile));
+}
+
+void AudioMidiRecorderPluginProcessor::startTake (const File& audioFile, const File& midiFile,
+                                                  std::unique_ptr<TakePreparer::Take> prepared) {
+    // (remembered for playback, once the take's finished)
+    takeAudioFile = recordToMemory ? File() : audioFile;
+    takeMidiFile = recordToMemory ? File() : midiFile;
+    
+    // The audio thread sees both takes at once, so they start on the same sample
+    deferTakeRequests (true);
+    
+    if (recordToMemory && recordingGroup == nullptr) {
+        startMemoryTake (audioFile, midiFile);
+    } else if (prepared != nullptr) {
+        // (the devices were looked up with the files, so nothing here touches the disk)
+        ioService->addClient (&audioRecorder, prepared->audioDevice);
+        ioService->addClient (&midiRecorder, prepared->midiDevice);
+        startAudioTake (audioFile, std::move (prepared->audioWriter));
+        startMidiTake (midiFile, std::move (prepared->midiWriter), calculateSegmentLength());
+    } else {
+        startRecordingAudio (audioFile);
+        startRecordingMidi (midiFile);
+    }
+    
+    deferTakeRequests (false);
+    
+    // ...and the next take's files are opened straight away, while this one records
+    prepareNextTake();
+}
+
+File AudioMidiRecorderPluginProcessor::getNextRecordingFile() const {
+    auto preparedFile = preparer.getAudioFile();
+    return preparedFile != File() ? preparedFile : getNextTakeFile();
+}
+
+void AudioMidiRecorderPluginProcessor::setPrearmTakes (bool shouldPrearm) {
+    prearmTakes = shouldPrearm;
+    
+    if (prearmTakes)
+        prepareNextTake();
+    else
+        discardPreparedTake();
+}
+
+void AudioMidiRecorderPluginProcessor::prepareNextTake() {
+    // (the channel count isn't known until prepareToPlay, and groups open one shared file)
+    if (! prearmTakes || recordToMemory || mBlockSize == 0 || recordingGroup != nullptr || preparer.getAudioFile() != File())
+        return;
+    
+    auto audioFile = getNextTakeFile();
+    prepareTake (audioFile, audioFile.withFileExtension (".mid"), false);
+}
+
+void AudioMidiRecorderPluginProcessor::prepareTake (const File& audioFile, const File& midiFile, bool replacePrepared) {
+    auto settings = getTakeSettings (audioFile);
+    
+    auto open = [=] (TakePreparer::Take& take) {
+        take.audioDevice = RecordingIOService::getDeviceId (audioFile);
+        take.midiDevice = RecordingIOService::getDeviceId (midiFile);
+        take.audioWriter = openAudioTakeWriter (audioFile, settings);
+        take.midiWriter = openMidiTakeWriter (settings.segmentLength > 0 ? getSegmentFile (midiFile, 0) : midiFile,
+                                              settings.midiTicksPerQuarterNote, settings.audio.sampleRate,
+                                              settings.audio.writeSeekIndex);
+    };
+    
+    // (a take prepared for other files or settings is thrown away on the preparer's thread too)
+    if (replacePrepared)
+        preparer.replace (audioFile, midiFile, settings.toString(), open, [] (std::unique_ptr<TakePreparer::Take> take) { discardTake (std::move (take)); });
+    else
+        preparer.prepare (audioFile, midiFile, settings.toString(), open);
+}
+
+std::unique_ptr<TakePreparer::Take> AudioMidiRecorderPluginProcessor::claimPreparedTake (const File& audioFile, const File& midiFile) {
+    // (another file was asked for - the prepared take is kept for next time)
+    if (isRecording() || recordToMemory || recordingGroup != nullptr || audioFile != preparer.getAudioFile())
+        return nullptr;
+    
+    auto take = preparer.claim();
+    
+    if (take == nullptr)
+        return nullptr;
+    
+    // A take prepared with other settings (the format was changed since, say) is thrown away,
+    // and the files opened again the usual way
+    if (take->midiFile != midiFile || take->settings != getTakeSettings (audioFile).toString()
+         || take->audioWriter == nullptr || take->midiWriter == nullptr) {
+        discardTake (std::move (take));
+        return nullptr;
+    }
+    
+    return take;
+}
+
+void AudioMidiRecorderPluginProcessor::discardPreparedTake() {
+    discardTake (preparer.claim());
+}
+
+void AudioMidiRecorderPluginProcessor::discardTake (std::unique_ptr<TakePreparer::Take> take) {
+    if (take == nullptr)
+        return;
+    
+    // Close the writers first (which finishes off the files), then delete everything they made.
+    // (Prepared takes are always .wav, so there are no per-channel-group files.)
+    take->audioWriter.reset();
+    take->midiWriter.reset();
+    deleteTakeFiles (take->audioFile, take->midiFile);
+}
+
+void AudioMidiRecorderPluginProcessor::deleteTakeFiles (const File& audioFile, const File& midiFile) {
+    // (only for takes that never got any samples, so there's at most the first segment)
+    for (auto& file : { audioFile, getSegmentFile (audioFile, 0) }) {
+        file.deleteFile();
+        PeakOverview::getFileFor (file).deleteFile();
+        SeekIndex::getFileFor (file).deleteFile();
+    }
+    
+    SilenceGateWriter::getIndexFileFor (audioFile).deleteFile();
+    
+    for (auto& file : { midiFile, getSegmentFile (midiFile, 0) }) {
+        file.deleteFile();
+        SeekIndex::getFileFor (file).deleteFile();
+    }
+}
+
+void AudioMidiRecorderPluginProcessor::deleteDisarmedTake() {
+    // The writer thread drops the writers of a take the audio thread never started, which
+    // finishes off their (empty) files - they can go once it's closed every take up to the
+    // last one stopped
+    if (disarmedTakeFiles.isEmpty() || isFinalizing())
+        return;
+    
+    for (int i = 0; i + 1 < disarmedTakeFiles.size(); i += 2)
+        deleteTakeFiles (disarmedTakeFiles.getReference (i), disarmedTakeFiles.getReference (i + 1));
+    
+    disarmedTakeFiles.clear();
+}
+
+bool AudioMidiRecorderPluginProcessor::playTake (const File& audioFile, const File& midiFile) {
+    if (mBlockSize == 0 || (! audioFile.existsAsFile() && ! midiFile.existsAsFile()))
+        return false;
+    
+    // A take that's only just been stopped is still being finished off on the writer thread (the
+    // header and the midi track length are written last), so it starts once that's done
+    playAudioFile = audioFile;
+    playMidiFile = midiFile;
+    playPending = true;
+    startTimerHz (10);
+    startPendingPlayback();
+    return true;
+}
+
+void AudioMidiRecorderPluginProcessor::startPendingPlayback() {
+    if (! playPending || isFinalizing())
+        return;
+    
+    playPending = false;
+    
+    // The files are read on the writer thread for their disk, like the recorders' files
+    ioService->addClient (&player, playAudioFile.existsAsFile() ? playAudioFile : playMidiFile);
+    player.play (playAudioFile, playMidiFile);
+}
+
+bool AudioMidiRecorderPluginProcessor::playLastTake() {
+    return playTake (lastTakeAudioFile, lastTakeMidiFile);
+}
+
+bool AudioMidiRecorderPluginProcessor::overdub (const File& audioFile, const File& midiFile) {
+    if (isRecording() || isArmed() || recordingGroup != nullptr || ! playLastTake())
+        return false;
+    
+    // The new takes are opened now, but queued in overdubTakes: the audio thread only starts them
+    // when it starts the playback
+    queueingOverdub = true;
+    startRecording (audioFile, midiFile);
+    queueingOverdub = false;
+    
+    overdubbing = true;
+    return true;
+}
+
+bool AudioMidiRecorderPluginProcessor::armRecording (const File& audioFile, const File& midiFile) {
+    // (a group's take is started by whichever member the user presses Record on)
+    if (isRecording() || isArmed() || recordingGroup != nullptr || mBlockSize == 0)
+        return false;
+    
+    startTimerHz (10);
+    
+    // Memory takes have no files, so they're queued straight away
+    if (recordToMemory) {
+        armingTakes = true;
+        startRecording (audioFile, midiFile);
+        armingTakes = false;
+        return true;
+    }
+    
+    // Otherwise the files are only ever opened by the take preparer: the takes are queued as soon
+    // as it has them open (straight away, if they were prepared already - see timerCallback)
+    if (preparer.getAudioFile() != audioFile || preparer.getMidiFile() != midiFile
+         || preparer.getSettings() != getTakeSettings (audioFile).toString())
+        prepareTake (audioFile, midiFile, true);
+    
+    armAudioFile = audioFile;
+    armMidiFile = midiFile;
+    armPending = true;
+    armPreparedTake();
+    return true;
+}
+
+void AudioMidiRecorderPluginProcessor::armPreparedTake() {
+    // (if the prepared take has been thrown away meanwhile, there's nothing to wait for)
+    if (! armPending || (preparer.getAudioFile() != File() && ! preparer.isReady()))
+        return;
+    
+    armPending = false;
+    auto prepared = claimPreparedTake (armAudioFile, armMidiFile);
+    
+    // (the files couldn't be opened, or the take or the options changed meanwhile - nothing's armed)
+    if (prepared == nullptr)
+        return;
+    
+    // The takes are queued, but they're handed to the audio thread through armedTakes: it only
+    // moves them to requestedTakes when it sees the trigger
+    armingTakes = true;
+    startTake (armAudioFile, armMidiFile, std::move (prepared));
+    armingTakes = false;
+}
+
+void AudioMidiRecorderPluginProcessor::setAutoRecord (const AutoRecordOptions& options) {
+    autoRecord = options;
+    autoRecord.thresholdDb = jlimit (-96.0, 0.0, options.thresholdDb);
+    autoRecord.idleSeconds = jlimit (0.1, 24.0 * 3600.0, options.idleSeconds);
+    
+    autoRecordOnMidi = autoRecord.triggerOnMidi;
+    autoRecordOnAudio = autoRecord.triggerOnAudio;
+    autoRecordThreshold = Decibels::decibelsToGain ((float) autoRecord.thresholdDb);
+    autoRecordIdleSamples = (int64) (autoRecord.idleSeconds * mSampleRate);
+}
+
+void AudioMidiRecorderPluginProcessor::timerCallback() {
+    // The audio thread stopped an auto-recorded take: catch the recorders up, then wait for
+    // the next one
+    if (autoRecordStopped.exchange (false)) {
+        stopRecording();
+        
+        if (autoRecord.rearm) {
+            auto audioFile = getNextRecordingFile();
+            armRecording (audioFile, audioFile.withFileExtension (".mid"));
+        }
+    }
+    
+    // (arms a take whose files have just been opened, plays one that's just been finished off,
+    // and deletes one that was disarmed)
+    armPreparedTake();
+    startPendingPlayback();
+    deleteDisarmedTake();
+    
+    if (! isRecording() && ! isArmed() && ! playPending && disarmedTakeFiles.isEmpty())
+        stopTimer();
+}
+
+void AudioMidiRecorderPluginProcessor::stopRecording() {
+    // (disarms, if the trigger hasn't come yet - the queued takes are then dropped unused and
+    // their files deleted, and a take still being opened is kept as the next prepared one)
+    armPending = false;
+    auto neverStarted = armedTakes.exchange (0) != 0;
+    neverStarted = overdubTakes.exchange (0) != 0 || neverStarted;
+    
+    if (neverStarted && takeAudioFile != File()) {
+        disarmedTakeFiles.add (takeAudioFile, takeMidiFile);
+        startTimerHz (10);
+    }
+    
+    if (overdubbing) {
+        stopPlayback();
+        overdubbing = false;
+    }
+    
+    // (the take that's stopping is the one Play plays next)
+    if (isRecording() && ! neverStarted) {
+        lastTakeAudioFile = takeAudioFile;
+        lastTakeMidiFile = takeMidiFile;
+    }
+    
+    deferTakeRequests (true);
+    stopRecordingAudio();
+    stopRecordingMidi();
+    deferTakeRequests (false);
+}
+
+void AudioMidiRecorderPluginProcessor::deferTakeRequests (bool shouldDefer) {
+    // (in a group, every member has to hold its requests back until they're all made)
+    if (recordingGroup != nullptr)
+        recordingGroup->deferTakeRequests (shouldDefer);
+    else
+        deferGroupTakeRequests (shouldDefer);
+}
+
+void AudioMidiRecorderPluginProcessor::deferGroupTakeRequests (bool shouldDefer) {
+    takeRequestsDeferred += shouldDefer ? 1 : -1;
+    publishRequestedTakes();
+}
+
+void AudioMidiRecorderPluginProcessor::publishRequestedTakes() {
+    // One atomic for both recorders, read once per block by processBlock
+    if (takeRequestsDeferred != 0)
+        return;
+    
+    auto takes = ((uint64) (uint32) audioRecorder.getRequestedTake() << 32) | (uint64) (uint32) midiRecorder.getRequestedTake();
+    
+    if (armingTakes)
+        armedTakes = takes;
+    else if (queueingOverdub)
+        overdubTakes = takes;
+    else
+        requestedTakes = takes;
+}
+
+void AudioMidiRecorderPluginProcessor::startRecordingAudio (const File& audioFile) {
+    // Exit if already recording
+    if (recordingAudio)
+        return;
+    
+    // (the previous take may still be finalizing on the writer thread - the new one queues
+    // up behind it, so back-to-back takes don't have to wait)
+    auto settings = getTakeSettings (audioFile);
+    
+    // Grouped instances all record into one file, with a set of channels each. (The shared writer
+    // can outlive this instance, so it's encoded on the writer thread rather than our pool, and
+    // isn't split into segments.)
+    if (recordingGroup != nullptr) {
+        recordingGroup->startAudioTake (audioFile, [&] (int totalChannels) {
+                                            auto groupSettings = settings.audio;
+                                            groupSettings.numChannels = totalChannels;
+                                            return createAudioWriter (audioFile, groupSettings);
+                                        }, mSampleRate, mBlockSize);
+        return;
+    }
+    
+    ioService->addClient (&audioRecorder, audioFile);
+    startAudioTake (audioFile, openAudioTakeWriter (audioFile, settings));
+}
+
+AudioMidiRecorderPluginProcessor::TakeSettings AudioMidiRecorderPluginProcessor::getTakeSettings (const File& audioFile) {
+    TakeSettings settings;
+    
+    // The file has as many channels as the input bus
+    settings.audio.sampleRate = mSampleRate;
+    settings.audio.numChannels = audioRecorder.getNumChannels();
+    settings.audio.format = recordingFormat;
+    settings.audio.dither = ditherMode;
+    settings.audio.outputMode = wavOutputMode;
+    settings.audio.channelsPerEncoder = channelsPerEncoder;
+    settings.audio.writeOverview = writeOverviews;
+    settings.audio.writeSeekIndex = writeSeekIndexes;
+    
+    // Compressed formats are encoded on a pool of workers shared by every instance, leaving the
+    // writer thread free to keep draining the ring
+    if (recordingGroup == nullptr && ! audioFile.hasFileExtension(".wav"))
+        settings.audio.encoderPool = &encoderPool->get();
+    
+    settings.segmentLength = calculateSegmentLength();
+    settings.silenceGate = silenceGate;
+    settings.midiTicksPerQuarterNote = midiTicksPerQuarterNote;
+    return settings;
+}
+
+String AudioMidiRecorderPluginProcessor::TakeSettings::toString() const {
+    StringArray fields;
+    fields.add (String (audio.sampleRate));
+    fields.add (String (audio.numChannels));
+    fields.add (String ((int) audio.format));
+    fields.add (String ((int) audio.dither));
+    fields.add (String ((int) audio.outputMode));
+    fields.add (String ((int) (audio.encoderPool != nullptr)));
+    fields.add (String (audio.channelsPerEncoder));
+    fields.add (String ((int) audio.writeOverview));
+    fields.add (String ((int) audio.writeSeekIndex));
+    fields.add (String (segmentLength));
+    fields.add (silenceGate.enabled ? String (silenceGate.thresholdDb) + "/" + String (silenceGate.holdSeconds) + "/"
+                                        + String (silenceGate.preRollSeconds) + "/" + String ((int) silenceGate.splitTakes)
+                                    : String ("off"));
+    fields.add (String (midiTicksPerQuarterNote));
+    return fields.joinIntoString (",");
+}
+
+std::unique_ptr<RecordingWriter> AudioMidiRecorderPluginProcessor::openAudioTakeWriter (const File& audioFile, const TakeSettings& settings) {
+    auto numChannels = settings.audio.numChannels;
+    auto segmentLength = settings.segmentLength;
+    auto audioSettings = settings.audio;
+    
+    auto openTakeFile = [=] (const File& file) -> std::unique_ptr<RecordingWriter> {
+        if (segmentLength > 0) {
+            // Rolling segments: the writer thread opens the next file as each one fills up
+            auto segmentedWriter = std::make_unique<SegmentedRecordingWriter> ([=] (int segmentIndex) {
+                                                                                   return createAudioWriter (getSegmentFile (file, segmentIndex), audioSettings);
+                                                                               }, numChannels, segmentLength);
+            if (segmentedWriter->openedOk())
+                return segmentedWriter;
+            
+            return nullptr;
+        }
+        
+        return createAudioWriter (file, audioSettings);
+    };
+    
+    if (settings.silenceGate.enabled) {
+        // Silence is left out on the writer thread, with a timeline index of what was kept. When
+        // each stretch gets its own file, they're named apart from the midi file's segments.
+        auto split = settings.silenceGate.splitTakes;
+        auto gateWriter = std::make_unique<SilenceGateWriter> (SilenceGateWriter::getIndexFileFor (audioFile),
+                                                               [=] (int part) { return split ? getStretchFile (audioFile, part) : audioFile; },
+                                                               [=] (const File& file) { return split ? createAudioWriter (file, audioSettings) : openTakeFile (file); },
+                                                               numChannels, audioSettings.sampleRate, settings.silenceGate);
+        if (gateWriter->openedOk())
+            return gateWriter;
+        
+        return nullptr;
+    }
+    
+    return openTakeFile (audioFile);
+}
+
+void AudioMidiRecorderPluginProcessor::startAudioTake (const File& audioFile, std::unique_ptr<RecordingWriter> audioWriter) {
+    // Re-size the ring for this take (only possible once the previous take has finished
+    // finalizing - otherwise it keeps its current size)
+    if (audioRecorder.resizeFifo (calculateFifoSize (audioRecorder.getNumChannels()))) {
+        metrics.setFifoCapacity (audioRecorder.getFifoSize(), mSampleRate);
+        droppedSamplesAtLastResize = getNumDroppedSamples();
+        updateWriteBatchSize();
+    }
+    
+    // Hand the writer to the recorder, which writes the data to disk on our background
+    // thread and tells the audio callback to start feeding it
+    if (audioWriter != nullptr)
+        audioRecorder.startTake (std::move (audioWriter));
+    
     // Update recording flag
     recordingAudio = true;
+    publishRequestedTakes();
 }
 
 void AudioMidiRecorderPluginProcessor::stopRecordingAudio () {
-    
-    // First, clear this pointer to stop the audio callback from using our writer object..
-    {
-        const ScopedLock sl (writerLock);
-        activeWriter = nullptr;
+    if (recordingGroup != nullptr) {
+        recordingGroup->stopAudioTake();
+        return;
     }
     
-    // Now we can delete the writer object. It's done in this order because the deletion could
-    // take a little time while remaining data gets flushed to disk, so it's best to avoid blocking
-    // the audio callback while this happens.
-    threadedWriter.reset();
+    stopAudioTake();
+}
+
+void AudioMidiRecorderPluginProcessor::stopAudioTake() {
+    // Ask the audio callback to end the take. The writer thread flushes the remaining data and
+    // rewrites the header in the background; isFinalizing() says when it's done.
+    lastAudioTake = audioRecorder.stopTake();
 
     // Update recording flag
     recordingAudio = false;
+    publishRequestedTakes();
 }
 
 void AudioMidiRecorderPluginProcessor::startRecordingMidi (const File& midiFile) {
@@ -251,31 +966,282 @@ void AudioMidiRecorderPluginProcessor::startRecordingMidi (const File& midiFile)
     if (recordingMidi)
         return;
     
+    // Grouped instances write a track each into one file
+    if (recordingGroup != nullptr) {
+        auto tempo = followHostTempo.load() && hostTempo.load() > 0.0 ? hostTempo.load() : midiTempo;
+        recordingGroup->startMidiTake (midiFile, midiTicksPerQuarterNote, midiTicksPerQuarterNote * tempo / 60.0);
+        return;
+    }
+    
+    auto segmentLength = calculateSegmentLength();
+    auto firstFile = segmentLength > 0 ? getSegmentFile (midiFile, 0) : midiFile;
+    ioService->addClient (&midiRecorder, midiFile);
+    startMidiTake (midiFile, openMidiTakeWriter (firstFile, midiTicksPerQuarterNote, mSampleRate, writeSeekIndexes), segmentLength);
+}
+
+std::unique_ptr<MidiFileStreamWriter> AudioMidiRecorderPluginProcessor::openMidiTakeWriter (const File& file, int ticksPerQuarterNote,
+                                                                                            double sampleRate, bool writeSeekIndex) {
+    // The writer streams the track to disk as the take goes on
     // Clear file before starting recording
-    midiFile.deleteFile();
+    file.deleteFile();
     
-    // Initialise variables for recording Midi input to file
-    midiStream = midiFile.createOutputStream();
-    midiSequence.clear();
-    midiRecordingFile.clear();
-    recordingTime=0;
+    if (auto midiStream = file.createOutputStream()) {
+        auto midiWriter = std::make_unique<MidiFileStreamWriter> (std::move (midiStream), ticksPerQuarterNote);
+        
+        if (writeSeekIndex)
+            midiWriter->enableSeekIndex (SeekIndex::getFileFor (file), sampleRate);
+        
+        return midiWriter;
+    }
+    
+    return nullptr;
+}
+
+void AudioMidiRecorderPluginProcessor::startMidiTake (const File& midiFile, std::unique_ptr<MidiFileStreamWriter> firstWriter,
+                                                      int64 segmentLength) {
+    if (segmentLength > 0) {
+        // Split at the same sample positions as the audio segments
+        midiRecorder.startTake (std::move (firstWriter),
+                                [=, ppq = midiTicksPerQuarterNote, sampleRate = mSampleRate, writeSeekIndex = writeSeekIndexes] (int segmentIndex) {
+                                    return openMidiTakeWriter (getSegmentFile (midiFile, segmentIndex), ppq, sampleRate, writeSeekIndex);
+                                },
+                                segmentLength);
+    } else if (firstWriter != nullptr) {
+        midiRecorder.startTake (std::move (firstWriter));
+    }
     
     // Update recording Flag
     recordingMidi = true;
+    publishRequestedTakes();
+}
+
+void AudioMidiRecorderPluginProcessor::startMemoryTake (const File& audioFile, const File& midiFile) {
+    if (isRecording())
+        return;
+    
+    // The recorders are fed exactly as for files; only the writers are different (and the files
+    // are just remembered, as the default place to commit the take to)
+    auto bitsPerSample = recordingFormat == WavRecordingWriter::SampleFormat::int16 ? 16 : 24;
+    auto take = memoryTakes.createTake (audioFile, midiFile, mSampleRate, audioRecorder.getNumChannels(), bitsPerSample);
+    
+    startAudioTake (audioFile, take->createAudioWriter());
+    startMidiTake (midiFile, take->createMidiWriter (midiTicksPerQuarterNote), 0);
+}
+
+void AudioMidiRecorderPluginProcessor::setRecordToMemory (bool shouldRecordToMemory) {
+    recordToMemory = shouldRecordToMemory;
+    
+    // (memory takes have no files to prepare)
+    if (recordToMemory)
+        discardPreparedTake();
+    else
+        prepareNextTake();
+}
+
+bool AudioMidiRecorderPluginProcessor::commitMemoryTake (const MemoryTake& take, const File& audioFile, const File& midiFile) {
+    auto settings = getTakeSettings (audioFile).audio;
+    
+    return take.commit (audioFile, midiFile, [settings] (const File& file, int numChannels) {
+                            auto fileSettings = settings;
+                            fileSettings.numChannels = numChannels;
+                            return createAudioWriter (file, fileSettings);
+                        });
 }
 
 void AudioMidiRecorderPluginProcessor::stopRecordingMidi () {
+    if (recordingGroup != nullptr) {
+        recordingGroup->stopMidiTake();
+        return;
+    }
+    
+    stopMidiTake();
+}
+
+void AudioMidiRecorderPluginProcessor::stopMidiTake() {
     // Exit if not recording
     if (!recordingMidi)
         return;
     
-    // Add recorded Midi Sequence and write to recording file
-    midiRecordingFile.addTrack(midiSequence);
-    midiRecordingFile.setTicksPerQuarterNote(96);
-    midiRecordingFile.writeTo(*midiStream,0);
+    // Ask the audio callback to end the take; the writer thread writes the end of the
+    // track and patches the header in the background
+    lastMidiTake = midiRecorder.stopTake();
     
     // Update recording file
     recordingMidi = false;
+    publishRequestedTakes();
+}
+
+//==============================================================================
+void AudioMidiRecorderPluginProcessor::setRecordingGroup (const String& groupId) {
+    if (groupId == getRecordingGroup())
+        return;
+    
+    groupRegistry->leave (recordingGroup, this);
+    recordingGroup = groupId.isNotEmpty() ? groupRegistry->join (groupId, this) : nullptr;
+    
+    // (groups don't use prepared takes)
+    if (recordingGroup != nullptr)
+        discardPreparedTake();
+    else
+        prepareNextTake();
+}
+
+String AudioMidiRecorderPluginProcessor::getRecordingGroup() const {
+    return recordingGroup != nullptr ? recordingGroup->getId() : String();
+}
+
+void AudioMidiRecorderPluginProcessor::updateTrackProperties (const TrackProperties& properties) {
+    const ScopedLock sl (trackNameLock);
+    trackName = properties.name;
+    metricsLogger.setTrackName (trackName);
+}
+
+int AudioMidiRecorderPluginProcessor::getNumGroupChannels() const {
+    return audioRecorder.getNumChannels();
+}
+
+String AudioMidiRecorderPluginProcessor::getGroupMemberName() const {
+    const ScopedLock sl (trackNameLock);
+    return trackName.isNotEmpty() ? trackName : getName();
+}
+
+void AudioMidiRecorderPluginProcessor::startGroupAudioTake (const File& audioFile, std::unique_ptr<RecordingWriter> writer) {
+    ioService->addClient (&audioRecorder, audioFile);
+    startAudioTake (audioFile, std::move (writer));
+}
+
+void AudioMidiRecorderPluginProcessor::startGroupMidiTake (const File& midiFile, std::unique_ptr<MidiFileStreamWriter> writer) {
+    ioService->addClient (&midiRecorder, midiFile);
+    
+    if (writer != nullptr)
+        midiRecorder.startTake (std::move (writer));
+    
+    recordingMidi = true;
+    publishRequestedTakes();
+}
+
+void AudioMidiRecorderPluginProcessor::stopGroupAudioTake() {
+    stopAudioTake();
+}
+
+void AudioMidiRecorderPluginProcessor::stopGroupMidiTake() {
+    stopMidiTake();
+}
+
+int64 AudioMidiRecorderPluginProcessor::calculateSegmentLength() const {
+    int64 length = 0;
+    
+    // (the gate collapses the audio but not the midi, so segments wouldn't cut them in the same
+    // places - the midi file stays whole, and follows the kept audio through the timeline index)
+    if (silenceGate.enabled)
+        return 0;
+    
+    if (segmentSeconds > 0)
+        length = (int64) (segmentSeconds * mSampleRate);
+    
+    // (sizes are for uncompressed audio in the current format, so midi and ogg segments
+    // line up with what a wav take would be split into)
+    if (segmentMegabytes > 0) {
+        auto bytesPerFrame = audioRecorder.getNumChannels() * WavRecordingWriter::getBitsPerSample (recordingFormat) / 8;
+        auto sizeLength = (int64) segmentMegabytes * 1024 * 1024 / jmax (1, bytesPerFrame);
+        length = length > 0 ? jmin (length, sizeLength) : sizeLength;
+    }
+    
+    return length;
+}
+
+void AudioMidiRecorderPluginProcessor::setHeaderCommitSeconds (double seconds) {
+    headerCommitSeconds = jlimit (0.0, 3600.0, seconds);
+    audioRecorder.setCommitInterval ((int) (headerCommitSeconds * 1000.0));
+}
+
+bool AudioMidiRecorderPluginProcessor::isFinalizing() const {
+    return ! audioRecorder.isTakeFinished (lastAudioTake) || ! midiRecorder.isTakeFinished (lastMidiTake);
+}
+
+int AudioMidiRecorderPluginProcessor::calculateFifoSize (int numChannels) const {
+    auto stats = metrics.getSnapshot();
+    
+    // Hold the latency budget, or four times the longest write the disk has taken so far
+    auto seconds = jmax (fifoLatencySeconds, 4.0 * stats.maxWriteMs / 1000.0);
+    
+    // If the last ring still overflowed, at least double it
+    if (stats.droppedSamples > droppedSamplesAtLastResize && audioRecorder.getFifoSize() > 0)
+        seconds = jmax (seconds, 2.0 * audioRecorder.getFifoSize() / mSampleRate);
+    
+    // A few blocks at least, and no more than 256MB whatever the channel count. Rounding up to a
+    // power of two stops small changes in the measurements from reallocating on every take.
+    const int64 maxFifoBytes = 256 * 1024 * 1024;
+    auto maxSamples = (int) (maxFifoBytes / ((int64) numChannels * (int64) sizeof (float)));
+    auto samples = jmax ((int64) 4 * mBlockSize, (int64) (seconds * mSampleRate));
+    
+    return jmin (nextPowerOfTwo ((int) jmin (samples, (int64) maxSamples)), maxSamples);
+}
+
+void AudioMidiRecorderPluginProcessor::setSilenceGate (const SilenceGateWriter::Options& options) {
+    silenceGate = options;
+    silenceGate.thresholdDb = jlimit (-120.0, 0.0, options.thresholdDb);
+    silenceGate.holdSeconds = jlimit (0.0, 3600.0, options.holdSeconds);
+    silenceGate.preRollSeconds = jlimit (0.0, 10.0, options.preRollSeconds);
+}
+
+void AudioMidiRecorderPluginProcessor::setMidiTempo (double bpm) {
+    midiTempo = jlimit (20.0, 999.0, bpm);
+    midiRecorder.setTempo (midiTempo);
+}
+
+void AudioMidiRecorderPluginProcessor::updateWriteBatchSize() {
+    // Gather a little audio before each write, so instances sharing a disk take turns with
+    // larger writes (never more than a quarter of the ring, to leave room for stalls)
+    auto batchSamples = (int) (ioService->getOptions().writeBatchSeconds * mSampleRate);
+    audioRecorder.setWriteBatchSize (jmin (batchSamples, audioRecorder.getFifoSize() / 4));
+}
+
+void AudioMidiRecorderPluginProcessor::setMetricsLogInterval (int seconds) {
+    metricsLogInterval = jlimit (0, 3600, seconds);
+    
+    auto logFile = getRecordingDirectory().getChildFile ("AudioMidiRecorder-metrics.csv");
+    
+    if (metricsLogInterval > 0)
+        getRecordingDirectory().createDirectory();
+    
+    metricsLogger.setLogFile (logFile, metricsLogInterval);
+}
+
+File AudioMidiRecorderPluginProcessor::getRecordingDirectory() {
+    return File::getSpecialLocation (File::userDocumentsDirectory).getChildFile ("AudioMidiRecordings");
+}
+
+File AudioMidiRecorderPluginProcessor::getNextTakeFile() {
+    auto parentDir = getRecordingDirectory();
+    parentDir.createDirectory();
+    
+    // The files aren't created until the take is opened on the preparer's thread, so every
+    // instance would otherwise be handed the same free name. Names are kept once given out.
+    static CriticalSection reservedLock;
+    static Array<File> reservedFiles;
+    const ScopedLock sl (reservedLock);
+    
+    // (a segmented or split take only creates recording-001.wav etc, so those names have to be free too)
+    for (int index = 1;; ++index) {
+        auto audioFile = parentDir.getChildFile ("recording" + (index > 1 ? " (" + String (index) + ")" : String()) + ".wav");
+        
+        if (! audioFile.exists() && ! getSegmentFile (audioFile, 0).exists() && ! getStretchFile (audioFile, 0).exists()
+             && ! reservedFiles.contains (audioFile)) {
+            reservedFiles.add (audioFile);
+            return audioFile;
+        }
+    }
+}
+
+File AudioMidiRecorderPluginProcessor::getSegmentFile (const File& takeFile, int segmentIndex) {
+    return takeFile.getSiblingFile (takeFile.getFileNameWithoutExtension() + "-" + String (segmentIndex + 1).paddedLeft ('0', 3)
+                                      + takeFile.getFileExtension());
+}
+
+File AudioMidiRecorderPluginProcessor::getStretchFile (const File& takeFile, int stretchIndex) {
+    return takeFile.getSiblingFile (takeFile.getFileNameWithoutExtension() + "-part" + String (stretchIndex + 1).paddedLeft ('0', 3)
+                                      + takeFile.getFileExtension());
 }
 
 
@@ -296,12 +1262,88 @@ void AudioMidiRecorderPluginProcessor::getStateInformation (juce::MemoryBlock& d
     // You should use this method to store your parameters in the memory block.
     // You could do that either as raw data, or use the XML or ValueTree classes
     // as intermediaries to make it easy to save and load complex data.
+    XmlElement xml ("AudioMidiRecorderState");
+    xml.setAttribute ("sampleFormat", (int) recordingFormat);
+    xml.setAttribute ("dither", (int) ditherMode);
+    xml.setAttribute ("lookbackSeconds", lookbackSeconds);
+    xml.setAttribute ("metricsLogInterval", metricsLogInterval);
+    xml.setAttribute ("fifoLatencySeconds", fifoLatencySeconds);
+    xml.setAttribute ("segmentSeconds", segmentSeconds);
+    xml.setAttribute ("segmentMegabytes", segmentMegabytes);
+    xml.setAttribute ("headerCommitSeconds", headerCommitSeconds);
+    xml.setAttribute ("wavOutputMode", (int) wavOutputMode);
+    xml.setAttribute ("channelsPerEncoder", channelsPerEncoder);
+    xml.setAttribute ("recordingGroup", getRecordingGroup());
+    xml.setAttribute ("writeOverviews", writeOverviews);
+    xml.setAttribute ("writeSeekIndexes", writeSeekIndexes);
+    xml.setAttribute ("silenceGate", silenceGate.enabled);
+    xml.setAttribute ("silenceThresholdDb", silenceGate.thresholdDb);
+    xml.setAttribute ("silenceHoldSeconds", silenceGate.holdSeconds);
+    xml.setAttribute ("silencePreRollSeconds", silenceGate.preRollSeconds);
+    xml.setAttribute ("silenceSplitTakes", silenceGate.splitTakes);
+    xml.setAttribute ("prearmTakes", prearmTakes);
+    xml.setAttribute ("recordToMemory", recordToMemory);
+    xml.setAttribute ("memoryLimitMegabytes", getMemoryLimitMegabytes());
+    xml.setAttribute ("playbackPrefetchSeconds", playbackPrefetchSeconds);
+    xml.setAttribute ("autoRecord", autoRecord.enabled);
+    xml.setAttribute ("autoRecordOnMidi", autoRecord.triggerOnMidi);
+    xml.setAttribute ("autoRecordOnAudio", autoRecord.triggerOnAudio);
+    xml.setAttribute ("autoRecordThresholdDb", autoRecord.thresholdDb);
+    xml.setAttribute ("autoRecordIdleSeconds", autoRecord.idleSeconds);
+    xml.setAttribute ("autoRecordRearm", autoRecord.rearm);
+    xml.setAttribute ("midiTicksPerQuarterNote", midiTicksPerQuarterNote);
+    xml.setAttribute ("midiTempo", midiTempo);
+    xml.setAttribute ("followHostTempo", followHostTempo.load());
+    copyXmlToBinary (xml, destData);
 }
 
 void AudioMidiRecorderPluginProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
     // You should use this method to restore your parameters from this memory block,
     // whose contents will have been created by the getStateInformation() call.
+    if (auto xml = getXmlFromBinary (data, sizeInBytes)) {
+        if (xml->hasTagName ("AudioMidiRecorderState")) {
+            recordingFormat = (WavRecordingWriter::SampleFormat) jlimit (0, 3, xml->getIntAttribute ("sampleFormat", 0));
+            ditherMode = (SampleConversion::Ditherer::Mode) jlimit (0, 2, xml->getIntAttribute ("dither", 1));
+            setLookbackSeconds (xml->getDoubleAttribute ("lookbackSeconds", 0.0));
+            setMetricsLogInterval (xml->getIntAttribute ("metricsLogInterval", 0));
+            setFifoLatencySeconds (xml->getDoubleAttribute ("fifoLatencySeconds", 0.5));
+            setSegmentSeconds (xml->getDoubleAttribute ("segmentSeconds", 0.0));
+            setSegmentMegabytes (xml->getIntAttribute ("segmentMegabytes", 0));
+            setHeaderCommitSeconds (xml->getDoubleAttribute ("headerCommitSeconds", 5.0));
+            wavOutputMode = (WavOutputMode) jlimit (0, 3, xml->getIntAttribute ("wavOutputMode", 0));
+            setChannelsPerEncoder (xml->getIntAttribute ("channelsPerEncoder", 2));
+            setRecordingGroup (xml->getStringAttribute ("recordingGroup"));
+            setWriteOverviews (xml->getBoolAttribute ("writeOverviews", true));
+            setWriteSeekIndexes (xml->getBoolAttribute ("writeSeekIndexes", true));
+            
+            SilenceGateWriter::Options gate;
+            gate.enabled = xml->getBoolAttribute ("silenceGate", false);
+            gate.thresholdDb = xml->getDoubleAttribute ("silenceThresholdDb", gate.thresholdDb);
+            gate.holdSeconds = xml->getDoubleAttribute ("silenceHoldSeconds", gate.holdSeconds);
+            gate.preRollSeconds = xml->getDoubleAttribute ("silencePreRollSeconds", gate.preRollSeconds);
+            gate.splitTakes = xml->getBoolAttribute ("silenceSplitTakes", false);
+            setSilenceGate (gate);
+            
+            setMemoryLimitMegabytes (xml->getIntAttribute ("memoryLimitMegabytes", 256));
+            setPlaybackPrefetchSeconds (xml->getDoubleAttribute ("playbackPrefetchSeconds", 2.0));
+            setRecordToMemory (xml->getBoolAttribute ("recordToMemory", false));
+            setPrearmTakes (xml->getBoolAttribute ("prearmTakes", true));
+            
+            AutoRecordOptions autoOptions;
+            autoOptions.enabled = xml->getBoolAttribute ("autoRecord", false);
+            autoOptions.triggerOnMidi = xml->getBoolAttribute ("autoRecordOnMidi", autoOptions.triggerOnMidi);
+            autoOptions.triggerOnAudio = xml->getBoolAttribute ("autoRecordOnAudio", autoOptions.triggerOnAudio);
+            autoOptions.thresholdDb = xml->getDoubleAttribute ("autoRecordThresholdDb", autoOptions.thresholdDb);
+            autoOptions.idleSeconds = xml->getDoubleAttribute ("autoRecordIdleSeconds", autoOptions.idleSeconds);
+            autoOptions.rearm = xml->getBoolAttribute ("autoRecordRearm", autoOptions.rearm);
+            setAutoRecord (autoOptions);
+            
+            setMidiTicksPerQuarterNote (xml->getIntAttribute ("midiTicksPerQuarterNote", 96));
+            setMidiTempo (xml->getDoubleAttribute ("midiTempo", 120.0));
+            setFollowHostTempo (xml->getBoolAttribute ("followHostTempo", true));
+        }
+    }
 }
 
 //==============================================================================
@@ -9,11 +9,30 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "AudioRecorder.h"
+#include "DirectFileOutputStream.h"
+#include "LevelMonitor.h"
+#include "MappedFileOutputStream.h"
+#include "MemoryTakeStore.h"
+#include "MidiRecorder.h"
+#include "ParallelEncodingWriter.h"
+#include "PeakOverview.h"
+#include "RecordingGroup.h"
+#include "RecordingIOService.h"
+#include "RecorderMetrics.h"
+#include "SeekIndex.h"
+#include "SegmentedRecordingWriter.h"
+#include "SilenceGateWriter.h"
+#include "TakePlayer.h"
+#include "TakePreparer.h"
+#include "WavRecordingWriter.h"
 
 //==============================================================================
 /**
 */
-class AudioMidiRecorderPluginProcessor  : public juce::AudioProcessor
+class AudioMidiRecorderPluginProcessor  : public juce::AudioProcessor,
+                                          private RecordingGroup::Member,
+                                          private Timer
 {
 public:
     //==============================================================================
@@ -52,31 +71,366 @@ public:
     //==============================================================================
     void getStateInformation (juce::MemoryBlock& destData) override;
     void setStateInformation (const void* data, int sizeInBytes) override;
+    
+    void updateTrackProperties (const TrackProperties& properties) override;
 
     //==============================================================================
     // Audio and Midi Recording
+    // Starts (or stops) both takes together, so the audio and midi begin on the same sample
+    void startRecording (const File& audioFile, const File& midiFile);
+    void stopRecording();
+    
     void startRecordingAudio (const File& audioFile);
     void stopRecordingAudio ();
     void startRecordingMidi (const File& midiFile);
     void stopRecordingMidi ();
     
+    // True while a take is running (which in a recording group may have been started by another instance)
+    // or armed
+    bool isRecording() const                                                    { return recordingAudio || recordingMidi; }
+    
+    // Auto-record: armRecording queues the takes, but the audio thread only starts them on the first
+    // note-on and/or the first sample over the threshold - on that exact sample, with the lookback
+    // (setLookbackSeconds) as the pre-roll. The files are always opened by the take preparer, so if
+    // they aren't ready yet the takes are queued once they are. Once nothing has happened for the
+    // idle time the takes stop, and (with rearm) the next ones are armed. stopRecording disarms.
+    // Not available in a recording group.
+    struct AutoRecordOptions
+    {
+        bool enabled = false;               // (only used by the editor, to decide what Record does)
+        bool triggerOnMidi = true;
+        bool triggerOnAudio = false;
+        double thresholdDb = -40.0;         // sample peak
+        double idleSeconds = 10.0;
+        bool rearm = true;
+    };
+    
+    bool armRecording (const File& audioFile, const File& midiFile);
+    bool isArmed() const                                                        { return armedTakes.load() != 0 || armPending; }
+    void setAutoRecord (const AutoRecordOptions& options);
+    AutoRecordOptions getAutoRecord() const                                     { return autoRecord; }
+    
+    // The next free take name in the recording directory (recording.wav, recording (2).wav, ...).
+    // Each name is only handed out once per process, so instances never share one.
+    static File getNextTakeFile();
+    
+    // Pre-armed takes: the next take's files (getNextRecordingFile and its ".mid") are opened in
+    // the background while nothing is recording, so starting a take on them only hands the writers
+    // to the recorders. Another is prepared as soon as each take starts. If the recording options
+    // have changed since, the prepared files are deleted and opened again. Not used for groups.
+    void setPrearmTakes (bool shouldPrearm);
+    bool isPrearmingTakes() const                                               { return prearmTakes; }
+    
+    // The file Record should use next (the prepared take's, if there is one)
+    File getNextRecordingFile() const;
+    
+    // Recording to memory: takes are kept in RAM (the audio FLAC-compressed on the writer thread,
+    // the midi as a standard midi file), so nothing goes to disk unless a take is committed. The
+    // limit covers every take in the store: the oldest finished takes are evicted to make room, and
+    // a take is only cut short if it doesn't fit on its own. Segments,
+    // the silence gate and overviews don't apply. Not used for recording groups.
+    void setRecordToMemory (bool shouldRecordToMemory);
+    bool isRecordingToMemory() const                                            { return recordToMemory; }
+    void setMemoryLimitMegabytes (int megabytes)                                { memoryTakes.setMemoryLimit ((int64) jmax (1, megabytes) * 1024 * 1024); }
+    int getMemoryLimitMegabytes() const                                         { return (int) (memoryTakes.getMemoryLimit() / (1024 * 1024)); }
+    MemoryTakeStore& getMemoryTakes()                                           { return memoryTakes; }
+    
+    // Saves a finished memory take (to .wav, .ogg or .flac with the current recording options, and
+    // a .mid). Takes as long as writing the files.
+    bool commitMemoryTake (const MemoryTake& take, const File& audioFile, const File& midiFile);
+    
+    // Playback: plays a take into the output, on top of the input, and its midi into the midi output
+    // on the samples it was recorded on. The files are streamed from disk on the writer threads,
+    // through a read-ahead buffer kept the prefetch time ahead, so the audio thread never waits for
+    // the disk (see TakePlayer). A take that's still being finished off on the writer thread starts
+    // playing once it's done, without waiting here. Plays a .wav, .ogg or .flac file, or a compressed
+    // take's per-channel-group files side by side: segments and silence-gated parts aren't joined
+    // back up.
+    bool playTake (const File& audioFile, const File& midiFile);
+    bool playLastTake();
+    void stopPlayback()                                                         { playPending = false; player.stop(); }
+    bool isPlaying() const                                                      { return playPending || player.isPlaying(); }
+    TakePlayer::Stats getPlaybackStats() const                                  { return player.getStats(); }
+    
+    // Overdub: plays the last take and records a new one alongside it, starting on the same sample
+    // (the audio thread starts the new takes on the block the playback starts on). stopRecording
+    // stops both. Not available in a recording group.
+    bool overdub (const File& audioFile, const File& midiFile);
+    
+    // How far ahead of the audio thread playback reads. The buffer is allocated in prepareToPlay,
+    // so changes apply from then.
+    void setPlaybackPrefetchSeconds (double seconds)                            { playbackPrefetchSeconds = jlimit (0.1, 30.0, seconds); }
+    double getPlaybackPrefetchSeconds() const                                   { return playbackPrefetchSeconds; }
+    
+    // Instances with the same group ID (empty for none) record together: starting or stopping a take
+    // on any of them does it on all of them, into one multichannel audio file (their channels side by
+    // side, listed in recording.channels.txt) and one midi file with a track each
+    void setRecordingGroup (const String& groupId);
+    String getRecordingGroup() const;
+    
+    // Midi files are written with this many ticks per quarter note, at the host's tempo (with a tempo
+    // event whenever it changes) or, if the host doesn't give one or following it is off, a fixed tempo.
+    // Ticks are worked out on the writer thread from the sample clock, so they never drift.
+    void setMidiTicksPerQuarterNote (int ppq)                                   { midiTicksPerQuarterNote = jlimit (24, 960, ppq); }
+    int getMidiTicksPerQuarterNote() const                                      { return midiTicksPerQuarterNote; }
+    void setMidiTempo (double bpm);
+    double getMidiTempo() const                                                 { return midiTempo; }
+    void setFollowHostTempo (bool shouldFollow)                                 { followHostTempo = shouldFollow; }
+    bool isFollowingHostTempo() const                                           { return followHostTempo.load(); }
+    
+    // Stopping returns straight away: the writer thread flushes and closes the files afterwards.
+    // This is true until it has finished with every take that's been stopped.
+    bool isFinalizing() const;
+    
+    // Recording Status (lock-free, safe to poll from any thread)
+    int64 getNumDroppedSamples() const                                          { return metrics.getSnapshot().droppedSamples; }
+    int64 getNumDroppedMidiEvents() const                                       { return metrics.getSnapshot().droppedMidiEvents; }
+    RecorderMetrics::Snapshot getMetrics() const                                { return metrics.getSnapshot(); }
+    
+    // Live input levels and waveform, for the editor
+    const LevelMonitor& getLevelMonitor() const                                 { return levelMonitor; }
+    void resetMetrics()                                                         { metrics.reset(); }
+    
+    // Writer FIFO (how much audio the ring holds while the disk stalls). The ring is sized for
+    // at least this long, and grows between takes to cover the worst write stall measured.
+    void setFifoLatencySeconds (double seconds)                                 { fifoLatencySeconds = jlimit (0.1, 10.0, seconds); }
+    double getFifoLatencySeconds() const                                        { return fifoLatencySeconds; }
+    
+    // Rolling recording: each take is split into files of this many seconds and/or megabytes
+    // (0 for no limit; recording-001.wav, recording-002.wav, ...). Applies from the next take.
+    void setSegmentSeconds (double seconds)                                     { segmentSeconds = jlimit (0.0, 24.0 * 3600.0, seconds); }
+    double getSegmentSeconds() const                                            { return segmentSeconds; }
+    void setSegmentMegabytes (int megabytes)                                    { segmentMegabytes = jlimit (0, 1 << 20, megabytes); }
+    int getSegmentMegabytes() const                                             { return segmentMegabytes; }
+    
+    // How often the open audio file gets a valid header, so a crash doesn't lose the take (0 to disable)
+    void setHeaderCommitSeconds (double seconds);
+    double getHeaderCommitSeconds() const                                       { return headerCommitSeconds; }
+    
+    // Appends the metrics to a CSV in the recording directory every few seconds (0 to disable)
+    void setMetricsLogInterval (int seconds);
+    int getMetricsLogInterval() const                                           { return metricsLogInterval; }
+    
+    // Where the editor puts new takes (and the metrics log goes)
+    static File getRecordingDirectory();
+    
+    // Segments are named after the take: recording-001.wav, recording-002.wav, ...
+    static File getSegmentFile (const File& takeFile, int segmentIndex);
+    
+    // ...and the silence gate's stretches, when they're split: recording-part001.wav, ...
+    static File getStretchFile (const File& takeFile, int stretchIndex);
+    
+    // Recording Options (applied from the next take, saved with the plugin state)
+    void setRecordingFormat (WavRecordingWriter::SampleFormat newFormat)        { recordingFormat = newFormat; }
+    WavRecordingWriter::SampleFormat getRecordingFormat() const                 { return recordingFormat; }
+    void setDitherMode (SampleConversion::Ditherer::Mode newMode)               { ditherMode = newMode; }
+    SampleConversion::Ditherer::Mode getDitherMode() const                      { return ditherMode; }
+    
+    // How .wav takes reach the disk: through a FileOutputStream, a DirectFileOutputStream that
+    // preallocates the file and writes aligned blocks (optionally bypassing the page cache), or
+    // a MappedFileOutputStream that the samples are converted straight into
+    enum class WavOutputMode
+    {
+        buffered = 0,
+        preallocated,
+        directIO,
+        memoryMapped
+    };
+    
+    void setWavOutputMode (WavOutputMode newMode)                               { wavOutputMode = newMode; }
+    WavOutputMode getWavOutputMode() const                                      { return wavOutputMode; }
+    
+    // Compressed takes (.ogg, .flac) are encoded on a pool of worker threads, in groups of this
+    // many channels. Each group gets its own file (recording-ch01-02.ogg, ...) unless the take
+    // fits in one group. FLAC groups are limited to 8 channels.
+    void setChannelsPerEncoder (int numChannels)                                { channelsPerEncoder = jlimit (1, 32, numChannels); }
+    int getChannelsPerEncoder() const                                           { return channelsPerEncoder; }
+    
+    // Everything needed to open a take's writer, copied so it can be used on the writer thread
+    struct AudioWriterSettings
+    {
+        double sampleRate = 44100.0;
+        int numChannels = 2;
+        WavRecordingWriter::SampleFormat format = WavRecordingWriter::SampleFormat::int16;
+        SampleConversion::Ditherer::Mode dither = SampleConversion::Ditherer::Mode::none;
+        WavOutputMode outputMode = WavOutputMode::buffered;
+        ThreadPool* encoderPool = nullptr;      // compressed formats are encoded here (if not null)
+        int channelsPerEncoder = 2;
+        bool writeOverview = true;              // save a PeakOverview next to the file
+        bool writeSeekIndex = true;             // save a SeekIndex next to the file (.wav and .ogg)
+    };
+    
+    // Opens a writer for one audio file (.wav, .ogg or .flac), or returns nullptr. Safe to call on
+    // any thread - it's also used on the writer thread to open each new segment.
+    static std::unique_ptr<RecordingWriter> createAudioWriter (const File& audioFile, const AudioWriterSettings& settings);
+    
+    // Silence gate: stretches of the take quieter than the threshold for longer than the hold time
+    // aren't written (apart from a pre-roll before each sound). The kept audio goes into one file,
+    // or a file per stretch, and "recording.wav.timeline" lists where each stretch sits in the take,
+    // which is the timeline the midi file follows. The midi isn't cut, so takes aren't segmented
+    // while the gate is on. Applies from the next take; not used for groups.
+    void setSilenceGate (const SilenceGateWriter::Options& options);
+    SilenceGateWriter::Options getSilenceGate() const                           { return silenceGate; }
+    
+    // Waveform overviews (min/max/RMS at several zoom levels) are built while each audio file is
+    // written and saved next to it as "recording.wav.peaks", so they're ready as soon as it's
+    // finished (see PeakOverview)
+    void setWriteOverviews (bool shouldWrite)                                   { writeOverviews = shouldWrite; }
+    bool isWritingOverviews() const                                             { return writeOverviews; }
+    
+    // Seek indexes map sample positions to byte offsets in each .wav, .ogg and .mid file, and are
+    // saved next to it as "recording.wav.seek", so a reader can jump to any point of a long take
+    // without scanning it (see SeekIndex). FLAC files aren't indexed.
+    void setWriteSeekIndexes (bool shouldWrite)                                 { writeSeekIndexes = shouldWrite; }
+    bool isWritingSeekIndexes() const                                           { return writeSeekIndexes; }
+    
+    // Lookback (how much audio and midi from before Record is put at the start of each take,
+    // 0 to disable). The history is allocated in prepareToPlay, so changes apply from then.
+    void setLookbackSeconds (double seconds)                                    { lookbackSeconds = jlimit (0.0, 600.0, seconds); }
+    double getLookbackSeconds() const                                           { return lookbackSeconds; }
+    
+    // The writer threads shared by all the instances in this process (see RecordingIOService)
+    RecordingIOService& getIOService()                                          { return *ioService; }
+    
 private:
-    double mSampleRate;
+    void recordBlock (const AudioBuffer<float>& buffer, const MidiBuffer& midiMessages, int startSample, int numSamples,
+                      uint64 takes, double tempo, TimelinePosition timelinePosition) noexcept;
+    int updateAutoRecord (const AudioBuffer<float>& buffer, const MidiBuffer& midiMessages, uint64& takes) noexcept;
+    void timerCallback() override;
+    static std::unique_ptr<RecordingWriter> openAudioWriter (const File& audioFile, const AudioWriterSettings& settings);
+    
+    // Everything a take's writers are opened with, so they can be opened on another thread
+    struct TakeSettings
+    {
+        AudioWriterSettings audio;
+        int64 segmentLength = 0;
+        SilenceGateWriter::Options silenceGate;
+        int midiTicksPerQuarterNote = 96;
+        
+        String toString() const;    // (to tell whether a prepared take is still up to date)
+    };
+    
+    TakeSettings getTakeSettings (const File& audioFile);
+    static std::unique_ptr<RecordingWriter> openAudioTakeWriter (const File& audioFile, const TakeSettings& settings);
+    static std::unique_ptr<MidiFileStreamWriter> openMidiTakeWriter (const File& file, int ticksPerQuarterNote,
+                                                                     double sampleRate, bool writeSeekIndex);
+    void startMidiTake (const File& midiFile, std::unique_ptr<MidiFileStreamWriter> firstWriter, int64 segmentLength);
+    void startMemoryTake (const File& audioFile, const File& midiFile);
+    void prepareNextTake();
+    void prepareTake (const File& audioFile, const File& midiFile, bool replacePrepared);
+    void startTake (const File& audioFile, const File& midiFile, std::unique_ptr<TakePreparer::Take> prepared);
+    void armPreparedTake();
+    void startPendingPlayback();
+    std::unique_ptr<TakePreparer::Take> claimPreparedTake (const File& audioFile, const File& midiFile);
+    void discardPreparedTake();
+    static void discardTake (std::unique_ptr<TakePreparer::Take> take);
+    static void deleteTakeFiles (const File& audioFile, const File& midiFile);
+    void deleteDisarmedTake();
+    void deferTakeRequests (bool shouldDefer);
+    void publishRequestedTakes();
+    void startAudioTake (const File& audioFile, std::unique_ptr<RecordingWriter> audioWriter);
+    void stopAudioTake();
+    void stopMidiTake();
+    
+    // RecordingGroup::Member
+    int getNumGroupChannels() const override;
+    String getGroupMemberName() const override;
+    void startGroupAudioTake (const File& audioFile, std::unique_ptr<RecordingWriter> writer) override;
+    void startGroupMidiTake (const File& midiFile, std::unique_ptr<MidiFileStreamWriter> writer) override;
+    void stopGroupAudioTake() override;
+    void stopGroupMidiTake() override;
+    void deferGroupTakeRequests (bool shouldDefer) override;
+    
+    int calculateFifoSize (int numChannels) const;
+    void updateWriteBatchSize();
+    int64 calculateSegmentLength() const;
+    
+    double mSampleRate = 44100.0;
+    int mBlockSize = 0;
+    
+    // Sample clock: advanced once per block by the audio thread, and shared by both recorders
+    int64 samplePosition = 0;
+    
+    // The audio and midi takes the audio thread should feed, packed into one atomic so it always
+    // sees a pair that was requested together (see publishRequestedTakes)
+    std::atomic<uint64> requestedTakes { 0 };
+    int takeRequestsDeferred = 0;
+    HeapBlock<const float*> inputPointers;
+    int numInputPointers = 0;
+    
+    // Auto-record: armed takes wait here for the audio thread to trigger them
+    std::atomic<uint64> armedTakes { 0 };
+    bool armingTakes = false;
+    bool armPending = false;                // (waiting for the take preparer to open armFiles)
+    File armAudioFile, armMidiFile;
+    Array<File> disarmedTakeFiles;          // (audio, midi, ... - deleted once the writer thread has closed them)
+    AutoRecordOptions autoRecord;
+    std::atomic<bool> autoRecordOnMidi { true }, autoRecordOnAudio { false }, autoRecordStopped { false };
+    std::atomic<float> autoRecordThreshold { 0.01f };
+    std::atomic<int64> autoRecordIdleSamples { 0 };
+    uint64 autoRecordedTakes = 0;           // (audio thread only)
+    int64 lastActivityPosition = 0;
+    
+    // Writer threads shared with every other instance (declared first, so it's released last)
+    SharedResourcePointer<RecordingIOService> ioService;
+    
+    // Recording group (see setRecordingGroup)
+    SharedResourcePointer<RecordingGroup::Registry> groupRegistry;
+    RecordingGroup::Ptr recordingGroup;
+    CriticalSection trackNameLock;
+    String trackName;
+    
+    // Telemetry (updated by the audio and writer threads, read by the editor)
+    RecorderMetrics metrics;
+    RecorderMetricsLogger metricsLogger { metrics };
+    int metricsLogInterval = 0;
+    
+    // Input levels for the editor (written by the audio thread, copied out by the editor)
+    LevelMonitor levelMonitor;
+    
+    // Takes recorded to memory (declared before the recorders, so it outlives their writers)
+    MemoryTakeStore memoryTakes;
+    bool recordToMemory = false;
     
     // Midi Recording
     bool recordingMidi;
-    double recordingTime;
-    std::unique_ptr<FileOutputStream> midiStream;
-    MidiFile midiRecordingFile;
-    MidiMessageSequence midiSequence;
+    int lastMidiTake = 0;
+    int midiTicksPerQuarterNote = 96;
+    double midiTempo = 120.0;
+    std::atomic<bool> followHostTempo { true };
+    std::atomic<double> hostTempo { 0.0 };
+    MidiRecorder midiRecorder { metrics };
     
     // Audio Recording
     bool recordingAudio;
-    TimeSliceThread writeThread;
-    std::unique_ptr<AudioFormatWriter::ThreadedWriter> threadedWriter;
-    CriticalSection writerLock;
-    std::atomic<AudioFormatWriter::ThreadedWriter*> activeWriter { nullptr };
-
+    int lastAudioTake = 0;
+    SharedResourcePointer<ParallelEncodingWriter::SharedPool> encoderPool;    // (shared by every instance, outlives the recorder's writers)
+    AudioRecorder audioRecorder { metrics };
+    WavRecordingWriter::SampleFormat recordingFormat = WavRecordingWriter::SampleFormat::int16;
+    SampleConversion::Ditherer::Mode ditherMode = SampleConversion::Ditherer::Mode::triangular;
+    WavOutputMode wavOutputMode = WavOutputMode::buffered;
+    double lookbackSeconds = 0.0;
+    double fifoLatencySeconds = 0.5;
+    int64 droppedSamplesAtLastResize = 0;
+    double segmentSeconds = 0.0, headerCommitSeconds = 5.0;
+    int segmentMegabytes = 0;
+    int channelsPerEncoder = 2;
+    bool writeOverviews = true;
+    bool writeSeekIndexes = true;
+    SilenceGateWriter::Options silenceGate;
+    
+    // The next take, opened in the background (see setPrearmTakes)
+    TakePreparer preparer;
+    bool prearmTakes = true;
+    
+    // Playback, and overdub takes waiting for it to start
+    TakePlayer player;
+    double playbackPrefetchSeconds = 2.0;
+    std::atomic<uint64> overdubTakes { 0 };
+    bool queueingOverdub = false, overdubbing = false;
+    bool playPending = false;               // (waiting for the last take to be finished off)
+    File playAudioFile, playMidiFile;
+    File takeAudioFile, takeMidiFile, lastTakeAudioFile, lastTakeMidiFile;
     
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioMidiRecorderPluginProcessor)
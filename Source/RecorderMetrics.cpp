@@ -0,0 +1,196 @@
+/*
+  ==============================================================================
+
+    This file contains the lock-free telemetry shared by the recorder's threads.
+
+  ==============================================================================
+*/
+
+#include "RecorderMetrics.h"
+
+//==============================================================================
+RecorderMetrics::RecorderMetrics()
+{
+    reset();
+}
+
+void RecorderMetrics::reset() noexcept
+{
+    for (auto& bucket : callbackHistogram)
+        bucket = 0;
+
+    maxCallbackMicroseconds = 0;
+    fifoHighWater = 0;
+    droppedSamples = 0;
+    droppedMidiEvents = 0;
+    bytesWritten = 0;
+    writerLag = 0;
+    maxWriterLag = 0;
+    maxWriteMicroseconds = 0;
+}
+
+void RecorderMetrics::updateMaximum (std::atomic<int>& value, int newValue) noexcept
+{
+    auto current = value.load();
+
+    while (newValue > current && ! value.compare_exchange_weak (current, newValue))
+    {}
+}
+
+//==============================================================================
+void RecorderMetrics::addCallbackDuration (double microseconds) noexcept
+{
+    auto us = (uint32) jmax (0.0, microseconds);
+    int bucket = 0;
+
+    while (us != 0 && bucket < numHistogramBuckets - 1)
+    {
+        us >>= 1;
+        ++bucket;
+    }
+
+    ++callbackHistogram[(size_t) bucket];
+    updateMaximum (maxCallbackMicroseconds, (int) microseconds);
+}
+
+void RecorderMetrics::updateFifoLevel (int numSamplesQueued) noexcept
+{
+    updateMaximum (fifoHighWater, numSamplesQueued);
+}
+
+void RecorderMetrics::updateWriterLag (int numSamplesBehind) noexcept
+{
+    writerLag = numSamplesBehind;
+    updateMaximum (maxWriterLag, numSamplesBehind);
+}
+
+void RecorderMetrics::addWriteDuration (double seconds) noexcept
+{
+    updateMaximum (maxWriteMicroseconds, (int) (seconds * 1.0e6));
+}
+
+void RecorderMetrics::setFifoCapacity (int numSamples, double newSampleRate) noexcept
+{
+    fifoCapacity = jmax (1, numSamples);
+    fifoHighWater = 0;
+    sampleRate = newSampleRate;
+}
+
+//==============================================================================
+double RecorderMetrics::getHistogramPercentile (double proportion, int64 total) const noexcept
+{
+    auto target = (int64) (proportion * (double) total);
+    int64 count = 0;
+
+    for (int i = 0; i < numHistogramBuckets; ++i)
+    {
+        count += callbackHistogram[(size_t) i].load();
+
+        // (reports the top of the bucket)
+        if (count > target)
+            return (double) (1 << i);
+    }
+
+    return (double) maxCallbackMicroseconds.load();
+}
+
+RecorderMetrics::Snapshot RecorderMetrics::getSnapshot() const noexcept
+{
+    Snapshot s;
+
+    for (auto& bucket : callbackHistogram)
+        s.numCallbacks += bucket.load();
+
+    s.callbackP50 = getHistogramPercentile (0.5, s.numCallbacks);
+    s.callbackP99 = getHistogramPercentile (0.99, s.numCallbacks);
+    s.callbackMax = maxCallbackMicroseconds.load();
+
+    s.fifoHighWater = fifoHighWater.load() / (double) fifoCapacity.load();
+    s.droppedSamples = droppedSamples.load();
+    s.droppedMidiEvents = droppedMidiEvents.load();
+    s.bytesWritten = bytesWritten.load();
+
+    auto msPerSample = 1000.0 / sampleRate.load();
+    s.writerLagMs = writerLag.load() * msPerSample;
+    s.maxWriterLagMs = maxWriterLag.load() * msPerSample;
+    s.maxWriteMs = maxWriteMicroseconds.load() / 1000.0;
+    s.fifoCapacityMs = fifoCapacity.load() * msPerSample;
+
+    return s;
+}
+
+String RecorderMetrics::Snapshot::getCsvHeader()
+{
+    return "time,callbacks,callback_p50_us,callback_p99_us,callback_max_us,fifo_high_water,"
+           "dropped_samples,dropped_midi_events,bytes_written,writer_lag_ms,max_writer_lag_ms,max_write_ms";
+}
+
+String RecorderMetrics::Snapshot::toCsvLine() const
+{
+    StringArray fields;
+    fields.add (Time::getCurrentTime().toISO8601 (true));
+    fields.add (String (numCallbacks));
+    fields.add (String (callbackP50));
+    fields.add (String (callbackP99));
+    fields.add (String (callbackMax));
+    fields.add (String (fifoHighWater, 3));
+    fields.add (String (droppedSamples));
+    fields.add (String (droppedMidiEvents));
+    fields.add (String (bytesWritten));
+    fields.add (String (writerLagMs, 2));
+    fields.add (String (maxWriterLagMs, 2));
+    fields.add (String (maxWriteMs, 2));
+
+    return fields.joinIntoString (",");
+}
+
+//==============================================================================
+// (random rather than counted, since instances in other processes can share the file too)
+RecorderMetricsLogger::RecorderMetricsLogger (const RecorderMetrics& metricsToLog)
+    : metrics (metricsToLog),
+      instanceId (String::toHexString (Random::getSystemRandom().nextInt64()).paddedLeft ('0', 16))
+{
+}
+
+void RecorderMetricsLogger::setLogFile (const File& file, int intervalSeconds)
+{
+    const ScopedLock sl (lock);
+    logFile = file;
+    interval = jmax (0, intervalSeconds);
+
+    if (interval <= 0)
+        return;
+
+    auto header = "instance,track," + RecorderMetrics::Snapshot::getCsvHeader();
+
+    // A log from before the instance columns were added is kept, but not appended to
+    if (logFile.existsAsFile())
+    {
+        FileInputStream stream (logFile);
+
+        if (stream.openedOk() && stream.readNextLine() != header)
+            logFile.moveFileTo (logFile.getNonexistentSibling());
+    }
+
+    if (! logFile.existsAsFile())
+        logFile.appendText (header + "\n");
+}
+
+void RecorderMetricsLogger::setTrackName (const String& name)
+{
+    const ScopedLock sl (lock);
+    trackName = name;
+}
+
+int RecorderMetricsLogger::useTimeSlice()
+{
+    const ScopedLock sl (lock);
+
+    if (interval <= 0)
+        return 1000;
+
+    // (the track name is quoted, since it can contain commas)
+    logFile.appendText (instanceId + ",\"" + trackName.replace ("\"", "\"\"") + "\","
+                          + metrics.getSnapshot().toCsvLine() + "\n");
+    return interval * 1000;
+}
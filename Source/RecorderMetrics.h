@@ -0,0 +1,114 @@
+/*
+  ==============================================================================
+
+    This file contains the lock-free telemetry shared by the recorder's threads.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    Counters describing how close the recorder is to its real-time and I/O limits.
+
+    Every field is a lock-free atomic, so the audio thread and the writer thread
+    can update them while the editor (or the CSV logger) reads a snapshot.
+*/
+class RecorderMetrics
+{
+public:
+    //==============================================================================
+    RecorderMetrics();
+
+    /** Clears all the counters. */
+    void reset() noexcept;
+
+    //==============================================================================
+    // Audio thread
+    void addCallbackDuration (double microseconds) noexcept;
+    void updateFifoLevel (int numSamplesQueued) noexcept;
+    void addDroppedSamples (int64 num) noexcept         { droppedSamples += num; }
+    void addDroppedMidiEvent() noexcept                 { ++droppedMidiEvents; }
+
+    // Writer thread
+    void addBytesWritten (int64 num) noexcept           { bytesWritten += num; }
+    void updateWriterLag (int numSamplesBehind) noexcept;
+    void addWriteDuration (double seconds) noexcept;
+
+    // Set when the ring is (re)allocated
+    void setFifoCapacity (int numSamples, double sampleRate) noexcept;
+
+    //==============================================================================
+    struct Snapshot
+    {
+        double callbackP50 = 0, callbackP99 = 0, callbackMax = 0;  // microseconds
+        int64 numCallbacks = 0;
+        double fifoHighWater = 0;                                   // proportion of the ring
+        double fifoCapacityMs = 0;
+        int64 droppedSamples = 0, droppedMidiEvents = 0, bytesWritten = 0;
+        double writerLagMs = 0, maxWriterLagMs = 0;
+        double maxWriteMs = 0;                                      // longest single write to disk
+
+        static String getCsvHeader();
+        String toCsvLine() const;
+    };
+
+    Snapshot getSnapshot() const noexcept;
+
+    //==============================================================================
+    // Bucket i counts callbacks taking [2^(i-1), 2^i) microseconds (bucket 0 is < 1us)
+    static constexpr int numHistogramBuckets = 20;
+
+private:
+    static void updateMaximum (std::atomic<int>& value, int newValue) noexcept;
+    double getHistogramPercentile (double proportion, int64 total) const noexcept;
+
+    std::array<std::atomic<uint32>, numHistogramBuckets> callbackHistogram;
+    std::atomic<int> maxCallbackMicroseconds { 0 };
+
+    std::atomic<int> fifoHighWater { 0 }, fifoCapacity { 1 };
+    std::atomic<int64> droppedSamples { 0 }, droppedMidiEvents { 0 }, bytesWritten { 0 };
+    std::atomic<int> writerLag { 0 }, maxWriterLag { 0 };
+    std::atomic<int> maxWriteMicroseconds { 0 };
+    std::atomic<double> sampleRate { 44100.0 };
+
+    JUCE_DECLARE_NON_COPYABLE (RecorderMetrics)
+};
+
+//==============================================================================
+/**
+    Appends a line of RecorderMetrics to a CSV file at a fixed interval, from the
+    writer thread.
+
+    Every instance in a session logs to the same file, so each line starts with
+    an ID that's unique to the logger, and the track it's on.
+*/
+class RecorderMetricsLogger  : public TimeSliceClient
+{
+public:
+    RecorderMetricsLogger (const RecorderMetrics& metricsToLog);
+
+    /** Starts logging to the given file (0 seconds stops logging). */
+    void setLogFile (const File& file, int intervalSeconds);
+
+    /** The track name to log (it can change at any time). */
+    void setTrackName (const String& name);
+
+    const String& getInstanceId() const noexcept            { return instanceId; }
+
+    int useTimeSlice() override;
+
+private:
+    const RecorderMetrics& metrics;
+    const String instanceId;
+
+    CriticalSection lock;
+    File logFile;
+    int interval = 0;
+    String trackName;
+
+    JUCE_DECLARE_NON_COPYABLE (RecorderMetricsLogger)
+};
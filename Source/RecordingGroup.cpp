@@ -0,0 +1,603 @@
+/*
+  ==============================================================================
+
+    This file contains the group takes that let several instances of the
+    recorder share one multichannel file and one multi-track midi file.
+
+  ==============================================================================
+*/
+
+#include "RecordingGroup.h"
+
+//==============================================================================
+/** Where each member's take starts in the shared audio file, for lining up the midi tracks. */
+struct RecordingGroup::Timeline
+{
+    CriticalSection lock;
+    Array<Member*> members;
+    Array<int64> startOffsets;      // samples into the file (0 until known)
+    double sampleRate = 44100.0;
+};
+
+//==============================================================================
+/**
+    The shared audio file. Members copy their channels into a staging ring indexed
+    by timeline position; whatever every member has delivered goes to the file.
+    The members' writer threads may be different, so everything is under a lock.
+*/
+class RecordingGroup::AudioTake
+{
+public:
+    AudioTake (std::unique_ptr<RecordingWriter> w, const Array<int>& memberChannels, int nominalBlockSize,
+               double rate, std::shared_ptr<Timeline> memberTimeline)
+        : writer (std::move (w)),
+          timeline (std::move (memberTimeline)),
+          blockSize (jmax (1, nominalBlockSize)),
+          maxSkew ((int64) rate)
+    {
+        for (auto numChannels : memberChannels)
+        {
+            MemberState m;
+            m.firstChannel = totalChannels;
+            m.numChannels = numChannels;
+            members.add (m);
+            totalChannels += numChannels;
+        }
+
+        // A couple of seconds, so one member's writer thread can stall without the others
+        // having to give up on it
+        stagingSize = nextPowerOfTwo (jmax (65536, (int) (2.0 * rate)));
+        staging.setSize (totalChannels, stagingSize);
+        staging.clear();
+        writePointers.malloc ((size_t) jmax (1, totalChannels));
+    }
+
+    ~AudioTake()
+    {
+        const ScopedLock sl (lock);
+
+        for (auto& m : members)
+            m.finished = true;
+
+        writeReady();
+        writer.reset();
+    }
+
+    //==============================================================================
+    void startMember (int index, TimelinePosition position)
+    {
+        const ScopedLock sl (lock);
+        startMemberLocked (index, position);
+        writeReady();
+    }
+
+    bool write (int index, const float* const* channels, int numSamples)
+    {
+        const ScopedLock sl (lock);
+        auto& m = members.getReference (index);
+
+        if (! m.started)
+            startMemberLocked (index, {});
+
+        // Nobody can get a whole staging ring ahead of the file: if a member stalls (or stops
+        // being called), its channels go out as silence and it loses what arrives too late
+        auto end = m.position + numSamples;
+
+        if (end - getLowestPosition() > stagingSize)
+        {
+            if (! originFixed)
+                fixOrigin();
+
+            writeOut (end - stagingSize);
+        }
+
+        auto skip = originFixed ? (int) jlimit ((int64) 0, (int64) numSamples, flushed - m.position) : 0;
+
+        for (auto done = skip; done < numSamples;)
+        {
+            auto ringIndex = (int) ((m.position + done) & (stagingSize - 1));
+            auto num = jmin (numSamples - done, stagingSize - ringIndex);
+
+            for (int ch = 0; ch < m.numChannels; ++ch)
+                staging.copyFrom (m.firstChannel + ch, ringIndex, channels[ch] + done, num);
+
+            done += num;
+        }
+
+        m.position = end;
+        writeReady();
+        return ok;
+    }
+
+    void finishMember (int index)
+    {
+        const ScopedLock sl (lock);
+        members.getReference (index).finished = true;
+        writeReady();
+    }
+
+    bool commit()
+    {
+        // (every member's recorder asks, so the header is only rewritten once a second)
+        const ScopedLock sl (lock);
+        auto now = Time::getMillisecondCounter();
+
+        if (writer == nullptr || now - lastCommitTime < 1000)
+            return ok;
+
+        lastCommitTime = now;
+        return writer->commit();
+    }
+
+    /** The member's share of the file, so the instances' telemetry adds up to its size. */
+    int64 getNumBytesWritten (int index) const
+    {
+        const ScopedLock sl (lock);
+
+        if (writer == nullptr || totalChannels == 0)
+            return 0;
+
+        return writer->getNumBytesWritten() * members.getReference (index).numChannels / totalChannels;
+    }
+
+private:
+    //==============================================================================
+    struct MemberState
+    {
+        int firstChannel = 0, numChannels = 0;
+        int64 start = 0, position = 0;     // timeline positions
+        bool started = false, finished = false;
+    };
+
+    void startMemberLocked (int index, TimelinePosition position)
+    {
+        auto& m = members.getReference (index);
+
+        if (m.started)
+            return;
+
+        auto start = position.samples;
+        const MemberState* first = nullptr;
+
+        for (auto& other : members)
+            if (other.started && (first == nullptr || other.start < first->start))
+                first = &other;
+
+        if (first != nullptr)
+        {
+            // Members pick the take up within a few callbacks of each other, so anything further
+            // out is on a different clock (e.g. one saw the host playing and another didn't)
+            if (std::abs (start - first->start) > maxSkew)
+                start = first->start;
+
+            // The wall clock is only good to about a block, and members called in the same
+            // cycle really started a whole number of blocks apart
+            else if (! position.fromHost)
+                start = first->start + blockSize * (int64) std::llround ((double) (start - first->start) / blockSize);
+        }
+
+        m.start = m.position = start;
+        m.started = true;
+
+        if (originFixed)
+            publishOffset (index);
+    }
+
+    int64 getLowestPosition() const
+    {
+        if (originFixed)
+            return flushed;
+
+        auto lowest = std::numeric_limits<int64>::max();
+
+        for (auto& m : members)
+            if (m.started)
+                lowest = jmin (lowest, m.start);
+
+        return lowest;
+    }
+
+    /** The file starts where the earliest member started. */
+    void fixOrigin()
+    {
+        flushed = getLowestPosition();
+        originFixed = true;
+
+        for (int i = 0; i < members.size(); ++i)
+            if (members.getReference (i).started)
+                publishOffset (i);
+    }
+
+    void publishOffset (int index)
+    {
+        const ScopedLock sl (timeline->lock);
+        timeline->startOffsets.set (index, jmax ((int64) 0, members.getReference (index).start - flushed));
+    }
+
+    /** Writes out everything every member that's still going has delivered. */
+    void writeReady()
+    {
+        if (! originFixed)
+        {
+            bool anyStarted = false;
+
+            for (auto& m : members)
+            {
+                if (! m.started && ! m.finished)
+                    return;
+
+                anyStarted = anyStarted || m.started;
+            }
+
+            if (! anyStarted)
+                return;
+
+            fixOrigin();
+        }
+
+        auto ready = std::numeric_limits<int64>::max();
+        auto furthest = flushed;
+
+        for (auto& m : members)
+        {
+            if (! m.started)
+                continue;
+
+            furthest = jmax (furthest, m.position);
+
+            if (! m.finished)
+                ready = jmin (ready, m.position);
+        }
+
+        // (once everyone has finished, the shorter takes are padded out to the longest)
+        writeOut (ready == std::numeric_limits<int64>::max() ? furthest : ready);
+    }
+
+    void writeOut (int64 endPosition)
+    {
+        while (flushed < endPosition)
+        {
+            auto index = (int) (flushed & (stagingSize - 1));
+            auto num = (int) jmin (endPosition - flushed, (int64) (stagingSize - index));
+
+            for (int ch = 0; ch < totalChannels; ++ch)
+                writePointers[ch] = staging.getReadPointer (ch, index);
+
+            if (writer != nullptr)
+                ok = writer->write (writePointers, num) && ok;
+
+            // (cleared, so a member that's behind or finished reads as silence next time round)
+            staging.clear (index, num);
+            flushed += num;
+        }
+    }
+
+    //==============================================================================
+    CriticalSection lock;
+    std::unique_ptr<RecordingWriter> writer;
+    std::shared_ptr<Timeline> timeline;
+    Array<MemberState> members;
+    int totalChannels = 0, blockSize;
+    int64 maxSkew;
+
+    AudioBuffer<float> staging;
+    int stagingSize = 0;
+    HeapBlock<const float*> writePointers;
+    int64 flushed = 0;
+    bool originFixed = false, ok = true;
+    uint32 lastCommitTime = 0;
+
+    JUCE_DECLARE_NON_COPYABLE (AudioTake)
+};
+
+//==============================================================================
+/** What each member's AudioRecorder writes its channels through. */
+class RecordingGroup::MemberAudioWriter  : public RecordingWriter
+{
+public:
+    MemberAudioWriter (std::shared_ptr<AudioTake> groupTake, int memberIndex, int channels)
+        : take (std::move (groupTake)), index (memberIndex), numChannels (channels)
+    {
+    }
+
+    ~MemberAudioWriter() override                                   { take->finishMember (index); }
+
+    bool write (const float* const* channels, int numSamples) override
+    {
+        return take->write (index, channels, numSamples);
+    }
+
+    bool commit() override                                          { return take->commit(); }
+    int getNumChannels() const override                             { return numChannels; }
+    int64 getNumBytesWritten() const override                       { return take->getNumBytesWritten (index); }
+    void setStartPosition (TimelinePosition position) override      { take->startMember (index, position); }
+
+private:
+    std::shared_ptr<AudioTake> take;
+    int index, numChannels;
+
+    JUCE_DECLARE_NON_COPYABLE (MemberAudioWriter)
+};
+
+//==============================================================================
+/**
+    The shared midi file. Each member streams its track into a file of its own
+    next to the take; once the last one is closed they're joined into a format 1
+    file, each track named after its member and shifted to where it started.
+*/
+class RecordingGroup::MidiTake
+{
+public:
+    MidiTake (const File& file, const StringArray& names, int ppq, double rate,
+              std::shared_ptr<Timeline> memberTimeline, const Array<Member*>& takeMembers)
+        : midiFile (file), trackNames (names), ticksPerQuarterNote (ppq), ticksPerSecond (rate),
+          timeline (std::move (memberTimeline)), members (takeMembers)
+    {
+    }
+
+    ~MidiTake()
+    {
+        midiFile.deleteFile();
+        FileOutputStream out (midiFile);
+
+        if (! out.openedOk())
+            return;
+
+        out.writeIntBigEndian ((int) ByteOrder::bigEndianInt ("MThd"));
+        out.writeIntBigEndian (6);
+        out.writeShortBigEndian (1);
+        out.writeShortBigEndian ((short) trackNames.size());
+        out.writeShortBigEndian ((short) ticksPerQuarterNote);
+
+        for (int i = 0; i < trackNames.size(); ++i)
+        {
+            auto trackFile = getTrackFile (midiFile, i);
+            MemoryBlock data;
+            trackFile.loadFileAsData (data);
+
+            // (the track's own MThd and MTrk headers are 22 bytes)
+            const int headerSize = 22;
+            auto* body = static_cast<const uint8*> (data.getData()) + headerSize;
+            auto bodySize = jmax (0, (int) data.getSize() - headerSize);
+
+            MemoryOutputStream track;
+            writeVariableLengthInt (track, 0);
+            track.writeByte ((char) 0xff);
+            track.writeByte ((char) 0x03);
+            writeVariableLengthInt (track, (uint32) trackNames[i].getNumBytesAsUTF8());
+            track.write (trackNames[i].toRawUTF8(), trackNames[i].getNumBytesAsUTF8());
+
+            // The first event's delta is moved along by where this member started in the audio
+            uint32 firstDelta = 0;
+            int numDeltaBytes = 0;
+
+            while (numDeltaBytes < bodySize && numDeltaBytes < 4)
+            {
+                auto byte = body[numDeltaBytes++];
+                firstDelta = (firstDelta << 7) | (uint32) (byte & 0x7f);
+
+                if ((byte & 0x80) == 0)
+                    break;
+            }
+
+            if (bodySize > 0)
+            {
+                writeVariableLengthInt (track, firstDelta + (uint32) getStartTicks (i));
+                track.write (body + numDeltaBytes, (size_t) (bodySize - numDeltaBytes));
+            }
+            else
+            {
+                const uint8 endOfTrack[] = { 0x00, 0xff, 0x2f, 0x00 };
+                track.write (endOfTrack, sizeof (endOfTrack));
+            }
+
+            out.writeIntBigEndian ((int) ByteOrder::bigEndianInt ("MTrk"));
+            out.writeIntBigEndian ((int) track.getDataSize());
+            out.write (track.getData(), track.getDataSize());
+
+            trackFile.deleteFile();
+        }
+    }
+
+private:
+    int64 getStartTicks (int trackIndex) const
+    {
+        const ScopedLock sl (timeline->lock);
+        auto index = timeline->members.indexOf (members[trackIndex]);
+
+        if (index < 0)
+            return 0;
+
+        return (int64) std::llround ((double) timeline->startOffsets[index] * ticksPerSecond / timeline->sampleRate);
+    }
+
+    static void writeVariableLengthInt (OutputStream& out, uint32 value)
+    {
+        auto buffer = (uint32) (value & 0x7f);
+
+        while ((value >>= 7) != 0)
+        {
+            buffer <<= 8;
+            buffer |= ((value & 0x7f) | 0x80);
+        }
+
+        for (;;)
+        {
+            out.writeByte ((char) buffer);
+
+            if ((buffer & 0x80) == 0)
+                break;
+
+            buffer >>= 8;
+        }
+    }
+
+    File midiFile;
+    StringArray trackNames;
+    int ticksPerQuarterNote;
+    double ticksPerSecond;
+    std::shared_ptr<Timeline> timeline;
+    Array<Member*> members;
+
+    JUCE_DECLARE_NON_COPYABLE (MidiTake)
+};
+
+//==============================================================================
+/** One member's track file. Closing the last one joins the tracks into the take. */
+class RecordingGroup::TrackStream  : public OutputStream
+{
+public:
+    TrackStream (std::shared_ptr<MidiTake> groupTake, std::unique_ptr<FileOutputStream> trackStream)
+        : take (std::move (groupTake)), stream (std::move (trackStream))
+    {
+    }
+
+    void flush() override                                   { stream->flush(); }
+    bool setPosition (int64 newPosition) override           { return stream->setPosition (newPosition); }
+    int64 getPosition() override                            { return stream->getPosition(); }
+    bool write (const void* data, size_t numBytes) override { return stream->write (data, numBytes); }
+
+private:
+    // (declared in this order, so the track is closed before the take is let go)
+    std::shared_ptr<MidiTake> take;
+    std::unique_ptr<FileOutputStream> stream;
+
+    JUCE_DECLARE_NON_COPYABLE (TrackStream)
+};
+
+//==============================================================================
+RecordingGroup::RecordingGroup (const String& groupId)
+    : id (groupId)
+{
+}
+
+RecordingGroup::~RecordingGroup()
+{
+}
+
+int RecordingGroup::getNumMembers() const
+{
+    return members.size();
+}
+
+File RecordingGroup::getTrackFile (const File& midiFile, int trackIndex)
+{
+    return midiFile.getSiblingFile (midiFile.getFileNameWithoutExtension() + "-track"
+                                      + String (trackIndex + 1).paddedLeft ('0', 2) + ".tmp");
+}
+
+//==============================================================================
+void RecordingGroup::startAudioTake (const File& audioFile, const AudioWriterFactory& createWriter,
+                                     double sampleRate, int blockSize)
+{
+    Array<int> memberChannels;
+    int totalChannels = 0;
+
+    for (auto* member : members)
+    {
+        memberChannels.add (member->getNumGroupChannels());
+        totalChannels += memberChannels.getLast();
+    }
+
+    auto timeline = std::make_shared<Timeline>();
+    timeline->members = members;
+    timeline->startOffsets.insertMultiple (0, 0, members.size());
+    timeline->sampleRate = sampleRate;
+    lastTimeline = timeline;
+
+    std::shared_ptr<AudioTake> take;
+
+    if (auto writer = createWriter (totalChannels))
+    {
+        // Which channels belong to which instance
+        String channelMap;
+        int channel = 1;
+
+        for (int i = 0; i < members.size(); ++i)
+        {
+            channelMap << channel << "-" << (channel + memberChannels[i] - 1) << "\t" << members[i]->getGroupMemberName() << "\n";
+            channel += memberChannels[i];
+        }
+
+        audioFile.withFileExtension (".channels.txt").replaceWithText (channelMap);
+
+        take = std::make_shared<AudioTake> (std::move (writer), memberChannels, blockSize, sampleRate, timeline);
+    }
+
+    for (int i = 0; i < members.size(); ++i)
+        members[i]->startGroupAudioTake (audioFile, take != nullptr ? std::make_unique<MemberAudioWriter> (take, i, memberChannels[i])
+                                                                    : nullptr);
+}
+
+void RecordingGroup::startMidiTake (const File& midiFile, int ticksPerQuarterNote, double ticksPerSecond)
+{
+    // The tracks line up with the audio take started along with this one (if there is one)
+    auto timeline = lastTimeline != nullptr ? lastTimeline : std::make_shared<Timeline>();
+    lastTimeline = nullptr;
+
+    StringArray names;
+
+    for (auto* member : members)
+        names.add (member->getGroupMemberName());
+
+    auto take = std::make_shared<MidiTake> (midiFile, names, ticksPerQuarterNote, ticksPerSecond, timeline, members);
+
+    for (int i = 0; i < members.size(); ++i)
+    {
+        auto trackFile = getTrackFile (midiFile, i);
+        trackFile.deleteFile();
+
+        std::unique_ptr<MidiFileStreamWriter> writer;
+
+        if (auto trackStream = trackFile.createOutputStream())
+            writer = std::make_unique<MidiFileStreamWriter> (std::make_unique<TrackStream> (take, std::move (trackStream)),
+                                                             ticksPerQuarterNote);
+
+        members[i]->startGroupMidiTake (midiFile, std::move (writer));
+    }
+}
+
+void RecordingGroup::stopAudioTake()
+{
+    for (auto* member : members)
+        member->stopGroupAudioTake();
+}
+
+void RecordingGroup::stopMidiTake()
+{
+    for (auto* member : members)
+        member->stopGroupMidiTake();
+}
+
+void RecordingGroup::deferTakeRequests (bool shouldDefer)
+{
+    for (auto* member : members)
+        member->deferGroupTakeRequests (shouldDefer);
+}
+
+//==============================================================================
+RecordingGroup::Ptr RecordingGroup::Registry::join (const String& groupId, Member* member)
+{
+    RecordingGroup::Ptr group;
+
+    for (auto* g : groups)
+        if (g->getId() == groupId)
+            group = g;
+
+    if (group == nullptr)
+        group = groups.add (new RecordingGroup (groupId));
+
+    group->members.addIfNotAlreadyThere (member);
+    return group;
+}
+
+void RecordingGroup::Registry::leave (const RecordingGroup::Ptr& group, Member* member)
+{
+    if (group == nullptr)
+        return;
+
+    group->members.removeFirstMatchingValue (member);
+
+    if (group->members.isEmpty())
+        groups.removeObject (group.get());
+}
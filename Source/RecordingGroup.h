@@ -0,0 +1,118 @@
+/*
+  ==============================================================================
+
+    This file contains the group takes that let several instances of the
+    recorder share one multichannel file and one multi-track midi file.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "MidiFileStreamWriter.h"
+#include "RecordingWriter.h"
+
+//==============================================================================
+/**
+    The instances that share a group ID. Starting a take on any of them starts
+    it on all of them: every member's AudioRecorder gets a writer for its own
+    channels of one shared file, and every member's MidiRecorder writes its own
+    track of one format 1 midi file.
+
+    Members keep their own rings and writer threads, so the audio thread does
+    exactly what it does for a solo take. The shared writers line the members up
+    on the writer threads, using the timeline position each take started at
+    (see TimelinePosition), and only hand a stretch of audio to the file once
+    every member has delivered it.
+
+    Groups are looked up by ID through a RecordingGroup::Registry, held with a
+    SharedResourcePointer so it lives as long as any instance does.
+*/
+class RecordingGroup  : public ReferenceCountedObject
+{
+public:
+    //==============================================================================
+    /** Implemented by the processor, to let the group start and stop its takes. */
+    struct Member
+    {
+        virtual ~Member() = default;
+
+        virtual int getNumGroupChannels() const = 0;
+        virtual String getGroupMemberName() const = 0;
+
+        virtual void startGroupAudioTake (const File& audioFile, std::unique_ptr<RecordingWriter> writer) = 0;
+        virtual void startGroupMidiTake (const File& midiFile, std::unique_ptr<MidiFileStreamWriter> writer) = 0;
+        virtual void stopGroupAudioTake() = 0;
+        virtual void stopGroupMidiTake() = 0;
+
+        /** While deferred, take changes are queued up but not shown to the audio thread. */
+        virtual void deferGroupTakeRequests (bool shouldDefer) = 0;
+    };
+
+    using Ptr = ReferenceCountedObjectPtr<RecordingGroup>;
+
+    /** Opens the shared audio file for the given total number of channels. */
+    using AudioWriterFactory = std::function<std::unique_ptr<RecordingWriter> (int numChannels)>;
+
+    //==============================================================================
+    explicit RecordingGroup (const String& groupId);
+    ~RecordingGroup() override;
+
+    const String& getId() const noexcept        { return id; }
+    int getNumMembers() const;
+
+    //==============================================================================
+    /** Starts an audio take on every member, in one file with their channels side by side
+        (in the order they joined). blockSize is only used to line up members whose
+        takes started with the host stopped.
+    */
+    void startAudioTake (const File& audioFile, const AudioWriterFactory& createWriter, double sampleRate, int blockSize);
+
+    /** Starts a midi take on every member, with a track each. */
+    void startMidiTake (const File& midiFile, int ticksPerQuarterNote, double ticksPerSecond);
+
+    void stopAudioTake();
+    void stopMidiTake();
+
+    /** Holds back (or releases) every member's take changes, so a group take starts in the
+        same callback on all of them.
+    */
+    void deferTakeRequests (bool shouldDefer);
+
+    //==============================================================================
+    /** The groups in the process, by ID. Message thread only. */
+    class Registry
+    {
+    public:
+        Registry() = default;
+
+        /** Adds the member to the group with this ID (creating it if needed). */
+        RecordingGroup::Ptr join (const String& groupId, Member* member);
+
+        /** Takes the member out of its group, and forgets the group once it's empty. */
+        void leave (const RecordingGroup::Ptr& group, Member* member);
+
+    private:
+        ReferenceCountedArray<RecordingGroup> groups;
+
+        JUCE_DECLARE_NON_COPYABLE (Registry)
+    };
+
+    static File getTrackFile (const File& midiFile, int trackIndex);
+
+private:
+    //==============================================================================
+    class AudioTake;
+    class MemberAudioWriter;
+    class MidiTake;
+    class TrackStream;
+    struct Timeline;
+
+    String id;
+    Array<Member*> members;
+    std::shared_ptr<Timeline> lastTimeline;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RecordingGroup)
+};
@@ -0,0 +1,227 @@
+/*
+  ==============================================================================
+
+    This file contains the writer threads shared by every instance of the
+    recorder in the process.
+
+  ==============================================================================
+*/
+
+#include "RecordingIOService.h"
+
+#if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+ #include <sys/stat.h>
+#endif
+
+//==============================================================================
+RecordingIOService::RecordingIOService()
+{
+    options.maxThreads = jlimit (1, 4, SystemStats::getNumCpus() / 2);
+}
+
+RecordingIOService::~RecordingIOService()
+{
+    // Every instance should have removed its clients before letting go of the service
+    jassert (registrations.isEmpty() && leaving.isEmpty());
+
+    for (auto* thread : threads)
+        thread->stopThread (1000);
+}
+
+//==============================================================================
+void RecordingIOService::setOptions (const Options& newOptions)
+{
+    const ScopedLock sl (lock);
+    options = newOptions;
+    options.maxThreads = jmax (1, options.maxThreads);
+    options.threadPriority = jlimit (0, 10, options.threadPriority);
+    options.writeBatchSeconds = jmax (0.0, options.writeBatchSeconds);
+
+    for (auto* thread : threads)
+        thread->setPriority (options.threadPriority);
+}
+
+RecordingIOService::Options RecordingIOService::getOptions() const
+{
+    const ScopedLock sl (lock);
+    return options;
+}
+
+//==============================================================================
+void RecordingIOService::addClient (TimeSliceClient* client, int64 device)
+{
+    const ScopedLock sl (lock);
+
+    // Already registered: its writer thread moves it (if need be) before its next slice
+    for (auto* r : registrations)
+    {
+        if (r->client == client)
+        {
+            r->pendingDevice = device;
+            r->movePending = r->device != device;
+            return;
+        }
+    }
+
+    // (the thread is found before the new registration is in the list it searches)
+    auto* thread = getThreadForDevice (device);
+    auto* r = registrations.add (new Registration (*this, client));
+    r->device = device;
+    r->thread = thread;
+    thread->addTimeSliceClient (r);
+}
+
+void RecordingIOService::removeClient (TimeSliceClient* client)
+{
+    std::unique_ptr<Registration> r;
+
+    // Taken out of the list first, so nobody else is held up while we wait for its threads
+    {
+        const ScopedLock sl (lock);
+
+        for (int i = registrations.size(); --i >= 0;)
+            if (registrations.getUnchecked (i)->client == client)
+                r.reset (registrations.removeAndReturn (i));
+
+        if (r == nullptr)
+            return;
+
+        r->movePending = false;
+        leaving.add (r.get());
+    }
+
+    // (blocks until neither thread is inside the client's useTimeSlice)
+    r->thread->removeTimeSliceClient (r.get());
+
+    if (r->previousThread != nullptr)
+        r->previousThread->removeTimeSliceClient (r.get());
+
+    {
+        const ScopedLock slice (r->sliceLock);
+    }
+
+    const ScopedLock sl (lock);
+    leaving.removeFirstMatchingValue (r.get());
+    stopIdleThreads();
+}
+
+int RecordingIOService::getNumThreads() const
+{
+    const ScopedLock sl (lock);
+    return threads.size();
+}
+
+//==============================================================================
+int RecordingIOService::Registration::useTimeSlice()
+{
+    // Just after a move, the old thread can still be on its way out of here - the new one
+    // comes back shortly
+    const ScopedTryLock stl (sliceLock);
+
+    if (! stl.isLocked())
+        return 1;
+
+    // (returning -1 takes us off this thread, now that the new one has us)
+    if (movePending.load() && service.moveToPendingThread (*this))
+        return -1;
+
+    return client->useTimeSlice();
+}
+
+bool RecordingIOService::moveToPendingThread (Registration& r)
+{
+    // Whoever holds the lock may be waiting for this thread, so don't wait for it - the move
+    // is tried again next slice
+    const ScopedTryLock stl (lock);
+
+    if (! stl.isLocked() || ! r.movePending.load())
+        return false;
+
+    r.movePending = false;
+    auto* thread = getThreadForDevice (r.pendingDevice);
+    r.device = r.pendingDevice;
+
+    if (thread == r.thread)
+        return false;
+
+    r.previousThread = r.thread;
+    r.thread = thread;
+    thread->addTimeSliceClient (&r);
+    return true;
+}
+
+void RecordingIOService::stopIdleThreads()
+{
+    for (int i = threads.size(); --i >= 0;)
+    {
+        auto* thread = threads.getUnchecked (i);
+
+        if (thread->getNumClients() > 0)
+            continue;
+
+        auto inUse = false;
+
+        for (auto* r : registrations)
+            inUse = inUse || r->thread == thread;
+
+        for (auto* r : leaving)
+            inUse = inUse || r->thread == thread || r->previousThread == thread;
+
+        if (inUse)
+            continue;
+
+        for (auto* r : registrations)
+            if (r->previousThread == thread)
+                r->previousThread = nullptr;
+
+        thread->stopThread (1000);
+        threads.remove (i);
+    }
+}
+
+TimeSliceThread* RecordingIOService::getThreadForDevice (int64 device)
+{
+    // Everything on one device goes through the same thread
+    for (auto* r : registrations)
+        if (r->device == device)
+            return r->thread;
+
+    if (threads.size() < options.maxThreads)
+    {
+        auto* thread = threads.add (new TimeSliceThread ("recording io " + String (threads.size() + 1)));
+
+        if (options.affinityMask != 0)
+            thread->setAffinityMask (options.affinityMask);
+
+        thread->startThread (options.threadPriority);
+        return thread;
+    }
+
+    // Out of threads: share the one with the fewest clients
+    auto* leastBusy = threads.getFirst();
+
+    for (auto* thread : threads)
+        if (thread->getNumClients() < leastBusy->getNumClients())
+            leastBusy = thread;
+
+    return leastBusy;
+}
+
+int64 RecordingIOService::getDeviceId (const File& destination)
+{
+   #if JUCE_LINUX || JUCE_MAC || JUCE_BSD
+    // (the file itself may not exist yet, so use the nearest parent directory that does)
+    for (auto f = destination;; f = f.getParentDirectory())
+    {
+        struct stat info;
+
+        if (stat (f.getFullPathName().toRawUTF8(), &info) == 0)
+            return (int64) info.st_dev;
+
+        if (f.getParentDirectory() == f)
+            return 0;
+    }
+   #else
+    return (int64) destination.getVolumeSerialNumber();
+   #endif
+}
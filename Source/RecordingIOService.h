@@ -0,0 +1,108 @@
+/*
+  ==============================================================================
+
+    This file contains the writer threads shared by every instance of the
+    recorder in the process.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    A process-wide set of writer threads that every recorder instance registers
+    its TimeSliceClients with, instead of each instance running its own thread.
+
+    Use it through a SharedResourcePointer<RecordingIOService>, so it's created
+    with the first instance and deleted with the last one.
+
+    Clients are grouped by the device their files live on: everything writing to
+    one disk is serviced by the same thread, one client at a time, so the disk
+    sees a few large sequential writes in turn rather than many threads seeking
+    against each other. A thread's clients take turns (TimeSliceThread calls
+    whichever has waited longest), which keeps the streams fair. New devices get
+    a thread of their own until maxThreads is reached, after which they share the
+    least busy one. Threads are stopped once their last client has gone.
+
+    A client that starts writing to another device moves to that device's
+    thread, but nothing waits for the move: the client's own writer thread
+    makes it between two of its time slices (so a take that's still being
+    finished off carries on on the new thread). Only removing a client waits
+    for it, and never while holding the lock the other instances use.
+*/
+class RecordingIOService
+{
+public:
+    //==============================================================================
+    RecordingIOService();
+    ~RecordingIOService();
+
+    struct Options
+    {
+        int maxThreads = 2;
+        int threadPriority = 6;         // 0 to 10, as for juce::Thread (5 is normal)
+        uint32 affinityMask = 0;        // 0 to let the threads run on any core
+        double writeBatchSeconds = 0.1; // how much audio a recorder should gather before writing it
+    };
+
+    /** Changes the options. The priority applies straight away, the affinity to threads
+        started from now on, and maxThreads to devices registered from now on.
+    */
+    void setOptions (const Options& newOptions);
+    Options getOptions() const;
+
+    //==============================================================================
+    /** Registers a client that writes to the given file or directory, or moves it to the
+        right thread if it's already registered and the destination is on another device.
+        Never waits for the client: a move is made by its writer thread, before its next
+        time slice.
+    */
+    void addClient (TimeSliceClient* client, const File& destination)     { addClient (client, getDeviceId (destination)); }
+
+    /** The same, with a device from getDeviceId() (which can be worked out on another thread,
+        since it has to look at the disk).
+    */
+    void addClient (TimeSliceClient* client, int64 device);
+
+    /** Unregisters a client, waiting for its current time slice to finish. */
+    void removeClient (TimeSliceClient* client);
+
+    /** The number of writer threads currently running. */
+    int getNumThreads() const;
+
+    /** The device a file or directory is on (for the nearest parent that exists, if it doesn't). */
+    static int64 getDeviceId (const File& destination);
+
+private:
+    //==============================================================================
+    // Stands in for a client on its thread, so it can move itself to another one
+    struct Registration  : public TimeSliceClient
+    {
+        Registration (RecordingIOService& s, TimeSliceClient* c) : service (s), client (c) {}
+        int useTimeSlice() override;
+
+        RecordingIOService& service;
+        TimeSliceClient* client;
+        int64 device = 0, pendingDevice = 0;
+        TimeSliceThread* thread = nullptr;
+        TimeSliceThread* previousThread = nullptr;  // (may still be on its way out of a slice after a move)
+        std::atomic<bool> movePending { false };
+        CriticalSection sliceLock;                  // (only ever one slice at a time, whichever thread it's on)
+    };
+
+    TimeSliceThread* getThreadForDevice (int64 device);
+    bool moveToPendingThread (Registration& r);
+    void stopIdleThreads();
+
+    CriticalSection lock;
+    OwnedArray<TimeSliceThread> threads;
+    OwnedArray<Registration> registrations;
+    Array<Registration*> leaving;                   // removed, and waiting for their threads
+    Options options;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RecordingIOService)
+};
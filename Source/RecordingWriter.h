@@ -0,0 +1,86 @@
+/*
+  ==============================================================================
+
+    This file contains the interface the audio recorder writes takes through.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/** Where a block (or a take's first sample) sits on a timeline shared by every
+    plugin instance in the process.
+*/
+struct TimelinePosition
+{
+    int64 samples = 0;
+    bool fromHost = false;  // the host's playhead (exact), rather than the wall clock (only good to a block)
+};
+
+//==============================================================================
+/**
+    Destination for one take of audio. All methods are called on the writer
+    thread; deleting the writer finalises the file.
+*/
+class RecordingWriter
+{
+public:
+    virtual ~RecordingWriter() = default;
+
+    /** Writes a block of non-interleaved float samples. The array holds at least
+        getNumChannels() channels.
+    */
+    virtual bool write (const float* const* channels, int numSamples) = 0;
+
+    virtual int getNumChannels() const = 0;
+
+    /** Makes everything written so far readable if the process dies (e.g. by
+        rewriting the header with the current sizes and flushing the stream).
+        Called periodically during a take.
+    */
+    virtual bool commit() = 0;
+
+    /** How much has gone to the destination stream so far, for the telemetry. */
+    virtual int64 getNumBytesWritten() const = 0;
+
+    /** Called before the first write with the timeline position of the take's first
+        sample (lookback included). Only writers that line takes up with each other use it.
+    */
+    virtual void setStartPosition (TimelinePosition) {}
+};
+
+//==============================================================================
+/**
+    Adapts one of JUCE's AudioFormatWriters (used for the compressed formats).
+
+    The stream is the one the AudioFormatWriter owns; it's only kept here to
+    report how much has been written.
+*/
+class AudioFormatRecordingWriter  : public RecordingWriter
+{
+public:
+    AudioFormatRecordingWriter (std::unique_ptr<AudioFormatWriter> w, OutputStream& writerStream)
+        : writer (std::move (w)), stream (writerStream)
+    {
+    }
+
+    bool write (const float* const* channels, int numSamples) override
+    {
+        return writer->writeFromFloatArrays (channels, getNumChannels(), numSamples);
+    }
+
+    // (not every format can flush part-way through a file)
+    bool commit() override                  { return writer->flush(); }
+
+    int getNumChannels() const override     { return writer->getNumChannels(); }
+    int64 getNumBytesWritten() const override   { return stream.getPosition(); }
+
+private:
+    std::unique_ptr<AudioFormatWriter> writer;
+    OutputStream& stream;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AudioFormatRecordingWriter)
+};
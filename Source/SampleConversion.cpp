@@ -0,0 +1,328 @@
+/*
+  ==============================================================================
+
+    This file contains the vectorised float to PCM conversion kernels used by
+    the writer thread.
+
+  ==============================================================================
+*/
+
+#include "SampleConversion.h"
+
+#if JUCE_USE_SSE_INTRINSICS
+ #include <emmintrin.h>
+#elif JUCE_USE_ARM_NEON
+ #include <arm_neon.h>
+#endif
+
+namespace SampleConversion
+{
+    // Samples are converted a tile at a time so the intermediate ints stay in L1.
+    // Wider layouts are converted maxTileChannels at a time, each chunk being
+    // interleaved into its slots of the full frame.
+    static constexpr int tileSize = 256;
+    static constexpr int maxTileChannels = 64;
+
+    static constexpr float int16Scale = (float) 0x7fff;
+    static constexpr float int24Scale = (float) 0x7fffff;
+
+    // (2^31 - 1 isn't representable as a float and would round up and overflow)
+    static constexpr float int32Scale = (float) 0x7fffff80;
+
+    void floatToInt32 (const float* source, int32* dest, float scale, int numSamples) noexcept
+    {
+        int i = 0;
+
+       #if JUCE_USE_SSE_INTRINSICS
+        auto s  = _mm_set1_ps (scale);
+        auto lo = _mm_set1_ps (-1.0f);
+        auto hi = _mm_set1_ps (1.0f);
+
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            auto x = _mm_min_ps (_mm_max_ps (_mm_loadu_ps (source + i), lo), hi);
+            _mm_storeu_si128 ((__m128i*) (dest + i), _mm_cvtps_epi32 (_mm_mul_ps (x, s)));
+        }
+       #elif JUCE_USE_ARM_NEON && defined (__aarch64__)
+        auto s  = vdupq_n_f32 (scale);
+        auto lo = vdupq_n_f32 (-1.0f);
+        auto hi = vdupq_n_f32 (1.0f);
+
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            auto x = vminq_f32 (vmaxq_f32 (vld1q_f32 (source + i), lo), hi);
+            vst1q_s32 (dest + i, vcvtnq_s32_f32 (vmulq_f32 (x, s)));
+        }
+       #endif
+
+        for (; i < numSamples; ++i)
+            dest[i] = roundToInt (jlimit (-1.0f, 1.0f, source[i]) * scale);
+    }
+
+    //==============================================================================
+    static void interleaveInt16 (int32 tile[][tileSize], int numChannels, int frameChannels,
+                                 int numSamples, int16* dest) noexcept
+    {
+        int i = 0;
+
+       #if JUCE_USE_SSE_INTRINSICS
+        // (a layout this narrow is always converted in a single chunk)
+        if (frameChannels == 1)
+        {
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                auto a = _mm_loadu_si128 ((const __m128i*) (tile[0] + i));
+                auto b = _mm_loadu_si128 ((const __m128i*) (tile[0] + i + 4));
+                _mm_storeu_si128 ((__m128i*) (dest + i), _mm_packs_epi32 (a, b));
+            }
+        }
+        else if (frameChannels == 2)
+        {
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                auto l = _mm_packs_epi32 (_mm_loadu_si128 ((const __m128i*) (tile[0] + i)),
+                                          _mm_loadu_si128 ((const __m128i*) (tile[0] + i + 4)));
+                auto r = _mm_packs_epi32 (_mm_loadu_si128 ((const __m128i*) (tile[1] + i)),
+                                          _mm_loadu_si128 ((const __m128i*) (tile[1] + i + 4)));
+
+                _mm_storeu_si128 ((__m128i*) (dest + 2 * i),     _mm_unpacklo_epi16 (l, r));
+                _mm_storeu_si128 ((__m128i*) (dest + 2 * i + 8), _mm_unpackhi_epi16 (l, r));
+            }
+        }
+       #elif JUCE_USE_ARM_NEON
+        if (frameChannels == 2)
+        {
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                int16x4x2_t lr;
+                lr.val[0] = vqmovn_s32 (vld1q_s32 (tile[0] + i));
+                lr.val[1] = vqmovn_s32 (vld1q_s32 (tile[1] + i));
+                vst2_s16 (dest + 2 * i, lr);
+            }
+        }
+       #endif
+
+        for (; i < numSamples; ++i)
+            for (int ch = 0; ch < numChannels; ++ch)
+                dest[i * frameChannels + ch] = (int16) ByteOrder::swapIfBigEndian ((uint16) tile[ch][i]);
+    }
+
+    static void interleaveInt24 (int32 tile[][tileSize], int numChannels, int frameChannels,
+                                 int numSamples, uint8* dest) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            auto* d = dest + (size_t) i * (size_t) (3 * frameChannels);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                auto v = tile[ch][i];
+                d[0] = (uint8) v;
+                d[1] = (uint8) (v >> 8);
+                d[2] = (uint8) (v >> 16);
+                d += 3;
+            }
+        }
+    }
+
+    //==============================================================================
+    template <typename Interleaver>
+    static void convertInTiles (const float* const* source, int numChannels, int numSamples,
+                                float scale, int bytesPerSample, uint8* dest, Interleaver&& interleave) noexcept
+    {
+        int32 tile[maxTileChannels][tileSize];
+        auto bytesPerFrame = (size_t) bytesPerSample * (size_t) numChannels;
+
+        for (int pos = 0; pos < numSamples; pos += tileSize)
+        {
+            auto num = jmin (tileSize, numSamples - pos);
+
+            for (int first = 0; first < numChannels; first += maxTileChannels)
+            {
+                auto chunk = jmin (maxTileChannels, numChannels - first);
+
+                for (int ch = 0; ch < chunk; ++ch)
+                    floatToInt32 (source[first + ch] + pos, tile[ch], scale, num);
+
+                interleave (tile, chunk, num, dest + (size_t) pos * bytesPerFrame + (size_t) first * (size_t) bytesPerSample);
+            }
+        }
+    }
+
+    void floatToInt16Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept
+    {
+        convertInTiles (source, numChannels, numSamples, int16Scale, 2, (uint8*) dest,
+                        [numChannels] (int32 tile[][tileSize], int chunk, int num, uint8* out)
+                        {
+                            interleaveInt16 (tile, chunk, numChannels, num, (int16*) out);
+                        });
+    }
+
+    void floatToInt24Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept
+    {
+        convertInTiles (source, numChannels, numSamples, int24Scale, 3, (uint8*) dest,
+                        [numChannels] (int32 tile[][tileSize], int chunk, int num, uint8* out)
+                        {
+                            interleaveInt24 (tile, chunk, numChannels, num, out);
+                        });
+    }
+
+    void floatToInt32Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept
+    {
+        convertInTiles (source, numChannels, numSamples, int32Scale, 4, (uint8*) dest,
+                        [numChannels] (int32 tile[][tileSize], int chunk, int num, uint8* out)
+                        {
+                            auto* d = (int32*) out;
+
+                            for (int i = 0; i < num; ++i)
+                                for (int ch = 0; ch < chunk; ++ch)
+                                    d[i * numChannels + ch] = (int32) ByteOrder::swapIfBigEndian ((uint32) tile[ch][i]);
+                        });
+    }
+
+    void floatToFloat32Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept
+    {
+        auto* d = (float*) dest;
+
+        if (numChannels == 1)
+        {
+            memcpy (d, source[0], (size_t) numSamples * sizeof (float));
+            return;
+        }
+
+        int i = 0;
+
+       #if JUCE_USE_SSE_INTRINSICS
+        if (numChannels == 2)
+        {
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                auto l = _mm_loadu_ps (source[0] + i);
+                auto r = _mm_loadu_ps (source[1] + i);
+                _mm_storeu_ps (d + 2 * i,     _mm_unpacklo_ps (l, r));
+                _mm_storeu_ps (d + 2 * i + 4, _mm_unpackhi_ps (l, r));
+            }
+        }
+       #elif JUCE_USE_ARM_NEON
+        if (numChannels == 2)
+        {
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                float32x4x2_t lr;
+                lr.val[0] = vld1q_f32 (source[0] + i);
+                lr.val[1] = vld1q_f32 (source[1] + i);
+                vst2q_f32 (d + 2 * i, lr);
+            }
+        }
+       #endif
+
+        for (; i < numSamples; ++i)
+            for (int ch = 0; ch < numChannels; ++ch)
+                d[i * numChannels + ch] = source[ch][i];
+    }
+
+    //==============================================================================
+    Ditherer::Ditherer (Mode m, int numChannels)
+        : mode (m),
+          channels ((size_t) numChannels)
+    {
+        Random random;
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            for (auto& seed : channels[ch].seeds)
+                seed = (uint32) random.nextInt() | 1u;   // (xorshift state must never be zero)
+
+            channels[ch].lastRandom = 0.0f;
+        }
+    }
+
+    static inline uint32 nextXorShift (uint32& x) noexcept
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+
+    // Turns the top 23 bits into a float in [-0.5, 0.5)
+    static inline float toUniform (uint32 bits) noexcept
+    {
+        bits = (bits >> 9) | 0x3f800000u;
+        float f;
+        memcpy (&f, &bits, sizeof (f));
+        return f - 1.5f;
+    }
+
+    void Ditherer::process (float* samples, int channel, int numSamples, float stepSize) noexcept
+    {
+        if (mode == Mode::none)
+            return;
+
+        auto& state = channels[channel];
+        auto highPass = mode == Mode::highPassTriangular;
+        int i = 0;
+
+       #if JUCE_USE_SSE_INTRINSICS
+        auto seeds = _mm_loadu_si128 ((const __m128i*) state.seeds);
+        auto step = _mm_set1_ps (stepSize);
+        auto exponent = _mm_set1_epi32 (0x3f800000);
+        auto offset = _mm_set1_ps (1.5f);
+        auto previous = _mm_set1_ps (state.lastRandom);
+
+        auto nextUniform = [&]
+        {
+            seeds = _mm_xor_si128 (seeds, _mm_slli_epi32 (seeds, 13));
+            seeds = _mm_xor_si128 (seeds, _mm_srli_epi32 (seeds, 17));
+            seeds = _mm_xor_si128 (seeds, _mm_slli_epi32 (seeds, 5));
+
+            return _mm_sub_ps (_mm_castsi128_ps (_mm_or_si128 (_mm_srli_epi32 (seeds, 9), exponent)), offset);
+        };
+
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            __m128 d;
+            auto r = nextUniform();
+
+            if (highPass)
+            {
+                // [previous[3], r0, r1, r2]
+                auto shifted = _mm_castsi128_ps (_mm_or_si128 (_mm_slli_si128 (_mm_castps_si128 (r), 4),
+                                                               _mm_srli_si128 (_mm_castps_si128 (previous), 12)));
+                d = _mm_sub_ps (r, shifted);
+                previous = r;
+            }
+            else
+            {
+                d = _mm_add_ps (r, nextUniform());
+            }
+
+            _mm_storeu_ps (samples + i, _mm_add_ps (_mm_loadu_ps (samples + i), _mm_mul_ps (d, step)));
+        }
+
+        _mm_storeu_si128 ((__m128i*) state.seeds, seeds);
+
+        float lastValues[4];
+        _mm_storeu_ps (lastValues, previous);
+        state.lastRandom = lastValues[3];
+       #endif
+
+        for (; i < numSamples; ++i)
+        {
+            auto r = toUniform (nextXorShift (state.seeds[i & 3]));
+            float d;
+
+            if (highPass)
+            {
+                d = r - state.lastRandom;
+                state.lastRandom = r;
+            }
+            else
+            {
+                d = r + toUniform (nextXorShift (state.seeds[(i + 1) & 3]));
+            }
+
+            samples[i] += d * stepSize;
+        }
+    }
+}
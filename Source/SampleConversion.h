@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    This file contains the vectorised float to PCM conversion kernels used by
+    the writer thread.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    Converts blocks of non-interleaved float channels into interleaved,
+    little-endian PCM ready to be written into a WAV data chunk.
+
+    Each tile of samples is first scaled, clipped and rounded to 32-bit ints one
+    channel at a time with SSE2/NEON, then interleaved. Mono and stereo 16-bit
+    output is packed and interleaved entirely in vector registers. 32-bit float
+    output involves no conversion at all, just an interleaving copy.
+*/
+namespace SampleConversion
+{
+    /** Writes numSamples frames of 16-bit PCM (2 * numChannels bytes per frame). */
+    void floatToInt16Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept;
+
+    /** Writes numSamples frames of packed 24-bit PCM (3 * numChannels bytes per frame). */
+    void floatToInt24Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept;
+
+    /** Writes numSamples frames of 32-bit integer PCM (4 * numChannels bytes per frame). */
+    void floatToInt32Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept;
+
+    /** Writes numSamples frames of 32-bit float (4 * numChannels bytes per frame). */
+    void floatToFloat32Interleaved (const float* const* source, int numChannels, int numSamples, void* dest) noexcept;
+
+    /** Scales, clips and rounds floats to ints in the range [-scale, scale]. */
+    void floatToInt32 (const float* source, int32* dest, float scale, int numSamples) noexcept;
+
+    //==============================================================================
+    /**
+        Adds triangular (TPDF) dither before a block is quantised to 16 or 24 bits.
+
+        Random numbers come from four xorshift generators per channel, run in
+        parallel in one SSE2 register. The high-pass variant subtracts each
+        sample's random value from the next one's, which still gives a triangular
+        distribution but pushes the noise up towards Nyquist, where it is much
+        less audible - a form of noise shaping that keeps every step vectorised.
+    */
+    class Ditherer
+    {
+    public:
+        enum class Mode
+        {
+            none = 0,
+            triangular,
+            highPassTriangular
+        };
+
+        Ditherer (Mode mode, int numChannels);
+
+        /** Adds dither of up to +/- one step of the given size to the samples in place. */
+        void process (float* samples, int channel, int numSamples, float stepSize) noexcept;
+
+        Mode getMode() const noexcept       { return mode; }
+
+    private:
+        struct ChannelState
+        {
+            uint32 seeds[4];
+            float lastRandom;
+        };
+
+        Mode mode;
+        HeapBlock<ChannelState> channels;
+    };
+}
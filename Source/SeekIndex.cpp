@@ -0,0 +1,227 @@
+/*
+  ==============================================================================
+
+    This file contains the seek index that's saved next to each take, mapping
+    sample positions to places in the file.
+
+  ==============================================================================
+*/
+
+#include "SeekIndex.h"
+
+//==============================================================================
+// File layout (little-endian): "SKIX", version, kind, sample rate (double), bytes per
+// frame, number of points, then each point's sample, offset and tick as int64s.
+static const char indexMagic[] = { 'S', 'K', 'I', 'X' };
+static constexpr int indexVersion = 1;
+
+SeekIndex::SeekIndex (Kind indexKind, double rate, int frameSize)
+    : kind (indexKind),
+      sampleRate (rate),
+      bytesPerFrame (frameSize),
+      interval (jmax ((int64) 1, (int64) (rate * intervalSeconds)))
+{
+}
+
+void SeekIndex::addPoint (int64 sample, int64 offset, int64 tick)
+{
+    if (! points.isEmpty() && sample < points.getReference (points.size() - 1).sample + interval)
+        return;
+
+    points.add ({ sample, offset, tick });
+}
+
+SeekIndex::Point SeekIndex::find (int64 samplePosition, int pointsBefore) const
+{
+    // The first point after the position, then back from there
+    auto after = std::upper_bound (points.begin(), points.end(), samplePosition,
+                                   [] (int64 position, const Point& p) { return position < p.sample; });
+    auto index = (int) (after - points.begin()) - 1 - jmax (0, pointsBefore);
+
+    if (index < 0)
+        return points.isEmpty() ? Point() : points.getReference (0);
+
+    return points.getReference (index);
+}
+
+int64 SeekIndex::getOffsetFor (int64 samplePosition) const
+{
+    auto point = find (samplePosition);
+
+    if (kind == Kind::wavFrames && bytesPerFrame > 0 && ! points.isEmpty())
+        return point.offset + (samplePosition - point.sample) * bytesPerFrame;
+
+    return point.offset;
+}
+
+File SeekIndex::getFileFor (const File& mediaFile)
+{
+    return File (mediaFile.getFullPathName() + ".seek");
+}
+
+//==============================================================================
+bool SeekIndex::writeTo (OutputStream& stream) const
+{
+    bool ok = stream.write (indexMagic, sizeof (indexMagic))
+               && stream.writeInt (indexVersion)
+               && stream.writeInt ((int) kind)
+               && stream.writeDouble (sampleRate)
+               && stream.writeInt (bytesPerFrame)
+               && stream.writeInt (points.size());
+
+    for (auto& p : points)
+        ok = ok && stream.writeInt64 (p.sample) && stream.writeInt64 (p.offset) && stream.writeInt64 (p.tick);
+
+    return ok;
+}
+
+bool SeekIndex::save (const File& file) const
+{
+    file.deleteFile();
+    FileOutputStream stream (file, 65536);
+
+    if (stream.openedOk() && writeTo (stream) && (stream.flush(), ! stream.getStatus().failed()))
+        return true;
+
+    file.deleteFile();
+    return false;
+}
+
+std::unique_ptr<SeekIndex> SeekIndex::readFrom (InputStream& stream)
+{
+    char magic[sizeof (indexMagic)];
+
+    if (stream.read (magic, (int) sizeof (magic)) != (int) sizeof (magic)
+         || memcmp (magic, indexMagic, sizeof (magic)) != 0
+         || stream.readInt() != indexVersion)
+        return nullptr;
+
+    auto kind = stream.readInt();
+    auto sampleRate = stream.readDouble();
+    auto bytesPerFrame = stream.readInt();
+    auto numPoints = stream.readInt();
+
+    // (a truncated or corrupt file mustn't make us allocate more than it could hold)
+    if (kind < 0 || kind > (int) Kind::midiEvents || sampleRate <= 0.0 || bytesPerFrame < 0 || numPoints < 0
+         || (stream.getTotalLength() >= 0 && (int64) numPoints * 24 > stream.getNumBytesRemaining()))
+        return nullptr;
+
+    auto index = std::make_unique<SeekIndex> ((Kind) kind, sampleRate, bytesPerFrame);
+    index->points.ensureStorageAllocated (numPoints);
+
+    for (int i = 0; i < numPoints; ++i)
+    {
+        Point p;
+        p.sample = stream.readInt64();
+        p.offset = stream.readInt64();
+        p.tick = stream.readInt64();
+        index->points.add (p);
+    }
+
+    if (! stream.isExhausted())
+        return nullptr;
+
+    return index;
+}
+
+std::unique_ptr<SeekIndex> SeekIndex::readFrom (const File& file)
+{
+    FileInputStream stream (file);
+
+    if (! stream.openedOk())
+        return nullptr;
+
+    BufferedInputStream buffered (stream, 65536);
+    return readFrom (buffered);
+}
+
+//==============================================================================
+OggPageIndexStream::OggPageIndexStream (std::unique_ptr<OutputStream> destStream, const File& indexFile, double sampleRate)
+    : stream (std::move (destStream)),
+      file (indexFile),
+      index (SeekIndex::Kind::oggPages, sampleRate)
+{
+}
+
+OggPageIndexStream::~OggPageIndexStream()
+{
+    // (the encoder has written its last page by the time it deletes us)
+    stream->flush();
+
+    if (valid)
+        index.save (file);
+}
+
+bool OggPageIndexStream::setPosition (int64 newPosition)
+{
+    // The Ogg writer only ever appends; anything else means the pages can't be followed
+    if (newPosition != position)
+        valid = false;
+
+    if (! stream->setPosition (newPosition))
+        return false;
+
+    position = newPosition;
+    return true;
+}
+
+bool OggPageIndexStream::write (const void* data, size_t numBytes)
+{
+    if (valid)
+        parse (static_cast<const uint8*> (data), numBytes);
+
+    position += (int64) numBytes;
+    return stream->write (data, numBytes);
+}
+
+void OggPageIndexStream::parse (const uint8* data, size_t numBytes)
+{
+    auto pos = position;
+
+    while (numBytes > 0 && valid)
+    {
+        // Skip over the body of the current page
+        if (bodyRemaining > 0)
+        {
+            auto num = (size_t) jmin ((int64) numBytes, bodyRemaining);
+            bodyRemaining -= (int64) num;
+            data += num;
+            numBytes -= num;
+            pos += (int64) num;
+            continue;
+        }
+
+        // Gather the header: 27 fixed bytes, then a segment table whose length is the last of them
+        if (headerLength == 0)
+            pageStart = pos;
+
+        auto needed = headerLength < 27 ? 27 : 27 + (int) header[26];
+        auto num = (int) jmin ((size_t) (needed - headerLength), numBytes);
+        memcpy (header + headerLength, data, (size_t) num);
+        headerLength += num;
+        data += num;
+        numBytes -= (size_t) num;
+        pos += num;
+
+        if (headerLength == 27 && memcmp (header, "OggS", 4) != 0)
+            valid = false;
+
+        if (headerLength < 27 || headerLength < 27 + (int) header[26])
+            continue;
+
+        for (int i = 0; i < (int) header[26]; ++i)
+            bodyRemaining += header[27 + i];
+
+        // A page's granule position is the number of samples decoded by its end, so decoding
+        // from this page starts where the last one with a granule position finished
+        if (lastGranule >= 0)
+            index.addPoint (lastGranule, pageStart);
+
+        auto granule = (int64) ByteOrder::littleEndianInt64 (header + 6);
+
+        if (granule >= 0)
+            lastGranule = granule;
+
+        headerLength = 0;
+    }
+}
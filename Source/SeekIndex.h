@@ -0,0 +1,133 @@
+/*
+  ==============================================================================
+
+    This file contains the seek index that's saved next to each take, mapping
+    sample positions to places in the file.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    A table of points in a recorded file: for each one, a sample position in the
+    take and the byte offset in the file to start reading from to get there.
+
+    The writers add a point every intervalSeconds or so as the take is written,
+    and save the index next to the file when it's finished (see getFileFor()).
+    Finding where to start reading for any position is then a binary search,
+    without reading the file itself:
+
+    - WAV files: the offset of the first frame. Every frame is the same size,
+      so getOffsetFor() is exact for any sample from that one point.
+    - Ogg Vorbis files: the start of a page, and the first sample decoded from
+      it. The decoder is set up from the header packets at the start of the
+      file as usual, and Vorbis needs the packet before to get going, so start
+      decoding from the point before the one found (find (position, 1)).
+    - Midi files: the start of an event's delta-time, and the absolute tick
+      the delta counts from. Every event has its own status byte, so reading
+      can start at any point (later ticks map to samples with the tempo in
+      force there, from the track's tempo events).
+*/
+class SeekIndex
+{
+public:
+    //==============================================================================
+    enum class Kind
+    {
+        wavFrames = 0,
+        oggPages,
+        midiEvents
+    };
+
+    struct Point
+    {
+        int64 sample = 0;       // samples from the start of the file
+        int64 offset = 0;       // bytes from the start of the file
+        int64 tick = -1;        // midi only (the tick the next event's delta starts from)
+    };
+
+    static constexpr double intervalSeconds = 0.5;
+
+    SeekIndex (Kind kind, double sampleRate, int bytesPerFrame = 0);
+
+    //==============================================================================
+    Kind getKind() const noexcept                           { return kind; }
+    double getSampleRate() const noexcept                   { return sampleRate; }
+    int getBytesPerFrame() const noexcept                   { return bytesPerFrame; }
+
+    int getNumPoints() const noexcept                       { return points.size(); }
+    const Point& getPoint (int index) const                 { return points.getReference (index); }
+
+    /** Adds a point, if it's at least intervalSeconds after the last one. Points have
+        to arrive in order.
+    */
+    void addPoint (int64 sample, int64 offset, int64 tick = -1);
+
+    /** The last point at or before samplePosition (or that many points before it), in
+        O(log n). If there are no points, returns a point at the start of the file.
+    */
+    Point find (int64 samplePosition, int pointsBefore = 0) const;
+
+    /** For WAV files, the exact byte offset of any frame; otherwise the offset of the
+        point find() returns.
+    */
+    int64 getOffsetFor (int64 samplePosition) const;
+
+    //==============================================================================
+    /** The index for a file ("recording.wav.seek"). */
+    static File getFileFor (const File& mediaFile);
+
+    bool writeTo (OutputStream& stream) const;
+    bool save (const File& file) const;
+
+    static std::unique_ptr<SeekIndex> readFrom (InputStream& stream);
+    static std::unique_ptr<SeekIndex> readFrom (const File& file);
+
+private:
+    //==============================================================================
+    Kind kind;
+    double sampleRate;
+    int bytesPerFrame;
+    int64 interval;
+    Array<Point> points;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SeekIndex)
+};
+
+//==============================================================================
+/**
+    Passes an Ogg stream through to a file, indexing its pages on the way, and
+    saves the index once the stream is deleted.
+
+    The pages are followed by their headers (each one says how long its body
+    is), so nothing has to be searched for or buffered.
+*/
+class OggPageIndexStream  : public OutputStream
+{
+public:
+    OggPageIndexStream (std::unique_ptr<OutputStream> destStream, const File& indexFile, double sampleRate);
+    ~OggPageIndexStream() override;
+
+    void flush() override                                   { stream->flush(); }
+    bool setPosition (int64 newPosition) override;
+    int64 getPosition() override                            { return position; }
+    bool write (const void* data, size_t numBytes) override;
+
+private:
+    void parse (const uint8* data, size_t numBytes);
+
+    std::unique_ptr<OutputStream> stream;
+    File file;
+    SeekIndex index;
+    int64 position = 0, pageStart = 0, bodyRemaining = 0, lastGranule = -1;
+    uint8 header[27 + 255];
+    int headerLength = 0;
+    bool valid = true;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OggPageIndexStream)
+};
@@ -0,0 +1,74 @@
+/*
+  ==============================================================================
+
+    This file contains the writer that splits a take into rolling segments.
+
+  ==============================================================================
+*/
+
+#include "SegmentedRecordingWriter.h"
+
+//==============================================================================
+SegmentedRecordingWriter::SegmentedRecordingWriter (SegmentFactory factory, int channels, int64 segmentLengthSamples)
+    : createSegment (std::move (factory)),
+      numChannels (channels),
+      segmentLength (jmax ((int64) 1, segmentLengthSamples)),
+      offsetChannels ((size_t) channels)
+{
+    startNextSegment();
+}
+
+//==============================================================================
+bool SegmentedRecordingWriter::write (const float* const* channels, int numSamples)
+{
+    bool ok = true;
+
+    for (int done = 0; done < numSamples;)
+    {
+        if (positionInSegment >= segmentLength)
+            startNextSegment();
+
+        auto num = (int) jmin ((int64) (numSamples - done), segmentLength - positionInSegment);
+
+        if (currentSegment != nullptr)
+        {
+            for (int ch = 0; ch < numChannels; ++ch)
+                offsetChannels[ch] = channels[ch] + done;
+
+            ok = currentSegment->write (offsetChannels, num) && ok;
+        }
+        else
+        {
+            ok = false;
+        }
+
+        done += num;
+        positionInSegment += num;
+    }
+
+    return ok;
+}
+
+bool SegmentedRecordingWriter::commit()
+{
+    return currentSegment != nullptr && currentSegment->commit();
+}
+
+int64 SegmentedRecordingWriter::getNumBytesWritten() const
+{
+    return bytesInClosedSegments + (currentSegment != nullptr ? currentSegment->getNumBytesWritten() : 0);
+}
+
+//==============================================================================
+void SegmentedRecordingWriter::startNextSegment()
+{
+    // Deleting the old writer finalises its file before the next one is opened
+    if (currentSegment != nullptr)
+    {
+        bytesInClosedSegments += currentSegment->getNumBytesWritten();
+        currentSegment.reset();
+    }
+
+    currentSegment = createSegment (++segmentIndex);
+    positionInSegment = 0;
+}
@@ -0,0 +1,62 @@
+/*
+  ==============================================================================
+
+    This file contains the writer that splits a take into rolling segments.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "RecordingWriter.h"
+
+//==============================================================================
+/**
+    Splits one take into consecutive files of a fixed number of samples.
+
+    The split happens inside write(), on the writer thread, at an exact sample
+    position, so the segments join up gaplessly and the audio thread does no
+    extra work. Each segment's writer comes from a factory. The first one is
+    created in the constructor (on the calling thread), and later ones are
+    created when the previous segment fills up.
+*/
+class SegmentedRecordingWriter  : public RecordingWriter
+{
+public:
+    //==============================================================================
+    /** Creates the writer for a segment (0 is the first). Returning nullptr loses
+        that segment's audio but doesn't stop the next one being tried.
+    */
+    using SegmentFactory = std::function<std::unique_ptr<RecordingWriter> (int segmentIndex)>;
+
+    SegmentedRecordingWriter (SegmentFactory createSegment, int numChannels, int64 segmentLengthSamples);
+
+    /** True if the first segment could be created. */
+    bool openedOk() const noexcept                  { return currentSegment != nullptr; }
+
+    //==============================================================================
+    bool write (const float* const* channels, int numSamples) override;
+    bool commit() override;
+
+    int getNumChannels() const override             { return numChannels; }
+    int64 getNumBytesWritten() const override;
+
+    int getNumSegments() const noexcept             { return segmentIndex + 1; }
+
+private:
+    //==============================================================================
+    void startNextSegment();
+
+    SegmentFactory createSegment;
+    int numChannels;
+    int64 segmentLength;
+
+    std::unique_ptr<RecordingWriter> currentSegment;
+    int segmentIndex = -1;
+    int64 positionInSegment = 0, bytesInClosedSegments = 0;
+    HeapBlock<const float*> offsetChannels;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SegmentedRecordingWriter)
+};
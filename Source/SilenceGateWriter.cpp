@@ -0,0 +1,236 @@
+/*
+  ==============================================================================
+
+    This file contains the writer that leaves silence out of a take.
+
+  ==============================================================================
+*/
+
+#include "SilenceGateWriter.h"
+#include "PeakOverview.h"
+
+//==============================================================================
+SilenceGateWriter::SilenceGateWriter (const File& indexFile, PartFileFunction partFileFunction, PartFactory factory,
+                                      int channels, double sampleRate, const Options& gateOptions)
+    : getPartFile (std::move (partFileFunction)),
+      createPart (std::move (factory)),
+      numChannels (channels),
+      options (gateOptions),
+      windowSize (jmax (64, roundToInt (0.01 * sampleRate))),
+      holdSamples ((int64) (jmax (0.0, options.holdSeconds) * sampleRate)),
+      thresholdPower (std::pow (10.0, options.thresholdDb / 10.0)),
+      windowSquares ((size_t) channels, true),
+      preRoll (channels, (int) (jmax (0.0, options.preRollSeconds) * sampleRate) + windowSize),
+      offsetChannels ((size_t) channels)
+{
+    indexFile.deleteFile();
+    index = std::make_unique<FileOutputStream> (indexFile);
+
+    if (index->openedOk())
+    {
+        *index << "# sample rate " << String (sampleRate) << "\n"
+               << "# take start\tlength\tfile\tfile start\n";
+        index->flush();
+    }
+    else
+    {
+        index.reset();
+    }
+
+    // Without splitting, every stretch goes into the one file
+    if (! options.splitTakes)
+        currentPart = createPart (getPartFile (0));
+}
+
+SilenceGateWriter::~SilenceGateWriter()
+{
+    if (open)
+        closeGate();
+
+    currentPart.reset();
+}
+
+bool SilenceGateWriter::openedOk() const noexcept
+{
+    return index != nullptr && (options.splitTakes || currentPart != nullptr);
+}
+
+File SilenceGateWriter::getIndexFileFor (const File& audioFile)
+{
+    return File (audioFile.getFullPathName() + ".timeline");
+}
+
+//==============================================================================
+bool SilenceGateWriter::write (const float* const* channels, int numSamples)
+{
+    bool ok = true;
+
+    for (int done = 0; done < numSamples;)
+    {
+        auto num = jmin (numSamples - done, windowSize - samplesInWindow);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            auto lo = 0.0f, hi = 0.0f;
+            PeakOverview::measure (channels[ch] + done, num, lo, hi, windowSquares[ch]);
+        }
+
+        // (the decision is made at the end of each window - until then, samples go wherever
+        // the last one sent them)
+        if (open)
+            ok = writeKept (channels, done, num) && ok;
+        else
+            addToPreRoll (channels, done, num);
+
+        done += num;
+        samplesInWindow += num;
+        position += num;
+
+        if (samplesInWindow == windowSize)
+            endWindow();
+    }
+
+    return ok;
+}
+
+bool SilenceGateWriter::commit()
+{
+    if (index != nullptr)
+        index->flush();
+
+    return currentPart == nullptr || currentPart->commit();
+}
+
+int64 SilenceGateWriter::getNumBytesWritten() const
+{
+    return bytesInClosedParts + (currentPart != nullptr ? currentPart->getNumBytesWritten() : 0);
+}
+
+void SilenceGateWriter::setStartPosition (TimelinePosition startPosition)
+{
+    if (currentPart != nullptr)
+        currentPart->setStartPosition (startPosition);
+}
+
+//==============================================================================
+void SilenceGateWriter::endWindow()
+{
+    double loudest = 0.0;
+
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        loudest = jmax (loudest, windowSquares[ch]);
+        windowSquares[ch] = 0.0;
+    }
+
+    auto loud = loudest / samplesInWindow >= thresholdPower;
+    samplesInWindow = 0;
+
+    if (! open)
+    {
+        if (loud)
+            openGate();
+    }
+    else if (loud)
+    {
+        quietSamples = 0;
+    }
+    else if ((quietSamples += windowSize) >= holdSamples)
+    {
+        closeGate();
+    }
+}
+
+void SilenceGateWriter::openGate()
+{
+    if (currentPart == nullptr && options.splitTakes)
+    {
+        currentPart = createPart (getPartFile (partIndex));
+        positionInPart = 0;
+    }
+
+    open = true;
+    quietSamples = 0;
+
+    // The stretch starts with the pre-roll (which includes the window that opened the gate)
+    stretchStart = position - preRollCount;
+    stretchPartStart = positionInPart;
+
+    auto capacity = preRoll.getNumSamples();
+    auto firstPart = jmin (preRollCount, capacity - preRollStart);
+
+    writeKept (preRoll.getArrayOfReadPointers(), preRollStart, firstPart);
+    writeKept (preRoll.getArrayOfReadPointers(), 0, preRollCount - firstPart);
+
+    preRollStart = preRollCount = 0;
+}
+
+void SilenceGateWriter::closeGate()
+{
+    open = false;
+
+    if (index != nullptr)
+    {
+        *index << String (stretchStart) << "\t" << String (positionInPart - stretchPartStart) << "\t"
+               << getPartFile (partIndex).getFileName() << "\t" << String (stretchPartStart) << "\n";
+        index->flush();
+    }
+
+    // With splitting, the file is finished as soon as the stretch is
+    if (options.splitTakes && currentPart != nullptr)
+    {
+        bytesInClosedParts += currentPart->getNumBytesWritten();
+        currentPart.reset();
+        ++partIndex;
+    }
+}
+
+bool SilenceGateWriter::writeKept (const float* const* channels, int offset, int numSamples)
+{
+    if (numSamples <= 0)
+        return true;
+
+    if (currentPart == nullptr)
+        return false;
+
+    for (int ch = 0; ch < numChannels; ++ch)
+        offsetChannels[ch] = channels[ch] + offset;
+
+    positionInPart += numSamples;
+    samplesKept += numSamples;
+    return currentPart->write (offsetChannels, numSamples);
+}
+
+void SilenceGateWriter::addToPreRoll (const float* const* channels, int offset, int numSamples)
+{
+    auto capacity = preRoll.getNumSamples();
+
+    // (only the most recent capacity's worth can ever be needed)
+    if (numSamples > capacity)
+    {
+        offset += numSamples - capacity;
+        numSamples = capacity;
+    }
+
+    auto writePosition = (preRollStart + preRollCount) % capacity;
+
+    for (int done = 0; done < numSamples;)
+    {
+        auto num = jmin (numSamples - done, capacity - writePosition);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            preRoll.copyFrom (ch, writePosition, channels[ch] + offset + done, num);
+
+        done += num;
+        writePosition = (writePosition + num) % capacity;
+    }
+
+    // Anything that didn't fit pushed the oldest samples out
+    preRollCount += numSamples;
+
+    if (preRollCount > capacity)
+    {
+        preRollStart = (preRollStart + preRollCount - capacity) % capacity;
+        preRollCount = capacity;
+    }
+}
@@ -0,0 +1,112 @@
+/*
+  ==============================================================================
+
+    This file contains the writer that leaves silence out of a take.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "RecordingWriter.h"
+
+//==============================================================================
+/**
+    Only passes on the parts of a take that aren't silent, and keeps an index
+    of where they came from.
+
+    The take is measured in short windows (the energy of the loudest channel,
+    in one vectorised pass). The gate opens on the first window above the
+    threshold, and closes once the signal has stayed below it for the hold
+    time. While it's closed, the most recent pre-roll's worth of audio is kept
+    in a preallocated ring, so that the start of a sound isn't lost when it
+    opens again.
+
+    The audio that's kept either goes into one file, with the silences
+    collapsed out of it, or (with splitTakes) each stretch gets a file of its
+    own. Either way, the timeline index next to the take (see getIndexFileFor())
+    lists every stretch: where it starts in the take, how long it is, and which
+    file and position it's in. The take's midi file still covers the whole
+    take, so it lines up with the kept audio through the index.
+
+    Everything happens on the writer thread, so the audio thread does the same
+    work as for any other take.
+*/
+class SilenceGateWriter  : public RecordingWriter
+{
+public:
+    //==============================================================================
+    struct Options
+    {
+        bool enabled = false;
+        double thresholdDb = -60.0;     // the loudest channel's RMS over a window
+        double holdSeconds = 2.0;       // how long it has to stay below the threshold to close
+        double preRollSeconds = 0.5;    // how much is kept from before it opened
+        bool splitTakes = false;        // a file for each stretch, rather than one file
+    };
+
+    /** The file for a part of the take (0 is the first), and how to open it. Without
+        splitTakes only part 0 is used.
+    */
+    using PartFileFunction = std::function<File (int partIndex)>;
+    using PartFactory = std::function<std::unique_ptr<RecordingWriter> (const File& partFile)>;
+
+    SilenceGateWriter (const File& indexFile, PartFileFunction getPartFile, PartFactory createPart,
+                       int numChannels, double sampleRate, const Options& options);
+
+    /** Closes the last stretch and finalises the current file. */
+    ~SilenceGateWriter() override;
+
+    /** True if the index (and without splitTakes, the file) could be created. */
+    bool openedOk() const noexcept;
+
+    /** The timeline index for a take ("recording.wav.timeline"). */
+    static File getIndexFileFor (const File& audioFile);
+
+    //==============================================================================
+    bool write (const float* const* channels, int numSamples) override;
+    bool commit() override;
+
+    int getNumChannels() const override             { return numChannels; }
+    int64 getNumBytesWritten() const override;
+    void setStartPosition (TimelinePosition position) override;
+
+    /** How much of the take has been left out so far. */
+    int64 getNumSamplesSkipped() const noexcept     { return position - samplesKept; }
+
+private:
+    //==============================================================================
+    void endWindow();
+    void openGate();
+    void closeGate();
+    bool writeKept (const float* const* channels, int offset, int numSamples);
+    void addToPreRoll (const float* const* channels, int offset, int numSamples);
+
+    PartFileFunction getPartFile;
+    PartFactory createPart;
+    int numChannels;
+    Options options;
+
+    std::unique_ptr<RecordingWriter> currentPart;
+    std::unique_ptr<FileOutputStream> index;
+    int partIndex = 0;
+    int64 positionInPart = 0, bytesInClosedParts = 0;
+
+    // Gate state (in samples from the start of the take)
+    int windowSize;
+    int64 holdSamples;
+    double thresholdPower;
+    int samplesInWindow = 0;
+    HeapBlock<double> windowSquares;
+    bool open = false;
+    int64 position = 0, quietSamples = 0, samplesKept = 0;
+    int64 stretchStart = 0, stretchPartStart = 0;
+
+    AudioBuffer<float> preRoll;
+    int preRollStart = 0, preRollCount = 0;
+    HeapBlock<const float*> offsetChannels;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SilenceGateWriter)
+};
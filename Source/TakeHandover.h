@@ -0,0 +1,150 @@
+/*
+  ==============================================================================
+
+    This file contains the take handover shared by the audio and midi recorders.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/**
+    Passes writers from the message thread to a recorder's writer thread, and
+    publishes the requested take number to the audio thread.
+
+    The requested take is positive while recording and minus the last take once
+    stopped. The audio thread only ever reads that atomic; the pending writer
+    list is shared between the message thread and the writer thread.
+*/
+template <typename WriterType>
+class TakeHandover
+{
+public:
+    //==============================================================================
+    TakeHandover() = default;
+
+    //==============================================================================
+    /** Queues the writer for a new take and publishes its number. Message thread. */
+    int startTake (std::unique_ptr<WriterType> writer)
+    {
+        int take;
+
+        {
+            const ScopedLock sl (pendingLock);
+            take = nextTake++;
+
+            auto pending = new PendingTake();
+            pending->take = take;
+            pending->writer = std::move (writer);
+            pendingTakes.add (pending);
+        }
+
+        // The writer is already in the pending list, so whoever sees this number can find it
+        requestedTake = take;
+        return take;
+    }
+
+    /** Asks the audio thread to end the current take. Returns the take being stopped. */
+    int stopTake()
+    {
+        int lastTake;
+
+        {
+            const ScopedLock sl (pendingLock);
+            lastTake = nextTake - 1;
+        }
+
+        requestedTake = -lastTake;
+        return lastTake;
+    }
+
+    /** The take the audio thread should be feeding. Safe to call on the audio thread. */
+    int getRequestedTake() const noexcept       { return requestedTake.load(); }
+
+    /** True once the last take has been stopped and the writer thread has closed it, i.e.
+        the audio thread won't feed anything until the next startTake().
+    */
+    bool isIdle() const noexcept
+    {
+        auto requested = requestedTake.load();
+        return requested <= 0 && lastFinishedTake.load() >= -requested;
+    }
+
+    //==============================================================================
+    /** Called on the writer thread when it reaches a take boundary. Marks everything up
+        to the boundary as finished and returns the writer for the new take (if any).
+    */
+    std::unique_ptr<WriterType> switchToTake (int take, int previousTake)
+    {
+        std::unique_ptr<WriterType> nextWriter;
+        auto lastClosed = jmax (previousTake, take > 0 ? take - 1 : -take);
+
+        {
+            const ScopedLock sl (pendingLock);
+
+            for (int i = pendingTakes.size(); --i >= 0;)
+            {
+                auto* pending = pendingTakes.getUnchecked (i);
+
+                if (pending->take == take)
+                    nextWriter = std::move (pending->writer);
+
+                // Takes that were started and stopped again before the audio thread saw them
+                // never get a boundary of their own, so they're dropped here
+                if (pending->take == take || pending->take <= lastClosed)
+                    pendingTakes.remove (i);
+            }
+        }
+
+        lastFinishedTake = lastClosed;
+        takeFinished.signal();
+
+        return nextWriter;
+    }
+
+    /** True once the writer thread has closed the given take (and every take before it). */
+    bool isTakeFinished (int takeNumber) const noexcept     { return lastFinishedTake.load() >= takeNumber; }
+
+    /** Blocks the calling (non audio) thread until the writer thread has closed the
+        given take, or the timeout expires.
+    */
+    bool waitForTakeToFinish (int takeNumber, int timeoutMs)
+    {
+        auto endTime = Time::getMillisecondCounter() + (uint32) timeoutMs;
+
+        while (lastFinishedTake.load() < takeNumber)
+        {
+            auto now = Time::getMillisecondCounter();
+
+            if (now >= endTime)
+                return false;
+
+            takeFinished.wait ((int) (endTime - now));
+        }
+
+        return true;
+    }
+
+private:
+    //==============================================================================
+    struct PendingTake
+    {
+        int take;
+        std::unique_ptr<WriterType> writer;
+    };
+
+    std::atomic<int> requestedTake { 0 };
+
+    CriticalSection pendingLock;
+    OwnedArray<PendingTake> pendingTakes;
+    int nextTake = 1;
+
+    std::atomic<int> lastFinishedTake { 0 };
+    WaitableEvent takeFinished;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE (TakeHandover)
+};
@@ -0,0 +1,450 @@
+/*
+  ==============================================================================
+
+    This file contains the player that streams a recorded take back from disk,
+    for auditioning and overdubbing.
+
+  ==============================================================================
+*/
+
+#include "TakePlayer.h"
+
+//==============================================================================
+TakePlayer::TakePlayer()
+{
+    formatManager.registerBasicFormats();
+    events.malloc ((size_t) midiFifoSize);
+}
+
+TakePlayer::~TakePlayer()
+{
+}
+
+void TakePlayer::prepare (int numChannels, double rate, int prefetchSamples)
+{
+    sampleRate = rate;
+    prefetchSamples = jmax (1024, prefetchSamples);
+
+    ring.setSize (jmax (1, numChannels), prefetchSamples);
+    ring.clear();
+    ringFifo.setTotalSize (prefetchSamples);
+    midiFifo.reset();
+
+    // (reads are small enough that the ring is topped up a few times per window)
+    readChunk = jlimit (256, 16384, prefetchSamples / 4);
+
+    // Nothing is running, so every thread's state can simply be put back to stopped
+    {
+        const ScopedLock sl (requestLock);
+        request = {};
+    }
+
+    requestedSession = acknowledgedSession = finishedSession = readerSession = audioSession = 0;
+    audioState = State::stopped;
+    audioPosition = samplesToSkip = 0;
+    position = 0;
+
+    readers.clear();
+    readerChannels.clear();
+    sequence.clear();
+    primed = false;
+    finished = true;
+
+    resetStats();
+}
+
+//==============================================================================
+void TakePlayer::play (const File& audioFile, const File& midiFile, int64 startSample)
+{
+    const ScopedLock sl (requestLock);
+    request.audioFile = audioFile;
+    request.midiFile = midiFile;
+    request.startSample = jmax ((int64) 0, startSample);
+    request.play = true;
+    ++requestedSession;
+}
+
+void TakePlayer::stop()
+{
+    const ScopedLock sl (requestLock);
+    request = {};
+    ++requestedSession;
+}
+
+bool TakePlayer::isPlaying() const noexcept
+{
+    const ScopedLock sl (requestLock);
+    return request.play && finishedSession.load() != requestedSession.load();
+}
+
+TakePlayer::Stats TakePlayer::getStats() const noexcept
+{
+    Stats stats;
+    stats.underruns = underruns;
+    stats.underrunSamples = underrunSamples;
+    stats.lowestPrefetch = (double) lowestFill.load() / (double) jmax (1, ringFifo.getTotalSize());
+    stats.bytesRead = bytesRead;
+    stats.eventsPlayed = eventsPlayed;
+    return stats;
+}
+
+void TakePlayer::resetStats() noexcept
+{
+    underruns = underrunSamples = bytesRead = eventsPlayed = 0;
+    lowestFill = ringFifo.getTotalSize();
+}
+
+//==============================================================================
+bool TakePlayer::update() noexcept
+{
+    // A new request: let go of the rings, so the reader thread can empty them
+    auto requested = requestedSession.load();
+
+    if (requested != audioSession)
+    {
+        audioSession = requested;
+        audioState = State::waiting;
+        acknowledgedSession = requested;
+    }
+
+    if (audioState != State::waiting || readerSession.load() != audioSession)
+        return false;
+
+    // (the rings are ours again from here - wait for the read-ahead to fill, or the take to end)
+    auto allRead = finished.load();
+
+    if (! primed.load() && ! allRead)
+        return false;
+
+    audioPosition = sessionStart.load();
+    position = audioPosition;
+    samplesToSkip = 0;
+
+    if (allRead && ringFifo.getNumReady() == 0 && midiFifo.getNumReady() == 0)
+    {
+        audioState = State::stopped;
+        finishedSession = audioSession;
+        return false;
+    }
+
+    audioState = State::playing;
+    return true;
+}
+
+void TakePlayer::process (float* const* outputs, int numOutputs, int numSamples, MidiBuffer& midiOut) noexcept
+{
+    if (audioState != State::playing || numSamples <= 0)
+        return;
+
+    // (read before the ring, so that once everything's been read it's all visible)
+    auto allRead = finished.load();
+    auto numReady = ringFifo.getNumReady();
+
+    if (numReady < lowestFill.load())
+        lowestFill = numReady;
+
+    // Samples that arrived too late for an earlier block are skipped, to stay on the timeline
+    if (samplesToSkip > 0)
+    {
+        auto num = (int) jmin ((int64) numReady, samplesToSkip);
+        ringFifo.finishedRead (num);
+        samplesToSkip -= num;
+        numReady -= num;
+    }
+
+    // Midi first, up to the end of the block: anything late is sent at the start of it, so
+    // no note-off goes missing
+    auto blockEnd = audioPosition + numSamples;
+
+    while (midiFifo.getNumReady() > 0)
+    {
+        int start1, size1, start2, size2;
+        midiFifo.prepareToRead (1, start1, size1, start2, size2);
+        auto& event = events[start1];
+
+        if (event.sample >= blockEnd)
+            break;
+
+        midiOut.addEvent (event.data, event.numBytes, (int) jmax ((int64) 0, event.sample - audioPosition));
+        midiFifo.finishedRead (1);
+        ++eventsPlayed;
+    }
+
+    // Audio, mixed in on top of whatever's already in the outputs
+    auto num = jmin (numReady, numSamples);
+    auto numChannels = jmin (numOutputs, ring.getNumChannels());
+
+    if (num > 0)
+    {
+        int start1, size1, start2, size2;
+        ringFifo.prepareToRead (num, start1, size1, start2, size2);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            FloatVectorOperations::add (outputs[ch], ring.getReadPointer (ch, start1), size1);
+
+            if (size2 > 0)
+                FloatVectorOperations::add (outputs[ch] + size1, ring.getReadPointer (ch, start2), size2);
+        }
+
+        ringFifo.finishedRead (size1 + size2);
+    }
+
+    if (num < numSamples && ! allRead)
+    {
+        ++underruns;
+        underrunSamples += numSamples - num;
+        samplesToSkip += numSamples - num;
+    }
+
+    audioPosition = blockEnd;
+    position = audioPosition;
+
+    if (allRead && ringFifo.getNumReady() == 0 && midiFifo.getNumReady() == 0)
+    {
+        audioState = State::stopped;
+        finishedSession = audioSession;
+    }
+}
+
+//==============================================================================
+int TakePlayer::useTimeSlice()
+{
+    auto requested = requestedSession.load();
+
+    if (requested != readerSession.load())
+    {
+        // (the audio thread may still be reading the rings until it's seen the request)
+        if (acknowledgedSession.load() != requested)
+            return 5;
+
+        startSession (requested);
+    }
+
+    if (finished.load())
+        return 20;
+
+    return fill();
+}
+
+void TakePlayer::startSession (int session)
+{
+    Request next;
+
+    {
+        const ScopedLock sl (requestLock);
+        next = request;
+    }
+
+    // The audio thread has stopped reading, so we can stand in for it and empty the rings
+    ringFifo.reset();
+    midiFifo.reset();
+    readers.clear();
+    readerChannels.clear();
+    sequence.clear();
+    nextEvent = 0;
+    takeLength = 0;
+
+    if (next.play)
+    {
+        auto numChannels = 0;
+
+        for (auto& file : findAudioFiles (next.audioFile))
+        {
+            if (auto* reader = formatManager.createReaderFor (file))
+            {
+                readers.add (reader);
+                readerChannels.add (numChannels);
+                numChannels += (int) reader->numChannels;
+                takeLength = jmax (takeLength, reader->lengthInSamples);
+            }
+        }
+
+        if (numChannels > 0)
+            readBuffer.setSize (numChannels, readChunk);
+
+        // The midi file is small enough to load in one go; its events are then stamped with
+        // the sample they fall on, following the tempo changes in it
+        FileInputStream midiStream (next.midiFile);
+        MidiFile midiFile;
+
+        if (next.midiFile.existsAsFile() && midiStream.openedOk() && midiFile.readFrom (midiStream))
+        {
+            midiFile.convertTimestampTicksToSeconds();
+
+            for (int track = 0; track < midiFile.getNumTracks(); ++track)
+                sequence.addSequence (*midiFile.getTrack (track), 0.0);
+
+            for (auto* holder : sequence)
+                holder->message.setTimeStamp ((double) roundToInt (holder->message.getTimeStamp() * sampleRate));
+
+            if (sequence.getNumEvents() > 0)
+                takeLength = jmax (takeLength, (int64) sequence.getEndTime() + 1);
+
+            nextEvent = sequence.getNextIndexAtTime ((double) next.startSample);
+        }
+    }
+
+    fillPosition = jmin (next.startSample, takeLength);
+    sessionStart = next.startSample;
+    primed = false;
+    finished = fillPosition >= takeLength;
+
+    // (publishes everything above to the audio thread)
+    readerSession = session;
+}
+
+int TakePlayer::fill()
+{
+    auto numFree = ringFifo.getFreeSpace();
+
+    // Full: come back once a chunk's worth has been played
+    if (numFree < readChunk && fillPosition + numFree < takeLength)
+    {
+        primed = true;
+        return jmax (1, (int) (500.0 * readChunk / sampleRate));
+    }
+
+    auto num = (int) jmin ((int64) jmin (numFree, readChunk), takeLength - fillPosition);
+
+    // The midi for the stretch goes in first, so the audio thread always finds it there
+    while (nextEvent < sequence.getNumEvents())
+    {
+        auto& message = sequence.getEventPointer (nextEvent)->message;
+        auto sample = (int64) message.getTimeStamp();
+
+        if (sample >= fillPosition + num)
+            break;
+
+        if (message.isMetaEvent() || message.getRawDataSize() > maxEventBytes)
+        {
+            ++nextEvent;
+            continue;
+        }
+
+        // With the midi ring full, the audio stops short of the event that didn't fit (and
+        // that's as far ahead as we can get)
+        if (midiFifo.getFreeSpace() == 0)
+        {
+            num = (int) jmax ((int64) 0, sample - fillPosition);
+            primed = true;
+            break;
+        }
+
+        int start1, size1, start2, size2;
+        midiFifo.prepareToWrite (1, start1, size1, start2, size2);
+
+        auto& event = events[start1];
+        event.sample = sample;
+        event.numBytes = message.getRawDataSize();
+        memcpy (event.data, message.getRawData(), (size_t) event.numBytes);
+
+        midiFifo.finishedWrite (1);
+        ++nextEvent;
+    }
+
+    if (num <= 0)
+        return 1;
+
+    int start1, size1, start2, size2;
+    ringFifo.prepareToWrite (num, start1, size1, start2, size2);
+    readAudio (start1, size1, fillPosition);
+    readAudio (start2, size2, fillPosition + size1);
+    ringFifo.finishedWrite (size1 + size2);
+    fillPosition += size1 + size2;
+
+    if (fillPosition >= takeLength)
+    {
+        primed = true;
+        finished = true;
+    }
+
+    return 0;
+}
+
+void TakePlayer::readAudio (int ringStart, int numSamples, int64 takePosition)
+{
+    if (numSamples <= 0)
+        return;
+
+    // Without any audio, the take is silence under the midi
+    if (readers.isEmpty())
+    {
+        for (int ch = 0; ch < ring.getNumChannels(); ++ch)
+            ring.clear (ch, ringStart, numSamples);
+
+        return;
+    }
+
+    for (int done = 0; done < numSamples;)
+    {
+        auto num = jmin (numSamples - done, readBuffer.getNumSamples());
+        auto position = takePosition + done;
+
+        // Each file's channels go into their own part of the buffer (and past its end, it's silent)
+        for (int i = 0; i < readers.size(); ++i)
+        {
+            auto* reader = readers.getUnchecked (i);
+            AudioBuffer<float> channels (readBuffer.getArrayOfWritePointers() + readerChannels[i], (int) reader->numChannels, num);
+            auto numFromFile = (int) jlimit ((int64) 0, (int64) num, reader->lengthInSamples - position);
+
+            if (numFromFile > 0)
+            {
+                reader->read (&channels, 0, numFromFile, position, true, true);
+                bytesRead += (int64) numFromFile * reader->numChannels * (reader->bitsPerSample / 8);
+            }
+
+            if (numFromFile < num)
+                channels.clear (numFromFile, num - numFromFile);
+        }
+
+        // A take with fewer channels than the output is repeated across it (mono to both sides)
+        for (int ch = 0; ch < ring.getNumChannels(); ++ch)
+            ring.copyFrom (ch, ringStart + done, readBuffer, ch % readBuffer.getNumChannels(), 0, num);
+
+        done += num;
+    }
+}
+
+Array<File> TakePlayer::findAudioFiles (const File& audioFile)
+{
+    if (audioFile.existsAsFile())
+        return { audioFile };
+
+    // The group files follow on from each other, so the ones on disk are looked up by their first
+    // channel and followed from channel 1 for as long as there's no gap
+    Array<File> groupFiles;
+    Array<int> firstChannels, numChannels;
+
+    for (auto& file : audioFile.getParentDirectory().findChildFiles (File::findFiles, false,
+                                                                     audioFile.getFileNameWithoutExtension() + "-ch*"
+                                                                       + audioFile.getFileExtension()))
+    {
+        auto range = file.getFileNameWithoutExtension().fromLastOccurrenceOf ("-ch", false, false);
+        auto first = range.upToFirstOccurrenceOf ("-", false, false).getIntValue() - 1;
+        auto num = range.fromFirstOccurrenceOf ("-", false, false).getIntValue() - first;
+
+        // (anything else that happens to match the wildcard is left out)
+        if (first >= 0 && num > 0 && ParallelEncodingWriter::getGroupFile (audioFile, first, num) == file)
+        {
+            groupFiles.add (file);
+            firstChannels.add (first);
+            numChannels.add (num);
+        }
+    }
+
+    Array<File> files;
+
+    for (int first = 0;;)
+    {
+        auto index = firstChannels.indexOf (first);
+
+        if (index < 0)
+            break;
+
+        files.add (groupFiles[index]);
+        first += numChannels[index];
+    }
+
+    return files;
+}
@@ -0,0 +1,164 @@
+/*
+  ==============================================================================
+
+    This file contains the player that streams a recorded take back from disk,
+    for auditioning and overdubbing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "ParallelEncodingWriter.h"
+
+//==============================================================================
+/**
+    Plays a take (an audio file and a midi file) into the processor's output,
+    streaming it from disk without the audio thread ever waiting for the disk.
+
+    The files are read on one of the writer threads (the player is a
+    TimeSliceClient, registered with the RecordingIOService like the recorders),
+    which keeps a read-ahead ring filled a prefetch window ahead of the audio
+    thread. The midi file is loaded on the same thread, and its events are
+    passed to the audio thread through a second ring, stamped with the sample
+    they fall on, always ahead of the audio they go with. The audio thread only
+    ever copies out of the two rings. A compressed take that was split into a
+    file per group of channels (see ParallelEncodingWriter::getGroupFile) is
+    read from all of them at once, with their channels side by side.
+
+    Playing or stopping bumps an atomic session number. The audio thread
+    acknowledges a new session at the top of its next callback and stops
+    reading the rings; the reader thread then empties them, opens the files and
+    fills the ring up, and playback starts at the top of the first callback after
+    that (see update()). A block that finds less audio in the ring than it needs
+    is counted as an underrun: the missing samples are played as silence and
+    skipped once they arrive, so the take never drifts against the timeline.
+*/
+class TakePlayer  : public TimeSliceClient
+{
+public:
+    //==============================================================================
+    TakePlayer();
+    ~TakePlayer() override;
+
+    /** Allocates the read-ahead ring, prefetchSamples long, for up to numChannels outputs,
+        and stops anything that was playing. Only call this while neither the audio callback
+        nor the reader thread is running.
+    */
+    void prepare (int numChannels, double sampleRate, int prefetchSamples);
+
+    //==============================================================================
+    /** Starts playing a take from startSample (either file can be File() to leave it out, and if
+        the audio file doesn't exist, its channel-group files are played instead).
+        Returns straight away: the files are opened on the reader thread, and the audio
+        starts once the read-ahead is full.
+    */
+    void play (const File& audioFile, const File& midiFile, int64 startSample = 0);
+
+    void stop();
+
+    /** True from play() until the audio thread reaches the end of the take (or stop()). */
+    bool isPlaying() const noexcept;
+
+    /** The position in the take of the audio thread's next sample. */
+    int64 getPosition() const noexcept                      { return position.load(); }
+
+    int getPrefetchSamples() const noexcept                 { return ringFifo.getTotalSize(); }
+
+    struct Stats
+    {
+        int64 underruns = 0, underrunSamples = 0;  // blocks that ran out, and the samples missing
+        double lowestPrefetch = 1.0;                // the emptiest the ring got, as a proportion
+        int64 bytesRead = 0;                        // audio decoded from the file (as PCM)
+        int64 eventsPlayed = 0;
+    };
+
+    Stats getStats() const noexcept;
+    void resetStats() noexcept;
+
+    //==============================================================================
+    /** Picks up play and stop requests. Call at the top of each callback on the audio thread;
+        returns true if playback starts with this block.
+    */
+    bool update() noexcept;
+
+    /** Adds the next numSamples of the take to the outputs, and its midi to midiOut. Called on
+        the audio thread after update(); never blocks.
+    */
+    void process (float* const* outputs, int numOutputs, int numSamples, MidiBuffer& midiOut) noexcept;
+
+    //==============================================================================
+    int useTimeSlice() override;
+
+private:
+    //==============================================================================
+    struct Request
+    {
+        File audioFile, midiFile;
+        int64 startSample = 0;
+        bool play = false;
+    };
+
+    static constexpr int midiFifoSize = 4096;
+
+    // (longer sysex messages aren't played)
+    static constexpr int maxEventBytes = 32;
+
+    struct Event
+    {
+        int64 sample;
+        int numBytes;
+        uint8 data[maxEventBytes];
+    };
+
+    void startSession (int session);
+    int fill();
+    void readAudio (int ringStart, int numSamples, int64 takePosition);
+    static Array<File> findAudioFiles (const File& audioFile);
+
+    enum class State
+    {
+        waiting = 0,
+        playing,
+        stopped
+    };
+
+    // Message thread
+    CriticalSection requestLock;
+    Request request;
+    std::atomic<int> requestedSession { 0 };
+
+    // Audio thread
+    int audioSession = 0;
+    State audioState = State::stopped;
+    int64 audioPosition = 0, samplesToSkip = 0;
+    std::atomic<int> acknowledgedSession { 0 }, finishedSession { 0 };
+    std::atomic<int64> position { 0 };
+
+    // Reader thread
+    AudioFormatManager formatManager;
+    OwnedArray<AudioFormatReader> readers;
+    Array<int> readerChannels;              // (each reader's first channel in the take)
+    AudioBuffer<float> readBuffer;
+    MidiMessageSequence sequence;
+    int nextEvent = 0;
+    int64 fillPosition = 0, takeLength = 0;
+    std::atomic<int> readerSession { 0 };
+    std::atomic<int64> sessionStart { 0 };
+    std::atomic<bool> primed { false }, finished { true };
+
+    // The rings
+    AudioBuffer<float> ring;
+    AbstractFifo ringFifo { 1 };
+    HeapBlock<Event> events;
+    AbstractFifo midiFifo { midiFifoSize };
+    double sampleRate = 44100.0;
+    int readChunk = 4096;
+
+    std::atomic<int64> underruns { 0 }, underrunSamples { 0 }, bytesRead { 0 }, eventsPlayed { 0 };
+    std::atomic<int> lowestFill { 0 };
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TakePlayer)
+};
@@ -0,0 +1,112 @@
+/*
+  ==============================================================================
+
+    This file contains the background opening of the next take's files, so
+    Record doesn't have to wait for the disk.
+
+  ==============================================================================
+*/
+
+#include "TakePreparer.h"
+
+//==============================================================================
+TakePreparer::TakePreparer()
+{
+}
+
+TakePreparer::~TakePreparer()
+{
+    for (auto& job : jobs)
+        pool.waitForJobToFinish (&job, -1);
+
+    claim();
+}
+
+ThreadPoolJob::JobStatus TakePreparer::Job::runJob()
+{
+    if (previous != nullptr)
+    {
+        discard (std::move (previous->take));
+        previous = nullptr;
+        discard = nullptr;
+    }
+
+    open (*take);
+    open = nullptr;
+    return jobHasFinished;
+}
+
+//==============================================================================
+void TakePreparer::prepare (const File& audioFile, const File& midiFile, const String& settings, OpenFunction open)
+{
+    if (pending)
+        return;
+
+    pool.addJob (&startJob (audioFile, midiFile, settings, std::move (open)), false);
+}
+
+void TakePreparer::replace (const File& audioFile, const File& midiFile, const String& settings, OpenFunction open, DiscardFunction discard)
+{
+    if (! pending)
+    {
+        prepare (audioFile, midiFile, settings, std::move (open));
+        return;
+    }
+
+    // (the other job can only still be running if takes were replaced in quick succession)
+    auto& previous = jobs[current];
+    pool.waitForJobToFinish (&jobs[1 - current], -1);
+
+    auto& job = startJob (audioFile, midiFile, settings, std::move (open));
+    job.previous = &previous;
+    job.discard = std::move (discard);
+    pool.addJob (&job, false);
+}
+
+TakePreparer::Job& TakePreparer::startJob (const File& audioFile, const File& midiFile, const String& settings, OpenFunction open)
+{
+    // (the job only touches the take until it finishes, and it's only read after waiting for that)
+    if (pending)
+        current = 1 - current;
+
+    auto& job = jobs[current];
+    job.take = std::make_unique<Take>();
+    job.take->audioFile = audioFile;
+    job.take->midiFile = midiFile;
+    job.take->settings = settings;
+    job.open = std::move (open);
+
+    pending = true;
+    return job;
+}
+
+File TakePreparer::getAudioFile() const
+{
+    return pending ? jobs[current].take->audioFile : File();
+}
+
+File TakePreparer::getMidiFile() const
+{
+    return pending ? jobs[current].take->midiFile : File();
+}
+
+String TakePreparer::getSettings() const
+{
+    return pending ? jobs[current].take->settings : String();
+}
+
+bool TakePreparer::isReady() const
+{
+    return pending && ! pool.contains (&jobs[current]);
+}
+
+std::unique_ptr<TakePreparer::Take> TakePreparer::claim()
+{
+    if (! pending)
+        return nullptr;
+
+    pool.waitForJobToFinish (&jobs[current], -1);
+    pending = false;
+
+    return std::move (jobs[current].take);
+}
@@ -0,0 +1,107 @@
+/*
+  ==============================================================================
+
+    This file contains the background opening of the next take's files, so
+    Record doesn't have to wait for the disk.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "MidiFileStreamWriter.h"
+#include "RecordingWriter.h"
+
+//==============================================================================
+/**
+    Opens the files and writers for the next take on a background thread, and
+    keeps them open until they're claimed.
+
+    Creating a take's files can take a while (the directory, deleting an old
+    file, opening the stream, writing the header, preallocating), especially on
+    network or slow storage. With a take prepared in advance, starting it only
+    means handing the writers over to the recorders.
+
+    Only one take is prepared at a time. The settings it was opened with are
+    kept as a string, so a take that was prepared before the settings changed
+    can be told apart and thrown away. replace() throws it away on the
+    background thread too, so a different take can be asked for without ever
+    waiting for the disk.
+*/
+class TakePreparer
+{
+public:
+    //==============================================================================
+    struct Take
+    {
+        File audioFile, midiFile;
+        String settings;
+        int64 audioDevice = 0, midiDevice = 0;     // (see RecordingIOService::getDeviceId)
+        std::unique_ptr<RecordingWriter> audioWriter;
+        std::unique_ptr<MidiFileStreamWriter> midiWriter;
+    };
+
+    /** Opens the writers for a take (called on the background thread). */
+    using OpenFunction = std::function<void (Take&)>;
+
+    /** Closes a take that's no longer wanted, and deletes its files (also on the background thread). */
+    using DiscardFunction = std::function<void (std::unique_ptr<Take>)>;
+
+    TakePreparer();
+
+    /** Waits for any take being prepared, then closes it (without deleting its files). */
+    ~TakePreparer();
+
+    //==============================================================================
+    /** Starts preparing a take in the background. Does nothing if one is already
+        prepared (or being prepared) - claim it first.
+    */
+    void prepare (const File& audioFile, const File& midiFile, const String& settings, OpenFunction open);
+
+    /** Starts preparing a take in place of the one that's prepared (or being prepared), which
+        is passed to discard first on the background thread. Only waits if the take before that
+        one is somehow still being thrown away.
+    */
+    void replace (const File& audioFile, const File& midiFile, const String& settings, OpenFunction open, DiscardFunction discard);
+
+    /** The files and settings of the take that's prepared or being prepared, or File() and an
+        empty string if there isn't one.
+    */
+    File getAudioFile() const;
+    File getMidiFile() const;
+    String getSettings() const;
+
+    /** True if a take is prepared and has finished opening, so claim() won't wait. */
+    bool isReady() const;
+
+    /** Hands over the prepared take, waiting for it to finish opening if it hasn't yet.
+        Returns nullptr if nothing is prepared.
+    */
+    std::unique_ptr<Take> claim();
+
+private:
+    //==============================================================================
+    struct Job  : public ThreadPoolJob
+    {
+        Job() : ThreadPoolJob ("Take preparer") {}
+        JobStatus runJob() override;
+
+        OpenFunction open;
+        std::unique_ptr<Take> take;
+
+        // (the job before this one has always finished by the time this one runs)
+        Job* previous = nullptr;
+        DiscardFunction discard;
+    };
+
+    Job& startJob (const File& audioFile, const File& midiFile, const String& settings, OpenFunction open);
+
+    ThreadPool pool { 1 };
+    Job jobs[2];                // (taking turns, so one can throw away the other's take)
+    int current = 0;
+    bool pending = false;       // (message thread only)
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TakePreparer)
+};
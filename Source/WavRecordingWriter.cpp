@@ -0,0 +1,237 @@
+/*
+  ==============================================================================
+
+    This file contains the WAV writer used for uncompressed recordings.
+
+  ==============================================================================
+*/
+
+#include "WavRecordingWriter.h"
+#include "SampleConversion.h"
+#include "SeekIndex.h"
+
+//==============================================================================
+int WavRecordingWriter::getBitsPerSample (SampleFormat format) noexcept
+{
+    switch (format)
+    {
+        case SampleFormat::int16:   return 16;
+        case SampleFormat::int24:   return 24;
+        case SampleFormat::int32:
+        case SampleFormat::float32: return 32;
+    }
+
+    return 16;
+}
+
+WavRecordingWriter::WavRecordingWriter (std::unique_ptr<OutputStream> destStream,
+                                        double rate, int channels, SampleFormat sampleFormat,
+                                        SampleConversion::Ditherer::Mode ditherMode)
+    : stream (std::move (destStream)),
+      sampleRate (rate),
+      format (sampleFormat),
+      numChannels (channels),
+      bitsPerSample (getBitsPerSample (sampleFormat)),
+      bytesPerFrame (channels * bitsPerSample / 8),
+      // (there's nothing to dither once the samples are 32 bits wide)
+      ditherer (bitsPerSample < 32 ? ditherMode : SampleConversion::Ditherer::Mode::none, channels)
+{
+    ok = stream != nullptr && numChannels > 0;
+
+    if (! ok)
+        return;
+
+    conversionBuffer.malloc ((size_t) (blockSize * bytesPerFrame));
+    offsetChannels.malloc ((size_t) numChannels);
+
+    if (ditherer.getMode() != SampleConversion::Ditherer::Mode::none)
+        ditherBuffer.setSize (numChannels, blockSize);
+
+    headerStart = stream->getPosition();
+    ok = writeHeader();
+}
+
+WavRecordingWriter::WavRecordingWriter (std::unique_ptr<MappedFileOutputStream> destStream,
+                                        double rate, int channels, SampleFormat sampleFormat,
+                                        SampleConversion::Ditherer::Mode ditherMode)
+    : WavRecordingWriter (std::unique_ptr<OutputStream> (destStream.release()), rate, channels, sampleFormat, ditherMode)
+{
+    mappedStream = static_cast<MappedFileOutputStream*> (stream.get());
+}
+
+WavRecordingWriter::~WavRecordingWriter()
+{
+    if (stream == nullptr)
+        return;
+
+    // Chunks have to be padded to an even length
+    if (((numSamplesWritten * bytesPerFrame) & 1) != 0)
+        stream->writeByte (0);
+
+    writeHeader();
+    stream->flush();
+}
+
+//==============================================================================
+bool WavRecordingWriter::write (const float* const* channels, int numSamples)
+{
+    if (! ok)
+        return false;
+
+    for (int pos = 0; pos < numSamples; pos += blockSize)
+    {
+        auto num = jmin (blockSize, numSamples - pos);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            offsetChannels[ch] = channels[ch] + pos;
+
+        auto numBytes = (size_t) (num * bytesPerFrame);
+
+        // With a mapped file the samples are converted straight into the file's pages
+        if (mappedStream != nullptr)
+        {
+            if (auto* dest = mappedStream->getWritePointer (numBytes))
+            {
+                convert (offsetChannels, num, dest);
+                mappedStream->advance (numBytes);
+                numSamplesWritten += num;
+                continue;
+            }
+        }
+
+        // A mono float take is already in its final layout, so it can go straight to the stream
+        auto* data = (const void*) offsetChannels[0];
+
+        if (format != SampleFormat::float32 || numChannels > 1)
+        {
+            convert (offsetChannels, num, conversionBuffer);
+            data = conversionBuffer;
+        }
+
+        if (! stream->write (data, numBytes))
+        {
+            ok = false;
+            return false;
+        }
+
+        numSamplesWritten += num;
+    }
+
+    return true;
+}
+
+bool WavRecordingWriter::commit()
+{
+    if (! ok)
+        return false;
+
+    // (an odd pad byte is left for the destructor - readers only need the sizes to be right)
+    ok = writeHeader();
+    stream->flush();
+    return ok;
+}
+
+bool WavRecordingWriter::writeSeekIndex (const File& indexFile) const
+{
+    if (! ok)
+        return false;
+
+    // (the header is the same size as an RF64 one, so the data never moves)
+    SeekIndex index (SeekIndex::Kind::wavFrames, sampleRate, bytesPerFrame);
+    index.addPoint (0, dataStart);
+    return index.save (indexFile);
+}
+
+void WavRecordingWriter::convert (const float* const* channels, int numSamples, void* dest) noexcept
+{
+    if (ditherer.getMode() != SampleConversion::Ditherer::Mode::none)
+    {
+        // One quantisation step, relative to full scale
+        auto stepSize = 1.0f / (float) (1 << (bitsPerSample - 1));
+
+        for (int ch = 0; ch < numChannels; ++ch)
+        {
+            ditherBuffer.copyFrom (ch, 0, channels[ch], numSamples);
+            ditherer.process (ditherBuffer.getWritePointer (ch), ch, numSamples, stepSize);
+        }
+
+        channels = ditherBuffer.getArrayOfReadPointers();
+    }
+
+    switch (format)
+    {
+        case SampleFormat::int16:   SampleConversion::floatToInt16Interleaved   (channels, numChannels, numSamples, dest); break;
+        case SampleFormat::int24:   SampleConversion::floatToInt24Interleaved   (channels, numChannels, numSamples, dest); break;
+        case SampleFormat::int32:   SampleConversion::floatToInt32Interleaved   (channels, numChannels, numSamples, dest); break;
+        case SampleFormat::float32: SampleConversion::floatToFloat32Interleaved (channels, numChannels, numSamples, dest); break;
+    }
+}
+
+//==============================================================================
+bool WavRecordingWriter::writeHeader()
+{
+    auto dataSize = (uint64) numSamplesWritten * (uint64) bytesPerFrame;
+    auto isFloat = format == SampleFormat::float32;
+    auto isExtensible = numChannels > 2 || (bitsPerSample > 16 && ! isFloat);
+    auto fmtSize = isExtensible ? 40 : 16;
+    auto riffSize = (uint64) (4 + (8 + 28) + (8 + fmtSize) + 8) + dataSize + (dataSize & 1);
+    auto isRF64 = riffSize > 0xffffffffull;
+
+    auto end = stream->getPosition();
+
+    if (! stream->setPosition (headerStart))
+        return false;
+
+    stream->write (isRF64 ? "RF64" : "RIFF", 4);
+    stream->writeInt (isRF64 ? -1 : (int) (uint32) riffSize);
+    stream->write ("WAVE", 4);
+
+    // The JUNK chunk becomes the ds64 chunk once the sizes no longer fit in 32 bits
+    if (isRF64)
+    {
+        stream->write ("ds64", 4);
+        stream->writeInt (28);
+        stream->writeInt64 ((int64) riffSize);
+        stream->writeInt64 ((int64) dataSize);
+        stream->writeInt64 (numSamplesWritten);
+        stream->writeInt (0);
+    }
+    else
+    {
+        stream->write ("JUNK", 4);
+        stream->writeInt (28);
+        stream->writeRepeatedByte (0, 28);
+    }
+
+    stream->write ("fmt ", 4);
+    stream->writeInt (fmtSize);
+    stream->writeShort ((short) (isExtensible ? 0xfffe : (isFloat ? 3 : 1)));
+    stream->writeShort ((short) numChannels);
+    stream->writeInt ((int) sampleRate);
+    stream->writeInt ((int) sampleRate * bytesPerFrame);
+    stream->writeShort ((short) bytesPerFrame);
+    stream->writeShort ((short) bitsPerSample);
+
+    if (isExtensible)
+    {
+        // KSDATAFORMAT_SUBTYPE_PCM / KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+        uint8 subFormat[] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                              0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+
+        if (isFloat)
+            subFormat[0] = 0x03;
+
+        stream->writeShort (22);
+        stream->writeShort ((short) bitsPerSample);
+        stream->writeInt (numChannels == 1 ? 4 : (numChannels == 2 ? 3 : 0));
+        stream->write (subFormat, sizeof (subFormat));
+    }
+
+    stream->write ("data", 4);
+    auto result = stream->writeInt (isRF64 ? -1 : (int) (uint32) dataSize);
+
+    dataStart = stream->getPosition();
+
+    // (when called for the first time we're already at the end)
+    return stream->setPosition (jmax (end, dataStart)) && result;
+}
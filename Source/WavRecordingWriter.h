@@ -0,0 +1,103 @@
+/*
+  ==============================================================================
+
+    This file contains the WAV writer used for uncompressed recordings.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "MappedFileOutputStream.h"
+#include "RecordingWriter.h"
+#include "SampleConversion.h"
+
+//==============================================================================
+/**
+    Writes interleaved PCM WAV files with any number of channels, using the
+    vectorised kernels in SampleConversion instead of JUCE's per-sample
+    converters.
+
+    16 and 24-bit files can be dithered on the way. 32-bit float files are
+    written without any per-sample conversion. Given a MappedFileOutputStream,
+    the conversion writes straight into the mapped file.
+
+    Files with more than two channels or more than 16 bits use
+    WAVE_FORMAT_EXTENSIBLE. A JUNK chunk is reserved after the RIFF header so the
+    file can be promoted to RF64 when the take grows past 4GB.
+*/
+class WavRecordingWriter  : public RecordingWriter
+{
+public:
+    //==============================================================================
+    enum class SampleFormat
+    {
+        int16 = 0,
+        int24,
+        int32,
+        float32
+    };
+
+    static int getBitsPerSample (SampleFormat format) noexcept;
+
+    //==============================================================================
+    WavRecordingWriter (std::unique_ptr<OutputStream> destStream,
+                        double sampleRate, int numChannels, SampleFormat format,
+                        SampleConversion::Ditherer::Mode ditherMode = SampleConversion::Ditherer::Mode::none);
+
+    /** Writes through a memory-mapped file: samples are converted straight into the
+        mapped pages instead of a buffer that's then copied to the stream.
+    */
+    WavRecordingWriter (std::unique_ptr<MappedFileOutputStream> destStream,
+                        double sampleRate, int numChannels, SampleFormat format,
+                        SampleConversion::Ditherer::Mode ditherMode = SampleConversion::Ditherer::Mode::none);
+
+    /** Rewrites the header with the final sizes. */
+    ~WavRecordingWriter() override;
+
+    /** True if the stream was valid and the format is one we can write. */
+    bool openedOk() const noexcept                  { return ok; }
+
+    SampleFormat getSampleFormat() const noexcept   { return format; }
+
+    //==============================================================================
+    bool write (const float* const* channels, int numSamples) override;
+
+    /** Rewrites the header with the sizes so far, so the file is valid up to here. */
+    bool commit() override;
+
+    int getNumChannels() const override             { return numChannels; }
+    int64 getNumBytesWritten() const override       { return stream != nullptr ? stream->getPosition() : 0; }
+
+    /** Saves a SeekIndex for the file. Every frame is the same size, so it only needs the
+        one point (the first frame), and it's written straight away.
+    */
+    bool writeSeekIndex (const File& indexFile) const;
+
+    int getBytesPerFrame() const noexcept           { return bytesPerFrame; }
+    int64 getNumSamplesWritten() const noexcept     { return numSamplesWritten; }
+
+private:
+    //==============================================================================
+    bool writeHeader();
+    void convert (const float* const* channels, int numSamples, void* dest) noexcept;
+
+    std::unique_ptr<OutputStream> stream;
+    MappedFileOutputStream* mappedStream = nullptr;     // the same stream, if it's mapped
+    double sampleRate;
+    SampleFormat format;
+    int numChannels, bitsPerSample, bytesPerFrame;
+    int64 numSamplesWritten = 0, headerStart = 0, dataStart = 0;
+    bool ok = true;
+
+    static constexpr int blockSize = 4096;
+    HeapBlock<uint8> conversionBuffer;
+    HeapBlock<const float*> offsetChannels;
+
+    SampleConversion::Ditherer ditherer;
+    AudioBuffer<float> ditherBuffer;
+
+    //==============================================================================
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (WavRecordingWriter)
+};